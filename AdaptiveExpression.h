@@ -0,0 +1,435 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "ExpressionCompiler.h"
+
+/* Profile-guided rewriting */
+
+// Rough cost of evaluating expr, in nodes; function calls count more since
+// they are usually not cheap builtins.
+double estimateCost(TConstExpressionPtr expr)
+{
+  switch (expr->Kind) {
+    case EExpressionKind::Literal:
+      return 0;
+    case EExpressionKind::Reference:
+      return 1;
+    case EExpressionKind::BinaryOp: {
+      const TBinaryOpExpression* binOpExpr = static_cast<const TBinaryOpExpression*>(expr);
+      return 1 + estimateCost(binOpExpr->Lhs) + estimateCost(binOpExpr->Rhs);
+    }
+    case EExpressionKind::Function: {
+      const TFunctionExpression* funExpr = static_cast<const TFunctionExpression*>(expr);
+      double cost = 10;
+      for (auto args = funExpr->Arguments.begin();
+           args != funExpr->Arguments.end();
+           args++) {
+        cost += estimateCost(*args);
+      }
+      return cost;
+    }
+  }
+  return 1;
+}
+
+bool isLogicalOp(TConstExpressionPtr expr, EBinaryOp opcode)
+{
+  const TBinaryOpExpression* binOpExpr = expr->As<TBinaryOpExpression>();
+  return binOpExpr
+    && binOpExpr->Opcode == opcode
+    && typeOf(expr) == EValueType::Boolean;
+}
+
+// Returns the probability of the boolean expression expr being true and
+// records it, together with those of its && and || operands, in hints.
+// Nodes counted in profile use their measured selectivity, i.e. over the
+// rows where they were evaluated: for the right operand of && or || that
+// is conditional on the left one (see LLVMCodegen::SetProfile). The others
+// are estimated from their operands assuming independence, or taken as 0.5.
+double estimateTrueProbability(
+  TConstExpressionPtr expr,
+  const TExpressionProfile& profile,
+  TBranchHints* hints)
+{
+  double probability = 0.5;
+  if (isLogicalOp(expr, EBinaryOp::And) || isLogicalOp(expr, EBinaryOp::Or)) {
+    const TBinaryOpExpression* binOpExpr = static_cast<const TBinaryOpExpression*>(expr);
+    double lhs = estimateTrueProbability(binOpExpr->Lhs, profile, hints);
+    double rhs = estimateTrueProbability(binOpExpr->Rhs, profile, hints);
+    probability = binOpExpr->Opcode == EBinaryOp::And
+      ? lhs * rhs
+      : 1 - (1 - lhs) * (1 - rhs);
+  }
+
+  int id = profile.GetId(expr);
+  if (profile.IsInstrumented(id) && profile.GetCounters(id).Rows > 0) {
+    probability = profile.GetSelectivity(id);
+  }
+
+  (*hints)[expr] = probability;
+  return probability;
+}
+
+void flattenTerms(
+  TConstExpressionPtr expr,
+  EBinaryOp opcode,
+  std::vector<TConstExpressionPtr>* terms)
+{
+  if (isLogicalOp(expr, opcode)) {
+    const TBinaryOpExpression* binOpExpr = static_cast<const TBinaryOpExpression*>(expr);
+    flattenTerms(binOpExpr->Lhs, opcode, terms);
+    flattenTerms(binOpExpr->Rhs, opcode, terms);
+  } else {
+    terms->push_back(expr);
+  }
+}
+
+// Whether evaluating expr may trap: integer division and modulo fault on a
+// zero divisor, and functions are not known to be safe on every row.
+bool canTrap(TConstExpressionPtr expr)
+{
+  switch (expr->Kind) {
+    case EExpressionKind::BinaryOp: {
+      const TBinaryOpExpression* binOpExpr = static_cast<const TBinaryOpExpression*>(expr);
+      if ((binOpExpr->Opcode == EBinaryOp::Divide || binOpExpr->Opcode == EBinaryOp::Modulo)
+          && typeOf(binOpExpr->Lhs) != EValueType::Double) {
+        return true;
+      }
+      return canTrap(binOpExpr->Lhs) || canTrap(binOpExpr->Rhs);
+    }
+    case EExpressionKind::Function:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Reorders the terms of && and || chains so that cheap terms likely to
+// decide the result are evaluated first: && terms by ascending
+// cost / P(false), || terms by ascending cost / P(true). The profile only
+// gives the rate of a term over the rows reaching it, so P of all but the
+// first term is conditional on the terms before; terms are ranked as if
+// independent. Terms that may trap (see canTrap) stay in place and no term
+// moves across them, since the terms before may guard them. Terms keep
+// their nodes, so the profile still applies to them; new chains are
+// allocated from arena.
+TConstExpressionPtr reorderConjuncts(
+  TConstExpressionPtr expr,
+  const TExpressionProfile& profile,
+  TExpressionArena* arena)
+{
+  EBinaryOp opcode;
+  if (isLogicalOp(expr, EBinaryOp::And)) {
+    opcode = EBinaryOp::And;
+  } else if (isLogicalOp(expr, EBinaryOp::Or)) {
+    opcode = EBinaryOp::Or;
+  } else {
+    return expr;
+  }
+
+  std::vector<TConstExpressionPtr> terms;
+  flattenTerms(expr, opcode, &terms);
+
+  std::vector<std::pair<double, TConstExpressionPtr>> ranked;
+  TBranchHints unused;
+  for (auto term = terms.begin(); term != terms.end(); term++) {
+    double probability = estimateTrueProbability(*term, profile, &unused);
+    double decisive = opcode == EBinaryOp::And ? 1 - probability : probability;
+    double rank = estimateCost(*term) / std::max(decisive, 1e-6);
+    ranked.push_back(std::make_pair(rank, reorderConjuncts(*term, profile, arena)));
+  }
+  // Sorts each run of terms between two that may trap.
+  size_t runBegin = 0;
+  for (size_t i = 0; i <= terms.size(); i++) {
+    if (i < terms.size() && !canTrap(terms[i])) {
+      continue;
+    }
+    std::stable_sort(
+      ranked.begin() + runBegin,
+      ranked.begin() + i,
+      [] (const std::pair<double, TConstExpressionPtr>& lhs,
+          const std::pair<double, TConstExpressionPtr>& rhs) {
+        return lhs.first < rhs.first;
+      });
+    runBegin = i + 1;
+  }
+
+  TConstExpressionPtr result = ranked[0].second;
+  for (size_t i = 1; i < ranked.size(); i++) {
+    result = arena->NewBinaryOp(EValueType::Null, opcode, result, ranked[i].second);
+  }
+  return result;
+}
+
+/* Value profiling */
+
+// Counts values sampled from the columns an expression references, to find
+// columns that are nearly constant.
+class TValueSampler {
+public:
+  static const size_t MaxDistinctValues = 64;
+
+  explicit TValueSampler(TConstExpressionPtr expr)
+  {
+    CollectColumns(expr);
+  }
+
+  // Samples up to sampleCount rows spread over the batch.
+  void Sample(TRow* rows, i64 count, int sampleCount)
+  {
+    i64 step = std::max<i64>(1, count / sampleCount);
+    for (i64 i = 0; i < count; i += step) {
+      TValue* values = (TValue*)(rows[i] + 1);
+      for (auto column = Columns.begin(); column != Columns.end(); column++) {
+        const TValue& value = values[column->ColumnIndex];
+        ui64 key = column->Type == EValueType::Boolean
+          ? value.Data.Boolean
+          : value.Data.Uint64;
+        column->Total++;
+        auto counts = column->Counts.find(key);
+        if (counts != column->Counts.end()) {
+          counts->second++;
+        } else if (column->Counts.size() < MaxDistinctValues) {
+          column->Counts.insert(std::make_pair(key, 1));
+        }
+      }
+    }
+  }
+
+  // Picks the column value accounting for the largest share of samples, if
+  // that share is at least minFrequency.
+  bool ChooseSpecialization(double minFrequency, TSpecialization* specialization) const
+  {
+    double bestFrequency = 0;
+    for (auto column = Columns.begin(); column != Columns.end(); column++) {
+      for (auto counts = column->Counts.begin(); counts != column->Counts.end(); counts++) {
+        double frequency = double(counts->second) / column->Total;
+        if (frequency >= minFrequency && frequency > bestFrequency) {
+          bestFrequency = frequency;
+          specialization->ColumnIndex = column->ColumnIndex;
+          specialization->Value.Id = column->ColumnIndex;
+          specialization->Value.Type = column->Type;
+          specialization->Value.Length = 0;
+          specialization->Value.Data.Uint64 = 0;
+          if (column->Type == EValueType::Boolean) {
+            specialization->Value.Data.Boolean = counts->first;
+          } else {
+            specialization->Value.Data.Uint64 = counts->first;
+          }
+          specialization->Frequency = frequency;
+        }
+      }
+    }
+    return bestFrequency > 0;
+  }
+
+private:
+  struct TColumnSamples {
+    int ColumnIndex;
+    EValueType Type;
+    ui64 Total;
+    std::unordered_map<ui64, ui64> Counts;
+  };
+
+  std::vector<TColumnSamples> Columns;
+
+  void CollectColumns(TConstExpressionPtr expr)
+  {
+    switch (expr->Kind) {
+      case EExpressionKind::Literal:
+        break;
+      case EExpressionKind::Reference: {
+        const TReferenceExpression* referenceExpr = static_cast<const TReferenceExpression*>(expr);
+        for (auto column = Columns.begin(); column != Columns.end(); column++) {
+          if (column->ColumnIndex == referenceExpr->ColumnIndex) {
+            return;
+          }
+        }
+        if (expr->Type == EValueType::String) {
+          return;
+        }
+        TColumnSamples column;
+        column.ColumnIndex = referenceExpr->ColumnIndex;
+        column.Type = expr->Type;
+        column.Total = 0;
+        Columns.push_back(column);
+        break;
+      }
+      case EExpressionKind::BinaryOp: {
+        const TBinaryOpExpression* binOpExpr = static_cast<const TBinaryOpExpression*>(expr);
+        CollectColumns(binOpExpr->Lhs);
+        CollectColumns(binOpExpr->Rhs);
+        break;
+      }
+      case EExpressionKind::Function: {
+        const TFunctionExpression* funExpr = static_cast<const TFunctionExpression*>(expr);
+        for (auto args = funExpr->Arguments.begin();
+             args != funExpr->Arguments.end();
+             args++) {
+          CollectColumns(*args);
+        }
+        break;
+      }
+    }
+  }
+};
+
+/* Adaptive evaluation */
+
+struct TAdaptiveOptions {
+  // Rows evaluated by the profiling code before the expression counts as
+  // hot and is recompiled.
+  i64 HotRows = 1 << 20;
+  // Every SampleInterval-th batch contributes SamplesPerBatch value samples.
+  int SampleInterval = 16;
+  int SamplesPerBatch = 8;
+  // Minimum share of samples a column value needs to be specialized on.
+  double SpecializationThreshold = 0.8;
+};
+
+// A compiled expression that starts out instrumented (see
+// TExpressionProfile) and, once hot, is recompiled in the background with
+// reordered && / || terms, branch weights from the profile and
+// specialization on a nearly constant column. The new code is swapped in
+// atomically while other threads keep evaluating.
+class TAdaptiveExpression {
+public:
+  explicit TAdaptiveExpression(
+    TConstExpressionPtr expr,
+    const TAdaptiveOptions& options = TAdaptiveOptions());
+  ~TAdaptiveExpression();
+
+  TAdaptiveExpression(const TAdaptiveExpression&) = delete;
+  void operator=(const TAdaptiveExpression&) = delete;
+
+  // Same contract as TBatchFunction. Safe to call from several threads.
+  void Evaluate(TRow* rows, TValue* results, i64 count);
+
+  bool IsRecompiled() const
+  {
+    return State.load(std::memory_order_acquire) == Recompiled;
+  }
+
+  // The expression the recompiled code evaluates, or NULL before that.
+  TConstExpressionPtr GetRecompiledExpression() const
+  {
+    return IsRecompiled() ? RecompiledExpression : NULL;
+  }
+
+  const TExpressionProfile& GetProfile() const
+  {
+    return Profile;
+  }
+
+private:
+  enum EState {
+    Profiling,
+    Recompiling,
+    Recompiled
+  };
+
+  TConstExpressionPtr Expr;
+  TAdaptiveOptions Options;
+  TExpressionProfile Profile;
+  TValueSampler Sampler;
+  std::mutex SamplerLock;
+
+  std::atomic<TBatchFunction> Function;
+  std::atomic<int> State;
+  std::atomic<i64> RowsEvaluated;
+  std::atomic<i64> Batches;
+
+  // Swapped-out code is kept until destruction, since other threads may
+  // still be running it.
+  TCompiledExpression ProfilingCode;
+  TCompiledExpression RecompiledCode;
+
+  // Owned by the background recompilation until State becomes Recompiled.
+  TExpressionArena Arena;
+  TConstExpressionPtr RecompiledExpression;
+  TBranchHints BranchHints;
+  TSpecialization Specialization;
+  std::thread Recompiler;
+
+  void Recompile();
+};
+
+TAdaptiveExpression::TAdaptiveExpression(
+  TConstExpressionPtr expr,
+  const TAdaptiveOptions& options)
+  : Expr(expr)
+  , Options(options)
+  , Profile(expr)
+  , Sampler(expr)
+  , State(Profiling)
+  , RowsEvaluated(0)
+  , Batches(0)
+  , RecompiledExpression(NULL)
+{
+  Profile.InstrumentBooleanNodes();
+  TCompileOptions compileOptions;
+  compileOptions.Profile = &Profile;
+  ProfilingCode = compileExpression(Expr, NULL, compileOptions);
+  RecompiledCode.Engine = NULL;
+  Function.store(ProfilingCode.BatchFunction, std::memory_order_release);
+}
+
+TAdaptiveExpression::~TAdaptiveExpression()
+{
+  if (Recompiler.joinable()) {
+    Recompiler.join();
+  }
+  delete RecompiledCode.Engine;
+  delete ProfilingCode.Engine;
+}
+
+void TAdaptiveExpression::Evaluate(TRow* rows, TValue* results, i64 count)
+{
+  Function.load(std::memory_order_acquire)(rows, results, count);
+
+  if (State.load(std::memory_order_relaxed) != Profiling) {
+    return;
+  }
+
+  if (Batches.fetch_add(1, std::memory_order_relaxed) % Options.SampleInterval == 0
+      && SamplerLock.try_lock()) {
+    Sampler.Sample(rows, count, Options.SamplesPerBatch);
+    SamplerLock.unlock();
+  }
+
+  i64 rowsEvaluated = RowsEvaluated.fetch_add(count, std::memory_order_relaxed) + count;
+  if (rowsEvaluated >= Options.HotRows) {
+    int expected = Profiling;
+    if (State.compare_exchange_strong(expected, Recompiling)) {
+      Recompiler = std::thread([this] () { Recompile(); });
+    }
+  }
+}
+
+void TAdaptiveExpression::Recompile()
+{
+  // The profiling code keeps updating the counters meanwhile; reading them
+  // slightly stale only affects the estimates.
+  TConstExpressionPtr expr = reorderConjuncts(Expr, Profile, &Arena);
+  if (typeOf(expr) == EValueType::Boolean) {
+    estimateTrueProbability(expr, Profile, &BranchHints);
+  }
+
+  TCompileOptions compileOptions;
+  compileOptions.BranchHints = &BranchHints;
+  {
+    std::lock_guard<std::mutex> guard(SamplerLock);
+    if (Sampler.ChooseSpecialization(Options.SpecializationThreshold, &Specialization)) {
+      compileOptions.Specialization = &Specialization;
+    }
+  }
+
+  RecompiledCode = compileExpression(expr, NULL, compileOptions);
+  RecompiledExpression = expr;
+  Function.store(RecompiledCode.BatchFunction, std::memory_order_release);
+  State.store(Recompiled, std::memory_order_release);
+}
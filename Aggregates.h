@@ -0,0 +1,308 @@
+#pragma once
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "llvm/IR/IRBuilder.h"
+#include "TExpressionInterpreter.h"
+#include "TExpressionTyper.h"
+using namespace TExpressionTyper;
+
+/* Aggregate functions */
+
+enum class EAggregateFunction {
+  Sum,
+  Count,
+  Min,
+  Max,
+  Avg
+};
+
+const char* getAggregateFunctionName(EAggregateFunction function)
+{
+  switch (function) {
+    case EAggregateFunction::Sum:
+      return "sum";
+    case EAggregateFunction::Count:
+      return "count";
+    case EAggregateFunction::Min:
+      return "min";
+    case EAggregateFunction::Max:
+      return "max";
+    case EAggregateFunction::Avg:
+      return "avg";
+  }
+  return "unknown";
+}
+
+struct TAggregate {
+  EAggregateFunction Function;
+  // NULL for count(*).
+  TConstExpressionPtr Argument;
+};
+
+EValueType getAggregateArgumentType(const TAggregate& aggregate)
+{
+  return aggregate.Argument ? typeOf(aggregate.Argument) : EValueType::Null;
+}
+
+// Returns EValueType::Null if the aggregate cannot be computed, e.g. sum
+// over a non-numeric argument.
+EValueType getAggregateType(const TAggregate& aggregate)
+{
+  EValueType argType = getAggregateArgumentType(aggregate);
+  if (aggregate.Function == EAggregateFunction::Count) {
+    return EValueType::Int64;
+  }
+  if (argType != EValueType::Int64
+      && argType != EValueType::Uint64
+      && argType != EValueType::Double) {
+    return EValueType::Null;
+  }
+  return aggregate.Function == EAggregateFunction::Avg
+    ? EValueType::Double
+    : argType;
+}
+
+/* Aggregate states */
+
+// The state of an aggregate is one or two 64-bit slots: the accumulated
+// value, followed for min, max and avg by the number of rows seen, so that
+// aggregating no rows gives Null. States of several aggregates are laid
+// out one after another.
+
+int getAggregateStateSlots(const TAggregate& aggregate)
+{
+  switch (aggregate.Function) {
+    case EAggregateFunction::Sum:
+    case EAggregateFunction::Count:
+      return 1;
+    default:
+      return 2;
+  }
+}
+
+int getAggregateStateSlots(const std::vector<TAggregate>& aggregates)
+{
+  int slots = 0;
+  for (auto aggregate = aggregates.begin(); aggregate != aggregates.end(); aggregate++) {
+    slots += getAggregateStateSlots(*aggregate);
+  }
+  return slots;
+}
+
+void initAggregateState(const TAggregate& aggregate, ui64* state)
+{
+  EValueType argType = getAggregateArgumentType(aggregate);
+  TValue value = TExpressionInterpreter::makeValue(argType);
+  switch (aggregate.Function) {
+    case EAggregateFunction::Min:
+      if (argType == EValueType::Double) {
+        value.Data.Double = std::numeric_limits<double>::infinity();
+      } else if (argType == EValueType::Uint64) {
+        value.Data.Uint64 = std::numeric_limits<ui64>::max();
+      } else {
+        value.Data.Int64 = std::numeric_limits<i64>::max();
+      }
+      break;
+    case EAggregateFunction::Max:
+      if (argType == EValueType::Double) {
+        value.Data.Double = -std::numeric_limits<double>::infinity();
+      } else if (argType == EValueType::Int64) {
+        value.Data.Int64 = std::numeric_limits<i64>::min();
+      }
+      break;
+    default:
+      // Zero is 0.0 for sums of doubles too.
+      break;
+  }
+  state[0] = value.Data.Uint64;
+  if (getAggregateStateSlots(aggregate) == 2) {
+    state[1] = 0;
+  }
+}
+
+void initAggregateStates(const std::vector<TAggregate>& aggregates, ui64* states)
+{
+  for (auto aggregate = aggregates.begin(); aggregate != aggregates.end(); aggregate++) {
+    initAggregateState(*aggregate, states);
+    states += getAggregateStateSlots(*aggregate);
+  }
+}
+
+// Adds the rows aggregated into from to into, as when merging partial
+// aggregates computed by different threads.
+void mergeAggregateState(const TAggregate& aggregate, ui64* into, const ui64* from)
+{
+  EValueType argType = getAggregateArgumentType(aggregate);
+  TValue lhs;
+  TValue rhs;
+  lhs.Data.Uint64 = into[0];
+  rhs.Data.Uint64 = from[0];
+
+  switch (aggregate.Function) {
+    case EAggregateFunction::Count:
+      lhs.Data.Int64 += rhs.Data.Int64;
+      break;
+    case EAggregateFunction::Sum:
+    case EAggregateFunction::Avg:
+      if (argType == EValueType::Double || aggregate.Function == EAggregateFunction::Avg) {
+        lhs.Data.Double += rhs.Data.Double;
+      } else {
+        lhs.Data.Uint64 += rhs.Data.Uint64;
+      }
+      break;
+    case EAggregateFunction::Min:
+    case EAggregateFunction::Max: {
+      // Sign of rhs - lhs.
+      int order;
+      if (argType == EValueType::Double) {
+        order = (rhs.Data.Double > lhs.Data.Double) - (rhs.Data.Double < lhs.Data.Double);
+      } else if (argType == EValueType::Uint64) {
+        order = (rhs.Data.Uint64 > lhs.Data.Uint64) - (rhs.Data.Uint64 < lhs.Data.Uint64);
+      } else {
+        order = (rhs.Data.Int64 > lhs.Data.Int64) - (rhs.Data.Int64 < lhs.Data.Int64);
+      }
+      bool better = aggregate.Function == EAggregateFunction::Min ? order < 0 : order > 0;
+      if (from[1] && better) {
+        lhs = rhs;
+      }
+      break;
+    }
+  }
+
+  into[0] = lhs.Data.Uint64;
+  if (getAggregateStateSlots(aggregate) == 2) {
+    into[1] += from[1];
+  }
+}
+
+void mergeAggregateStates(
+  const std::vector<TAggregate>& aggregates,
+  ui64* into,
+  const ui64* from)
+{
+  for (auto aggregate = aggregates.begin(); aggregate != aggregates.end(); aggregate++) {
+    mergeAggregateState(*aggregate, into, from);
+    into += getAggregateStateSlots(*aggregate);
+    from += getAggregateStateSlots(*aggregate);
+  }
+}
+
+TValue finalizeAggregateState(const TAggregate& aggregate, const ui64* state)
+{
+  EValueType type = getAggregateType(aggregate);
+  TValue value = TExpressionInterpreter::makeValue(type);
+  if (getAggregateStateSlots(aggregate) == 2 && state[1] == 0) {
+    return TExpressionInterpreter::makeValue(EValueType::Null);
+  }
+  if (aggregate.Function == EAggregateFunction::Avg) {
+    TValue sum;
+    sum.Data.Uint64 = state[0];
+    value.Data.Double = sum.Data.Double / state[1];
+  } else {
+    value.Data.Uint64 = state[0];
+  }
+  return value;
+}
+
+std::vector<TValue> finalizeAggregateStates(
+  const std::vector<TAggregate>& aggregates,
+  const ui64* states)
+{
+  std::vector<TValue> results;
+  for (auto aggregate = aggregates.begin(); aggregate != aggregates.end(); aggregate++) {
+    results.push_back(finalizeAggregateState(*aggregate, states));
+    states += getAggregateStateSlots(*aggregate);
+  }
+  return results;
+}
+
+/* Code generation */
+
+static Value* getAggregateSlot(
+  IRBuilder<>& builder,
+  Value* state,
+  int slot,
+  EValueType type)
+{
+  Value* slotPtr = builder.CreateConstInBoundsGEP1_32(state, slot);
+  if (type == EValueType::Double) {
+    slotPtr = builder.CreatePointerCast(slotPtr, builder.getDoubleTy()->getPointerTo());
+  }
+  return slotPtr;
+}
+
+// Emits the update of the state of aggregate, pointed to by state (i64*),
+// with argument, the value of its argument for the current row (NULL for
+// count(*)).
+void emitAggregateUpdate(
+  IRBuilder<>& builder,
+  const TAggregate& aggregate,
+  Value* state,
+  Value* argument)
+{
+  EValueType argType = getAggregateArgumentType(aggregate);
+  bool isDouble = argType == EValueType::Double;
+
+  if (getAggregateStateSlots(aggregate) == 2) {
+    // state[1]++
+    Value* countPtr = builder.CreateConstInBoundsGEP1_32(state, 1);
+    builder.CreateStore(
+      builder.CreateAdd(builder.CreateLoad(countPtr), builder.getInt64(1)),
+      countPtr);
+  }
+
+  switch (aggregate.Function) {
+    case EAggregateFunction::Count: {
+      Value* countPtr = builder.CreateConstInBoundsGEP1_32(state, 0);
+      builder.CreateStore(
+        builder.CreateAdd(builder.CreateLoad(countPtr), builder.getInt64(1)),
+        countPtr);
+      break;
+    }
+
+    case EAggregateFunction::Sum: {
+      Value* sumPtr = getAggregateSlot(builder, state, 0, argType);
+      Value* sum = builder.CreateLoad(sumPtr);
+      builder.CreateStore(
+        isDouble ? builder.CreateFAdd(sum, argument) : builder.CreateAdd(sum, argument),
+        sumPtr);
+      break;
+    }
+
+    case EAggregateFunction::Min:
+    case EAggregateFunction::Max: {
+      bool isMin = aggregate.Function == EAggregateFunction::Min;
+      Value* bestPtr = getAggregateSlot(builder, state, 0, argType);
+      Value* best = builder.CreateLoad(bestPtr);
+      Value* better;
+      if (isDouble) {
+        better = isMin
+          ? builder.CreateFCmpOLT(argument, best)
+          : builder.CreateFCmpOGT(argument, best);
+      } else if (argType == EValueType::Uint64) {
+        better = isMin
+          ? builder.CreateICmpULT(argument, best)
+          : builder.CreateICmpUGT(argument, best);
+      } else {
+        better = isMin
+          ? builder.CreateICmpSLT(argument, best)
+          : builder.CreateICmpSGT(argument, best);
+      }
+      builder.CreateStore(builder.CreateSelect(better, argument, best), bestPtr);
+      break;
+    }
+
+    case EAggregateFunction::Avg: {
+      Value* sumPtr = getAggregateSlot(builder, state, 0, EValueType::Double);
+      Value* value = argument;
+      if (argType == EValueType::Int64) {
+        value = builder.CreateSIToFP(argument, builder.getDoubleTy());
+      } else if (argType == EValueType::Uint64) {
+        value = builder.CreateUIToFP(argument, builder.getDoubleTy());
+      }
+      builder.CreateStore(builder.CreateFAdd(builder.CreateLoad(sumPtr), value), sumPtr);
+      break;
+    }
+  }
+}
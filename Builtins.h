@@ -0,0 +1,150 @@
+#pragma once
+#include "llvm/IR/Verifier.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "LLVMCodegen.h"
+
+// Builtin implementations of the binary operators. Each overload is emitted
+// under its own symbol (e.g. "+.Int64") so that overloads of one operator
+// can be linked into the same expression module.
+
+std::string getBuiltinSymbolName(EBinaryOp opcode, EValueType argType)
+{
+  return FunctionRegistry::getOperatorName(opcode)
+    + "."
+    + getValueTypeName(argType);
+}
+
+Module* emitBuiltinBinaryOp(
+  EBinaryOp opcode,
+  EValueType argType,
+  EValueType resultType,
+  IRBuilder<>& builder)
+{
+  LLVMContext &context = getGlobalContext();
+  std::string name = getBuiltinSymbolName(opcode, argType);
+  FunctionType* funTp = LLVMCodegen::getLLVMType(
+    resultType,
+    std::vector<EValueType>({ argType, argType }));
+  Module* module = new Module(name, context);
+
+  Function* function = Function::Create(
+    funTp,
+    Function::ExternalLinkage,
+    name,
+    module);
+
+  Function::arg_iterator args = function->arg_begin();
+  Argument* lhs = args;
+  args++;
+  Argument* rhs = args;
+
+  BasicBlock* body = BasicBlock::Create(context, "entry", function);
+  builder.SetInsertPoint(body);
+
+  bool isDouble = argType == EValueType::Double;
+  bool isUnsigned = argType == EValueType::Uint64;
+  Value* result = NULL;
+  switch (opcode) {
+    case Plus:
+      result = isDouble ? builder.CreateFAdd(lhs, rhs) : builder.CreateAdd(lhs, rhs);
+      break;
+    case Minus:
+      result = isDouble ? builder.CreateFSub(lhs, rhs) : builder.CreateSub(lhs, rhs);
+      break;
+    case Multiply:
+      result = isDouble ? builder.CreateFMul(lhs, rhs) : builder.CreateMul(lhs, rhs);
+      break;
+    case Divide:
+      result = isDouble ? builder.CreateFDiv(lhs, rhs)
+        : isUnsigned ? builder.CreateUDiv(lhs, rhs)
+        : builder.CreateSDiv(lhs, rhs);
+      break;
+    case Modulo:
+      result = isUnsigned ? builder.CreateURem(lhs, rhs) : builder.CreateSRem(lhs, rhs);
+      break;
+    case And:
+      result = builder.CreateAnd(lhs, rhs);
+      break;
+    case Or:
+      result = builder.CreateOr(lhs, rhs);
+      break;
+    case Equal:
+      result = isDouble ? builder.CreateFCmpOEQ(lhs, rhs) : builder.CreateICmpEQ(lhs, rhs);
+      break;
+    case NotEqual:
+      result = isDouble ? builder.CreateFCmpUNE(lhs, rhs) : builder.CreateICmpNE(lhs, rhs);
+      break;
+    case Less:
+      result = isDouble ? builder.CreateFCmpOLT(lhs, rhs)
+        : isUnsigned ? builder.CreateICmpULT(lhs, rhs)
+        : builder.CreateICmpSLT(lhs, rhs);
+      break;
+    case LessOrEqual:
+      result = isDouble ? builder.CreateFCmpOLE(lhs, rhs)
+        : isUnsigned ? builder.CreateICmpULE(lhs, rhs)
+        : builder.CreateICmpSLE(lhs, rhs);
+      break;
+    case Greater:
+      result = isDouble ? builder.CreateFCmpOGT(lhs, rhs)
+        : isUnsigned ? builder.CreateICmpUGT(lhs, rhs)
+        : builder.CreateICmpSGT(lhs, rhs);
+      break;
+    case GreaterOrEqual:
+      result = isDouble ? builder.CreateFCmpOGE(lhs, rhs)
+        : isUnsigned ? builder.CreateICmpUGE(lhs, rhs)
+        : builder.CreateICmpSGE(lhs, rhs);
+      break;
+  }
+  builder.CreateRet(result);
+
+  verifyFunction(*function);
+
+  return module;
+}
+
+void registerBuiltinBinaryOp(
+  EBinaryOp opcode,
+  EValueType argType,
+  EValueType resultType)
+{
+  std::vector<EValueType> argTypes({ argType, argType });
+  registry->AddFunction(FunctionSignature(
+    FunctionRegistry::getOperatorName(opcode),
+    argTypes,
+    resultType,
+    [=] (IRBuilder<>& builder) {
+      return emitBuiltinBinaryOp(opcode, argType, resultType, builder);
+    },
+    getBuiltinSymbolName(opcode, argType)));
+}
+
+// Registers the arithmetical, relational and logical operators for all
+// types that codegen supports.
+void registerBuiltins()
+{
+  EValueType numericTypes[] = {
+    EValueType::Int64, EValueType::Uint64, EValueType::Double
+  };
+  EBinaryOp arithmeticalOps[] = { Plus, Minus, Multiply, Divide };
+  EBinaryOp relationalOps[] = {
+    Equal, NotEqual, Less, LessOrEqual, Greater, GreaterOrEqual
+  };
+
+  for (EValueType type : numericTypes) {
+    for (EBinaryOp opcode : arithmeticalOps) {
+      registerBuiltinBinaryOp(opcode, type, type);
+    }
+    if (type != EValueType::Double) {
+      registerBuiltinBinaryOp(Modulo, type, type);
+    }
+    for (EBinaryOp opcode : relationalOps) {
+      registerBuiltinBinaryOp(opcode, type, EValueType::Boolean);
+    }
+  }
+
+  registerBuiltinBinaryOp(And, EValueType::Boolean, EValueType::Boolean);
+  registerBuiltinBinaryOp(Or, EValueType::Boolean, EValueType::Boolean);
+  registerBuiltinBinaryOp(Equal, EValueType::Boolean, EValueType::Boolean);
+  registerBuiltinBinaryOp(NotEqual, EValueType::Boolean, EValueType::Boolean);
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <stdio.h>
+#include <unistd.h>
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+using namespace llvm;
+
+// Keeps the objects MCJIT emits under the identifier of the module they
+// were compiled from (see compileExpression), so that compiling the same
+// module again loads the object instead of running codegen. Objects are
+// kept in memory and, when a directory is given, in files there, which
+// several processes or hosts may share: the key includes the target
+// features the object was generated for.
+//
+// Keys are short hashes, so each object is stored along with the contents
+// of its key, the full description of what was compiled (see SetContents),
+// and only found again for the same contents: a key colliding with another
+// one recompiles rather than runs the other's code.
+class TCompiledCodeCache : public ObjectCache {
+public:
+  explicit TCompiledCodeCache(const std::string& directory = std::string())
+    : Directory(directory)
+  { }
+
+  // Sets what the module with identifier key is compiled from, before it
+  // is compiled.
+  void SetContents(const std::string& key, const std::string& contents)
+  {
+    std::lock_guard<std::mutex> guard(Lock);
+    Contents[key] = contents;
+  }
+
+  virtual void notifyObjectCompiled(const Module* module, const MemoryBuffer* object)
+  {
+    const std::string& key = module->getModuleIdentifier();
+    TEntry entry;
+    entry.Contents = GetContents(key);
+    entry.Object.assign(object->getBufferStart(), object->getBufferSize());
+
+    if (!Directory.empty()) {
+      // Files hold the size of the contents on a line, the contents and the
+      // object. Written aside and renamed so that readers never see partial
+      // files.
+      std::string path = GetPath(key);
+      std::string temporaryPath = path + "." + std::to_string(getpid());
+      std::ofstream file(temporaryPath.c_str(), std::ios::binary);
+      file << entry.Contents.size() << "\n";
+      file.write(entry.Contents.data(), entry.Contents.size());
+      file.write(entry.Object.data(), entry.Object.size());
+      file.close();
+      if (!file || rename(temporaryPath.c_str(), path.c_str())) {
+        unlink(temporaryPath.c_str());
+      }
+    }
+
+    std::lock_guard<std::mutex> guard(Lock);
+    Objects[key] = entry;
+  }
+
+  // The caller takes ownership of the buffer.
+  virtual MemoryBuffer* getObject(const Module* module)
+  {
+    const std::string& key = module->getModuleIdentifier();
+    std::string object;
+    if (!Find(key, &object)) {
+      return NULL;
+    }
+    return MemoryBuffer::getMemBufferCopy(object, key);
+  }
+
+  bool Contains(const std::string& key)
+  {
+    std::string object;
+    return Find(key, &object);
+  }
+
+private:
+  struct TEntry {
+    std::string Contents;
+    std::string Object;
+  };
+
+  std::mutex Lock;
+  std::string Directory;
+  std::unordered_map<std::string, std::string> Contents;
+  std::unordered_map<std::string, TEntry> Objects;
+
+  std::string GetContents(const std::string& key)
+  {
+    std::lock_guard<std::mutex> guard(Lock);
+    auto contents = Contents.find(key);
+    return contents == Contents.end() ? std::string() : contents->second;
+  }
+
+  std::string GetPath(const std::string& key) const
+  {
+    return Directory + "/" + key + ".o";
+  }
+
+  // Finds the object stored under key for the current contents of key.
+  bool Find(const std::string& key, std::string* object)
+  {
+    std::string contents = GetContents(key);
+    {
+      std::lock_guard<std::mutex> guard(Lock);
+      auto entry = Objects.find(key);
+      if (entry != Objects.end() && entry->second.Contents == contents) {
+        *object = entry->second.Object;
+        return true;
+      }
+    }
+
+    if (Directory.empty()) {
+      return false;
+    }
+    std::ifstream file(GetPath(key).c_str(), std::ios::binary);
+    size_t contentsSize;
+    if (!(file >> contentsSize) || file.get() != '\n') {
+      return false;
+    }
+    TEntry entry;
+    entry.Contents.resize(contentsSize);
+    if (!file.read(&entry.Contents[0], contentsSize) || entry.Contents != contents) {
+      return false;
+    }
+    std::stringstream data;
+    data << file.rdbuf();
+    entry.Object = data.str();
+    *object = entry.Object;
+
+    std::lock_guard<std::mutex> guard(Lock);
+    Objects[key] = entry;
+    return true;
+  }
+};
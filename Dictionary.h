@@ -0,0 +1,192 @@
+#pragma once
+#include <cstring>
+#include <string>
+#include <vector>
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "YTTypes.h"
+using namespace llvm;
+
+// Dictionary encoding of string columns: each distinct string of a column is
+// stored once and rows hold a dense 32-bit code instead. Predicates on the
+// strings are resolved against the dictionary once, looking at each distinct
+// string a single time, into a predicate on codes (see TCodePredicate) that
+// filters the column without touching string bytes (see
+// LLVMCodegen::EmitCodeFilterFunction).
+
+class TStringDictionary {
+public:
+  // The code of nulls, missing values and anything that is not a string.
+  static const ui32 NullCode = 0;
+
+  TStringDictionary()
+    : Strings(1)
+  { }
+
+  TStringDictionary(const TStringDictionary&) = delete;
+  void operator=(const TStringDictionary&) = delete;
+
+  // Returns the code of value, adding it if it is new. Codes are given out
+  // in order starting from 1.
+  ui32 Add(StringRef value)
+  {
+    ui32 code = Strings.size();
+    StringMapEntry<ui32>& entry = Codes.GetOrCreateValue(value, code);
+    if (entry.getValue() == code) {
+      Strings.push_back(entry.getKey());
+    }
+    return entry.getValue();
+  }
+
+  // Returns NullCode if value is not in the dictionary.
+  ui32 Find(StringRef value) const
+  {
+    auto entry = Codes.find(value);
+    return entry == Codes.end() ? NullCode : entry->getValue();
+  }
+
+  StringRef GetString(ui32 code) const
+  {
+    return Strings[code];
+  }
+
+  // One more than the largest code.
+  ui32 GetCodeCount() const
+  {
+    return Strings.size();
+  }
+
+private:
+  StringMap<ui32> Codes;
+  // By code; the keys of Codes, which never move.
+  std::vector<StringRef> Strings;
+};
+
+struct TDictionaryColumn {
+  TStringDictionary Dictionary;
+  std::vector<ui32> Codes;
+};
+
+// Appends the codes of the column-th values of count rows to encoded.
+void encodeStringColumn(TRow* rows, i64 count, int column, TDictionaryColumn* encoded)
+{
+  encoded->Codes.reserve(encoded->Codes.size() + count);
+  for (i64 i = 0; i < count; i++) {
+    const TValue* values = reinterpret_cast<const TValue*>(rows[i] + 1);
+    ui32 code = TStringDictionary::NullCode;
+    if (column < rows[i]->Count && values[column].Type == EValueType::String) {
+      code = encoded->Dictionary.Add(StringRef(values[column].Data.String, values[column].Length));
+    }
+    encoded->Codes.push_back(code);
+  }
+}
+
+/* Predicates */
+
+enum class EStringPredicateKind {
+  // value = Values[0]
+  Equal,
+  // value != Values[0]
+  NotEqual,
+  // value IN (Values...)
+  In,
+  // value NOT IN (Values...)
+  NotIn,
+  // value starts with any of Values
+  Prefix
+};
+
+// A predicate on a string column. Nulls never match, not even negated
+// predicates.
+struct TStringPredicate {
+  EStringPredicateKind Kind;
+  std::vector<std::string> Values;
+};
+
+// A string predicate resolved against a dictionary: either the column holds
+// Code, or the bit of the code is set in Bitmap. Codes added to the
+// dictionary after resolving never match a bitmap.
+struct TCodePredicate {
+  bool IsBitmap;
+  ui32 Code;
+  std::vector<ui64> Bitmap;
+};
+
+// Evaluates predicate on a string, as resolved predicates do on its code.
+bool matchesStringPredicate(const TStringPredicate& predicate, StringRef value)
+{
+  switch (predicate.Kind) {
+    case EStringPredicateKind::Equal:
+    case EStringPredicateKind::NotEqual:
+    case EStringPredicateKind::In:
+    case EStringPredicateKind::NotIn: {
+      bool found = false;
+      for (auto candidate = predicate.Values.begin(); candidate != predicate.Values.end(); candidate++) {
+        found |= value == StringRef(*candidate);
+      }
+      bool negated = predicate.Kind == EStringPredicateKind::NotEqual
+        || predicate.Kind == EStringPredicateKind::NotIn;
+      return found != negated;
+    }
+    case EStringPredicateKind::Prefix: {
+      for (auto prefix = predicate.Values.begin(); prefix != predicate.Values.end(); prefix++) {
+        if (value.startswith(*prefix)) {
+          return true;
+        }
+      }
+      return false;
+    }
+  }
+  return false;
+}
+
+// Returns the predicate on the codes of dictionary matching the strings
+// predicate matches. Equality with a string in the dictionary becomes a
+// comparison with its code; everything else a bitmap over all codes.
+TCodePredicate resolveStringPredicate(
+  const TStringPredicate& predicate,
+  const TStringDictionary& dictionary)
+{
+  TCodePredicate resolved;
+  resolved.IsBitmap = true;
+  resolved.Code = TStringDictionary::NullCode;
+
+  if (predicate.Kind == EStringPredicateKind::Equal
+      || (predicate.Kind == EStringPredicateKind::In && predicate.Values.size() == 1)) {
+    ui32 code = predicate.Values.empty()
+      ? TStringDictionary::NullCode
+      : dictionary.Find(predicate.Values[0]);
+    if (code != TStringDictionary::NullCode) {
+      resolved.IsBitmap = false;
+      resolved.Code = code;
+      return resolved;
+    }
+  }
+
+  ui32 codeCount = dictionary.GetCodeCount();
+  resolved.Bitmap.assign((codeCount + 63) / 64, 0);
+  for (ui32 code = 1; code < codeCount; code++) {
+    if (matchesStringPredicate(predicate, dictionary.GetString(code))) {
+      resolved.Bitmap[code / 64] |= 1ULL << (code % 64);
+    }
+  }
+  return resolved;
+}
+
+bool matchesCodePredicate(const TCodePredicate& predicate, ui32 code)
+{
+  if (!predicate.IsBitmap) {
+    return code == predicate.Code;
+  }
+  return code / 64 < predicate.Bitmap.size()
+    && (predicate.Bitmap[code / 64] >> (code % 64)) & 1;
+}
+
+/* Generated functions */
+
+// Sets matches[i] to 1 if codes[i] matches the predicate it was generated
+// for and to 0 otherwise, and returns the number of matches.
+typedef i64 (*TCodeFilterFunction)(const ui32* codes, i64 count, ui8* matches);
+
+// Codes are filtered this many at a time, as vectors of 32-bit integers.
+const int CodeFilterVectorWidth = 8;
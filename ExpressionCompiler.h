@@ -0,0 +1,701 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <unistd.h>
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "CompiledCodeCache.h"
+#include "LLVMCodegen.h"
+#include "Optimize.h"
+#include "PerfJITEventListener.h"
+#include "TargetFeatures.h"
+
+/* Compile statistics */
+
+enum ECompilePhase {
+  Typing,
+  IRGeneration,
+  Linking,
+  Optimization,
+  CodeGeneration,
+  CompilePhaseCount
+};
+
+const char* getCompilePhaseName(ECompilePhase phase)
+{
+  switch (phase) {
+    case Typing:
+      return "typing";
+    case IRGeneration:
+      return "irgen";
+    case Linking:
+      return "linking";
+    case Optimization:
+      return "optimization";
+    case CodeGeneration:
+      return "codegen";
+    default:
+      return "unknown";
+  }
+}
+
+typedef std::chrono::steady_clock TCompileClock;
+
+ui64 toMicroseconds(TCompileClock::time_point time)
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    time.time_since_epoch()).count();
+}
+
+// Statistics of a single compilation. Phase times are wall clock
+// microseconds; PhaseStart is taken from the steady clock so that the
+// statistics of several compilations can be put on one timeline.
+struct TCompileStatistics {
+  TCompileStatistics()
+    : InstructionsBeforeOptimization(0)
+    , InstructionsAfterOptimization(0)
+    , CodeBytes(0)
+    , DataBytes(0)
+  {
+    for (int i = 0; i < CompilePhaseCount; i++) {
+      PhaseStart[i] = 0;
+      PhaseTime[i] = 0;
+    }
+  }
+
+  ui64 PhaseStart[CompilePhaseCount];
+  ui64 PhaseTime[CompilePhaseCount];
+  ui64 InstructionsBeforeOptimization;
+  ui64 InstructionsAfterOptimization;
+  // Sizes of the code and data sections emitted by MC.
+  ui64 CodeBytes;
+  ui64 DataBytes;
+
+  ui64 GetTotalTime() const
+  {
+    ui64 total = 0;
+    for (int i = 0; i < CompilePhaseCount; i++) {
+      total += PhaseTime[i];
+    }
+    return total;
+  }
+
+  // Writes the phases as complete ("X") events of the Chrome trace event
+  // format, without the enclosing array so that several compilations can
+  // be written into one trace.
+  void WriteChromeTraceEvents(std::ostream& output, const char* separator = ",\n") const;
+};
+
+void TCompileStatistics::WriteChromeTraceEvents(std::ostream& output, const char* separator) const
+{
+  for (int i = 0; i < CompilePhaseCount; i++) {
+    ECompilePhase phase = static_cast<ECompilePhase>(i);
+    output << (i ? separator : "")
+      << "{\"name\": \"" << getCompilePhaseName(phase) << "\""
+      << ", \"cat\": \"compile\", \"ph\": \"X\""
+      << ", \"ts\": " << PhaseStart[i]
+      << ", \"dur\": " << PhaseTime[i]
+      << ", \"pid\": " << getpid()
+      << ", \"tid\": 0";
+    if (phase == Optimization) {
+      output << ", \"args\": {\"instructions_before\": " << InstructionsBeforeOptimization
+        << ", \"instructions_after\": " << InstructionsAfterOptimization << "}";
+    } else if (phase == CodeGeneration) {
+      output << ", \"args\": {\"code_bytes\": " << CodeBytes
+        << ", \"data_bytes\": " << DataBytes << "}";
+    }
+    output << "}";
+  }
+}
+
+// Writes a complete Chrome trace (loadable in chrome://tracing) of the
+// given compilations.
+void exportChromeTrace(
+  std::ostream& output,
+  const std::vector<TCompileStatistics>& statistics)
+{
+  output << "[\n";
+  for (size_t i = 0; i < statistics.size(); i++) {
+    output << (i ? ",\n" : "");
+    statistics[i].WriteChromeTraceEvents(output);
+  }
+  output << "\n]\n";
+}
+
+// Process-wide totals over all compilations that collected statistics.
+struct TCompileCounters {
+  std::atomic<ui64> Compilations;
+  std::atomic<ui64> PhaseTime[CompilePhaseCount];
+  std::atomic<ui64> InstructionsBeforeOptimization;
+  std::atomic<ui64> InstructionsAfterOptimization;
+  std::atomic<ui64> CodeBytes;
+  std::atomic<ui64> DataBytes;
+
+  void Add(const TCompileStatistics& statistics)
+  {
+    Compilations.fetch_add(1, std::memory_order_relaxed);
+    for (int i = 0; i < CompilePhaseCount; i++) {
+      PhaseTime[i].fetch_add(statistics.PhaseTime[i], std::memory_order_relaxed);
+    }
+    InstructionsBeforeOptimization.fetch_add(
+      statistics.InstructionsBeforeOptimization,
+      std::memory_order_relaxed);
+    InstructionsAfterOptimization.fetch_add(
+      statistics.InstructionsAfterOptimization,
+      std::memory_order_relaxed);
+    CodeBytes.fetch_add(statistics.CodeBytes, std::memory_order_relaxed);
+    DataBytes.fetch_add(statistics.DataBytes, std::memory_order_relaxed);
+  }
+};
+
+// Zero-initialized as a global.
+TCompileCounters compileCounters;
+
+// Measures one phase for the lifetime of the object. Does nothing, not
+// even read the clock, when statistics are not being collected.
+class TCompilePhaseTimer {
+public:
+  TCompilePhaseTimer(TCompileStatistics* statistics, ECompilePhase phase)
+    : Statistics(statistics)
+    , Phase(phase)
+  {
+    if (Statistics) {
+      Start = TCompileClock::now();
+    }
+  }
+
+  ~TCompilePhaseTimer()
+  {
+    if (Statistics) {
+      TCompileClock::time_point end = TCompileClock::now();
+      Statistics->PhaseStart[Phase] = toMicroseconds(Start);
+      Statistics->PhaseTime[Phase] = toMicroseconds(end) - toMicroseconds(Start);
+    }
+  }
+
+private:
+  TCompileStatistics* Statistics;
+  ECompilePhase Phase;
+  TCompileClock::time_point Start;
+};
+
+ui64 countInstructions(const Module* module)
+{
+  ui64 count = 0;
+  for (auto function = module->begin(); function != module->end(); function++) {
+    for (auto block = function->begin(); block != function->end(); block++) {
+      count += block->size();
+    }
+  }
+  return count;
+}
+
+// Adds up the sizes of the sections MCJIT allocates for generated code.
+class TCountingMemoryManager : public SectionMemoryManager
+{
+  TCountingMemoryManager(const TCountingMemoryManager&) LLVM_DELETED_FUNCTION;
+  void operator=(const TCountingMemoryManager&) LLVM_DELETED_FUNCTION;
+
+public:
+  explicit TCountingMemoryManager(TCompileStatistics* statistics)
+    : Statistics(statistics)
+  { }
+  virtual ~TCountingMemoryManager() {}
+
+  virtual uint8_t* allocateCodeSection(
+    uintptr_t size,
+    unsigned alignment,
+    unsigned sectionID,
+    StringRef sectionName)
+  {
+    Statistics->CodeBytes += size;
+    return SectionMemoryManager::allocateCodeSection(
+      size, alignment, sectionID, sectionName);
+  }
+
+  virtual uint8_t* allocateDataSection(
+    uintptr_t size,
+    unsigned alignment,
+    unsigned sectionID,
+    StringRef sectionName,
+    bool isReadOnly)
+  {
+    Statistics->DataBytes += size;
+    return SectionMemoryManager::allocateDataSection(
+      size, alignment, sectionID, sectionName, isReadOnly);
+  }
+
+private:
+  TCompileStatistics* Statistics;
+};
+
+/* Compilation */
+
+struct TCompileOptions {
+  // Names the generated functions in profiles (see PerfJITEventListener.h).
+  // Defaults to the hex hash of the expression.
+  std::string Label;
+  // When set, the generated code counts evaluations of the nodes chosen in
+  // the profile. The profile must outlive the compiled expression.
+  TExpressionProfile* Profile = NULL;
+  // Profile-guided code generation, see LLVMCodegen.
+  const TBranchHints* BranchHints = NULL;
+  const TSpecialization* Specialization = NULL;
+  // Features to generate code for; the host's by default. Code generated
+  // for other features only runs on hosts that have them (see
+  // TTargetFeatures::IsSupportedBy).
+  const TTargetFeatures* Target = NULL;
+  // When set, the object is looked up in and added to the cache, keyed by
+  // the expression and target (see getCompiledCodeKey). Instrumented and
+  // profile-guided code is never cached.
+  TCompiledCodeCache* Cache = NULL;
+  // Rows ahead of the current one whose values the batch function
+  // prefetches (see LLVMCodegen::SetPrefetchDistance). Pays off when rows
+  // are scattered across memory much larger than the cache; 0 disables it.
+  int PrefetchDistance = 0;
+};
+
+// Version of the code generated for an expression, part of the keys of
+// cached code. Bump it whenever a change to LLVMCodegen, the builtins or the
+// optimization passes changes what an expression compiles to, so that
+// objects cached before are no longer loaded.
+const int CompiledCodeVersion = 2;
+
+std::string getCompiledCodeKey(
+  TConstExpressionPtr expr,
+  const TTargetFeatures& target,
+  int prefetchDistance = 0)
+{
+  char hash[17];
+  snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)hashExpression(expr));
+  std::string key = std::string("expr-") + hash
+    + "-v" + std::to_string(CompiledCodeVersion)
+    + "-llvm" + std::to_string(LLVM_VERSION_MAJOR) + "." + std::to_string(LLVM_VERSION_MINOR)
+    + "-" + target.GetKey();
+  if (prefetchDistance > 0) {
+    key += "-prefetch" + std::to_string(prefetchDistance);
+  }
+  return key;
+}
+
+// All compilations share the global LLVM context, which is not thread-safe,
+// so compilations from different threads are serialized.
+std::mutex compileMutex;
+
+// Creates an engine for module and optimizes the module for its target,
+// unless the object for the module is already in cache.
+ExecutionEngine* createOptimizedEngine(
+  Module* module,
+  TCompileStatistics* statistics,
+  const TTargetFeatures& target,
+  TCompiledCodeCache* cache)
+{
+  // Creating the engine sets up the target machine whose data layout the
+  // passes need, so it is accounted to optimization.
+  TCompilePhaseTimer timer(statistics, Optimization);
+  EngineBuilder builder(module);
+  builder.setUseMCJIT(true);
+  applyTargetFeatures(builder, target);
+  if (statistics) {
+    builder.setMCJITMemoryManager(new TCountingMemoryManager(statistics));
+  }
+  ExecutionEngine* engine = builder.create();
+  registerPerfJITEventListener(engine);
+  if (cache) {
+    engine->setObjectCache(cache);
+  }
+
+  if (statistics) {
+    statistics->InstructionsBeforeOptimization = countInstructions(module);
+  }
+  // A cached object replaces codegen of the module, so optimizing it
+  // would be wasted.
+  if (!cache || !cache->Contains(module->getModuleIdentifier())) {
+    optimize(module, engine);
+  }
+  if (statistics) {
+    statistics->InstructionsAfterOptimization = countInstructions(module);
+  }
+  return engine;
+}
+
+// Generates machine code, naming it label in profiles.
+void finalizeEngine(
+  ExecutionEngine* engine,
+  TCompileStatistics* statistics,
+  const std::string& label)
+{
+  TCompilePhaseTimer timer(statistics, CodeGeneration);
+  TPerfLabelScope labelScope(label.empty() ? NULL : label.c_str());
+  engine->finalizeObject();
+}
+
+// A compiled row function. Engine owns the generated code and must outlive
+// any use of the function pointers.
+struct TCompiledExpression {
+  ExecutionEngine* Engine;
+  TRowFunction RowFunction;
+  TBatchFunction BatchFunction;
+};
+
+// Compiles expr into "expr" and "expr_batch" (see
+// LLVMCodegen::GetRowFunctionModule), or returns NULL functions and engine
+// if expr is ill-typed. When statistics is not NULL it is filled in and
+// added to compileCounters.
+TCompiledExpression compileExpression(
+  TConstExpressionPtr expr,
+  TCompileStatistics* statistics = NULL,
+  const TCompileOptions& options = TCompileOptions())
+{
+  std::lock_guard<std::mutex> guard(compileMutex);
+
+  const TTargetFeatures& target = options.Target
+    ? *options.Target
+    : getHostTargetFeatures();
+  TCompiledCodeCache* cache = options.Profile || options.BranchHints || options.Specialization
+    ? NULL
+    : options.Cache;
+
+  TCompiledExpression compiled;
+  compiled.Engine = NULL;
+  compiled.RowFunction = NULL;
+  compiled.BatchFunction = NULL;
+  {
+    TCompilePhaseTimer timer(statistics, Typing);
+    if (typeOf(expr) == EValueType::Null) {
+      return compiled;
+    }
+  }
+
+  LLVMCodegen codegen;
+  codegen.SetProfile(options.Profile);
+  codegen.SetBranchHints(options.BranchHints);
+  codegen.SetSpecialization(options.Specialization);
+  codegen.SetPrefetchDistance(options.PrefetchDistance);
+  {
+    TCompilePhaseTimer timer(statistics, IRGeneration);
+    codegen.EmitRowFunction(expr);
+  }
+
+  Module* module;
+  {
+    TCompilePhaseTimer timer(statistics, Linking);
+    module = codegen.LinkFunctions();
+  }
+
+  if (cache) {
+    std::string key = getCompiledCodeKey(expr, target, options.PrefetchDistance);
+    module->setModuleIdentifier(key);
+    cache->SetContents(key, serializeExpression(expr));
+  }
+
+  ExecutionEngine* engine = createOptimizedEngine(module, statistics, target, cache);
+
+  std::string label = options.Label;
+  if (label.empty() && getPerfJITEventListener()) {
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)hashExpression(expr));
+    label = hash;
+  }
+  finalizeEngine(engine, statistics, label);
+
+  compiled.Engine = engine;
+  compiled.RowFunction =
+    (TRowFunction)engine->getPointerToNamedFunction("expr");
+  compiled.BatchFunction =
+    (TBatchFunction)engine->getPointerToNamedFunction("expr_batch");
+
+  if (statistics) {
+    compileCounters.Add(*statistics);
+  }
+
+  return compiled;
+}
+
+// Compiles expr for every variant of getTargetVariants() into cache, so
+// that hosts of any kind sharing its directory find code they can run.
+// Hosts pick theirs at load time by compiling with
+// options.Target = &selectTargetVariant(getHostTargetFeatures()).
+void compileTargetVariants(TConstExpressionPtr expr, TCompiledCodeCache* cache)
+{
+  const std::vector<TTargetFeatures>& variants = getTargetVariants();
+  for (auto variant = variants.begin(); variant != variants.end(); variant++) {
+    TCompileOptions options;
+    options.Target = &*variant;
+    options.Cache = cache;
+    // The code is never run here, only emitted.
+    delete compileExpression(expr, NULL, options).Engine;
+  }
+}
+
+// Emits functions into a module with emit, then links, optimizes and
+// generates machine code for it. Of options, only Label and Target apply.
+// The returned engine owns the generated code, so it must outlive any use
+// of the functions; the compiled operators below hold it as Engine. Callers
+// hold compileMutex.
+ExecutionEngine* compileFunctions(
+  const std::function<void(LLVMCodegen* codegen)>& emit,
+  TCompileStatistics* statistics,
+  const TCompileOptions& options)
+{
+  LLVMCodegen codegen;
+  {
+    TCompilePhaseTimer timer(statistics, IRGeneration);
+    emit(&codegen);
+  }
+
+  Module* module;
+  {
+    TCompilePhaseTimer timer(statistics, Linking);
+    module = codegen.LinkFunctions();
+  }
+
+  const TTargetFeatures& target = options.Target
+    ? *options.Target
+    : getHostTargetFeatures();
+  ExecutionEngine* engine = createOptimizedEngine(module, statistics, target, NULL);
+  finalizeEngine(engine, statistics, options.Label);
+
+  if (statistics) {
+    compileCounters.Add(*statistics);
+  }
+
+  return engine;
+}
+
+struct TCompiledPipeline {
+  ExecutionEngine* Engine;
+  TPipelineFunction Function;
+};
+
+// Compiles pipeline into a single TPipelineFunction. Returns a NULL
+// Function if the pipeline is not valid (see isValidPipeline).
+TCompiledPipeline compilePipeline(
+  const TPipeline& pipeline,
+  TCompileStatistics* statistics = NULL,
+  const TCompileOptions& options = TCompileOptions())
+{
+  std::lock_guard<std::mutex> guard(compileMutex);
+
+  TCompiledPipeline compiled;
+  compiled.Engine = NULL;
+  compiled.Function = NULL;
+  {
+    TCompilePhaseTimer timer(statistics, Typing);
+    if (!isValidPipeline(pipeline)) {
+      return compiled;
+    }
+  }
+
+  compiled.Engine = compileFunctions([&] (LLVMCodegen* codegen) {
+    codegen->EmitPipelineFunction(pipeline);
+  }, statistics, options);
+  compiled.Function = (TPipelineFunction)compiled.Engine->getPointerToNamedFunction("pipeline");
+  return compiled;
+}
+
+struct TCompiledGroupBy {
+  ExecutionEngine* Engine;
+  TGroupByFunction Function;
+};
+
+// Compiles groupBy into a TGroupByFunction, to be run against tables made
+// for the same TGroupBy. Returns a NULL Function if groupBy is not valid
+// (see isValidGroupBy).
+TCompiledGroupBy compileGroupBy(
+  const TGroupBy& groupBy,
+  TCompileStatistics* statistics = NULL,
+  const TCompileOptions& options = TCompileOptions())
+{
+  std::lock_guard<std::mutex> guard(compileMutex);
+
+  TCompiledGroupBy compiled;
+  compiled.Engine = NULL;
+  compiled.Function = NULL;
+  {
+    TCompilePhaseTimer timer(statistics, Typing);
+    if (!isValidGroupBy(groupBy)) {
+      return compiled;
+    }
+  }
+
+  compiled.Engine = compileFunctions([&] (LLVMCodegen* codegen) {
+    codegen->EmitGroupByFunction(groupBy);
+  }, statistics, options);
+  compiled.Function = (TGroupByFunction)compiled.Engine->getPointerToNamedFunction("groupby");
+  return compiled;
+}
+
+struct TCompiledJoin {
+  ExecutionEngine* Engine;
+  TJoinBuildFunction Build;
+  TJoinProbeFunction Probe;
+};
+
+// Compiles the hashing of the build side of join and the probing of its
+// probe side (see TJoinHashTable). Returns NULL functions if join is not
+// valid (see isValidJoin).
+TCompiledJoin compileJoin(
+  const TJoin& join,
+  TCompileStatistics* statistics = NULL,
+  const TCompileOptions& options = TCompileOptions())
+{
+  std::lock_guard<std::mutex> guard(compileMutex);
+
+  TCompiledJoin compiled;
+  compiled.Engine = NULL;
+  compiled.Build = NULL;
+  compiled.Probe = NULL;
+  {
+    TCompilePhaseTimer timer(statistics, Typing);
+    if (!isValidJoin(join)) {
+      return compiled;
+    }
+  }
+
+  compiled.Engine = compileFunctions([&] (LLVMCodegen* codegen) {
+    codegen->EmitJoinBuildFunction(join);
+    codegen->EmitJoinProbeFunction(join);
+  }, statistics, options);
+  compiled.Build = (TJoinBuildFunction)compiled.Engine->getPointerToNamedFunction("join_build");
+  compiled.Probe = (TJoinProbeFunction)compiled.Engine->getPointerToNamedFunction("join_probe");
+  return compiled;
+}
+
+struct TCompiledOrderBy {
+  ExecutionEngine* Engine;
+  TRowComparator Compare;
+  TSortKeyFunction SortKeys;
+  int KeyCount;
+};
+
+// Compiles a comparator and a normalized key function for orderBy (see
+// sortRows and TTopK). Returns NULL functions if orderBy is not valid (see
+// isValidOrderBy).
+TCompiledOrderBy compileOrderBy(
+  const TOrderBy& orderBy,
+  TCompileStatistics* statistics = NULL,
+  const TCompileOptions& options = TCompileOptions())
+{
+  std::lock_guard<std::mutex> guard(compileMutex);
+
+  TCompiledOrderBy compiled;
+  compiled.Engine = NULL;
+  compiled.Compare = NULL;
+  compiled.SortKeys = NULL;
+  compiled.KeyCount = orderBy.Keys.size();
+  {
+    TCompilePhaseTimer timer(statistics, Typing);
+    if (!isValidOrderBy(orderBy)) {
+      return compiled;
+    }
+  }
+
+  compiled.Engine = compileFunctions([&] (LLVMCodegen* codegen) {
+    codegen->EmitComparatorFunction(orderBy);
+    codegen->EmitSortKeyFunction(orderBy);
+  }, statistics, options);
+  compiled.Compare = (TRowComparator)compiled.Engine->getPointerToNamedFunction("order_compare");
+  compiled.SortKeys = (TSortKeyFunction)compiled.Engine->getPointerToNamedFunction("order_keys");
+  return compiled;
+}
+
+struct TCompiledBlockFilter {
+  ExecutionEngine* Engine;
+  TBlockFilterFunction Function;
+};
+
+// Compiles a filter of blocks by their zone maps for predicate (see
+// scanRowFile). Returns a NULL Function if predicate is not Boolean.
+TCompiledBlockFilter compileBlockFilter(
+  TConstExpressionPtr predicate,
+  TCompileStatistics* statistics = NULL,
+  const TCompileOptions& options = TCompileOptions())
+{
+  std::lock_guard<std::mutex> guard(compileMutex);
+
+  TCompiledBlockFilter compiled;
+  compiled.Engine = NULL;
+  compiled.Function = NULL;
+  {
+    TCompilePhaseTimer timer(statistics, Typing);
+    if (typeOf(predicate) != EValueType::Boolean) {
+      return compiled;
+    }
+  }
+
+  compiled.Engine = compileFunctions([&] (LLVMCodegen* codegen) {
+    codegen->EmitBlockFilterFunction(predicate);
+  }, statistics, options);
+  compiled.Function = (TBlockFilterFunction)compiled.Engine->getPointerToNamedFunction("block_filter");
+  return compiled;
+}
+
+struct TCompiledCodeFilter {
+  ExecutionEngine* Engine;
+  TCodeFilterFunction Function;
+};
+
+// Compiles a filter of the codes of a dictionary-encoded column for
+// predicate, as resolved against its dictionary (see
+// resolveStringPredicate).
+TCompiledCodeFilter compileCodeFilter(
+  const TCodePredicate& predicate,
+  TCompileStatistics* statistics = NULL,
+  const TCompileOptions& options = TCompileOptions())
+{
+  std::lock_guard<std::mutex> guard(compileMutex);
+
+  TCompiledCodeFilter compiled;
+  compiled.Engine = compileFunctions([&] (LLVMCodegen* codegen) {
+    codegen->EmitCodeFilterFunction(predicate);
+  }, statistics, options);
+  compiled.Function = (TCodeFilterFunction)compiled.Engine->getPointerToNamedFunction("code_filter");
+  return compiled;
+}
+
+struct TCompiledMaterialize {
+  ExecutionEngine* Engine;
+  TMaterializeFunction Function;
+};
+
+// Compiles a function writing the projections of the rows that pass
+// predicate, which may be NULL, as rows of a TRowWriter. Returns a NULL
+// Function if predicate is not Boolean or a projection is untyped or a
+// string, as generated code has no length to copy strings with (see
+// TRowWriter::SetString).
+TCompiledMaterialize compileMaterialize(
+  TConstExpressionPtr predicate,
+  const std::vector<TConstExpressionPtr>& projections,
+  TCompileStatistics* statistics = NULL,
+  const TCompileOptions& options = TCompileOptions())
+{
+  std::lock_guard<std::mutex> guard(compileMutex);
+
+  TCompiledMaterialize compiled;
+  compiled.Engine = NULL;
+  compiled.Function = NULL;
+  {
+    TCompilePhaseTimer timer(statistics, Typing);
+    if (predicate && typeOf(predicate) != EValueType::Boolean) {
+      return compiled;
+    }
+    for (auto projection = projections.begin(); projection != projections.end(); projection++) {
+      EValueType type = typeOf(*projection);
+      if (type == EValueType::Null || type == EValueType::String) {
+        return compiled;
+      }
+    }
+  }
+
+  compiled.Engine = compileFunctions([&] (LLVMCodegen* codegen) {
+    codegen->EmitMaterializeFunction(predicate, projections);
+  }, statistics, options);
+  compiled.Function = (TMaterializeFunction)compiled.Engine->getPointerToNamedFunction("materialize");
+  return compiled;
+}
@@ -0,0 +1,260 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <dlfcn.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "YTTypes.h"
+#include "TargetFeatures.h"
+
+// Shared objects of expressions compiled ahead of time by aot-compile.
+// Besides the row functions of every expression, "<name>" and
+// "<name>_batch", a library defines
+//
+//   yt_expression_library_abi       the TExpressionLibraryABI it was built for
+//   yt_expression_library_manifest  its TExpressionManifest, as text
+//
+// and the manifest is also written next to it as "<library>.manifest".
+
+/* ABI */
+
+const ui32 ExpressionLibraryMagic = 0x59544558; // "YTEX"
+// Bumped whenever generated functions change signature or calling
+// convention in ways the layout below does not show.
+const ui32 ExpressionLibraryVersion = 1;
+
+// Layout of the types generated code shares with its callers, which must
+// be the same in the library and the process loading it.
+struct TExpressionLibraryABI {
+  ui32 Magic;
+  ui32 Version;
+  ui32 ValueSize;
+  ui32 ValueIdOffset;
+  ui32 ValueTypeOffset;
+  ui32 ValueLengthOffset;
+  ui32 ValueDataOffset;
+  ui32 BooleanSize;
+  ui32 RowHeaderSize;
+  ui32 ValueTypeCount;
+};
+
+TExpressionLibraryABI getExpressionLibraryABI()
+{
+  TExpressionLibraryABI abi;
+  memset(&abi, 0, sizeof(abi));
+  abi.Magic = ExpressionLibraryMagic;
+  abi.Version = ExpressionLibraryVersion;
+  abi.ValueSize = sizeof(TValue);
+  abi.ValueIdOffset = offsetof(TValue, Id);
+  abi.ValueTypeOffset = offsetof(TValue, Type);
+  abi.ValueLengthOffset = offsetof(TValue, Length);
+  abi.ValueDataOffset = offsetof(TValue, Data);
+  abi.BooleanSize = sizeof(bool);
+  abi.RowHeaderSize = sizeof(TRowHeader);
+  abi.ValueTypeCount = EValueType::Any + 1;
+  return abi;
+}
+
+/* Manifest */
+
+// What a library contains, one line per item:
+//
+//   target <cpu> <attribute>,<attribute>,...   ("-" for no attributes)
+//   expr <name> <result type> <source>
+struct TExpressionManifest {
+  struct TEntry {
+    std::string Name;
+    EValueType Type;
+    std::string Source;
+  };
+
+  TTargetFeatures Target;
+  std::vector<TEntry> Expressions;
+
+  std::string Format() const;
+  // Returns false and describes the problem in error on malformed text.
+  bool Parse(const std::string& text, std::string* error);
+};
+
+std::string TExpressionManifest::Format() const
+{
+  std::ostringstream output;
+  output << "target " << (Target.CPU.empty() ? "-" : Target.CPU) << " ";
+  if (Target.Attributes.empty()) {
+    output << "-";
+  }
+  for (size_t i = 0; i < Target.Attributes.size(); i++) {
+    output << (i ? "," : "") << Target.Attributes[i];
+  }
+  output << "\n";
+
+  for (auto entry = Expressions.begin(); entry != Expressions.end(); entry++) {
+    output << "expr " << entry->Name
+      << " " << getValueTypeName(entry->Type)
+      << " " << entry->Source << "\n";
+  }
+  return output.str();
+}
+
+bool TExpressionManifest::Parse(const std::string& text, std::string* error)
+{
+  Target = TTargetFeatures();
+  Expressions.clear();
+
+  std::istringstream input(text);
+  std::string line;
+  for (int lineNumber = 1; std::getline(input, line); lineNumber++) {
+    std::istringstream fields(line);
+    std::string kind;
+    fields >> kind;
+
+    if (kind == "target") {
+      std::string cpu;
+      std::string attributes;
+      fields >> cpu >> attributes;
+      Target.CPU = cpu == "-" ? "" : cpu;
+      std::istringstream attributeList(attributes == "-" ? "" : attributes);
+      std::string attribute;
+      while (std::getline(attributeList, attribute, ',')) {
+        Target.Attributes.push_back(attribute);
+      }
+    } else if (kind == "expr") {
+      TEntry entry;
+      std::string typeName;
+      fields >> entry.Name >> typeName;
+      if (entry.Name.empty() || !parseValueTypeName(typeName, &entry.Type)) {
+        *error = "malformed manifest entry on line " + std::to_string(lineNumber);
+        return false;
+      }
+      std::getline(fields >> std::ws, entry.Source);
+      Expressions.push_back(entry);
+    } else if (!kind.empty()) {
+      *error = "unknown manifest entry \"" + kind + "\" on line " + std::to_string(lineNumber);
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Runtime */
+
+struct TLibraryExpression {
+  std::string Name;
+  EValueType Type;
+  std::string Source;
+  TRowFunction RowFunction;
+  TBatchFunction BatchFunction;
+};
+
+// A loaded expression library. Its functions are valid for the lifetime of
+// the object.
+class TExpressionLibrary {
+public:
+  // Returns NULL and describes the problem in error if the library cannot
+  // be loaded, was built against a different layout of YTTypes.h, or needs
+  // CPU features this host lacks.
+  static TExpressionLibrary* Load(const std::string& path, std::string* error);
+
+  ~TExpressionLibrary()
+  {
+    dlclose(Handle);
+  }
+
+  const TExpressionManifest& GetManifest() const
+  {
+    return Manifest;
+  }
+
+  const std::vector<TLibraryExpression>& GetExpressions() const
+  {
+    return Expressions;
+  }
+
+  // Returns NULL if the library has no expression called name.
+  const TLibraryExpression* Find(const std::string& name) const
+  {
+    for (auto expression = Expressions.begin(); expression != Expressions.end(); expression++) {
+      if (expression->Name == name) {
+        return &*expression;
+      }
+    }
+    return NULL;
+  }
+
+private:
+  explicit TExpressionLibrary(void* handle)
+    : Handle(handle)
+  { }
+
+  TExpressionLibrary(const TExpressionLibrary&) = delete;
+  void operator=(const TExpressionLibrary&) = delete;
+
+  void* Handle;
+  TExpressionManifest Manifest;
+  std::vector<TLibraryExpression> Expressions;
+
+  bool Initialize(std::string* error);
+};
+
+TExpressionLibrary* TExpressionLibrary::Load(const std::string& path, std::string* error)
+{
+  void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!handle) {
+    *error = dlerror();
+    return NULL;
+  }
+
+  TExpressionLibrary* library = new TExpressionLibrary(handle);
+  if (!library->Initialize(error)) {
+    *error = path + ": " + *error;
+    delete library;
+    return NULL;
+  }
+  return library;
+}
+
+bool TExpressionLibrary::Initialize(std::string* error)
+{
+  const TExpressionLibraryABI* abi =
+    (const TExpressionLibraryABI*)dlsym(Handle, "yt_expression_library_abi");
+  const char* manifest = (const char*)dlsym(Handle, "yt_expression_library_manifest");
+  if (!abi || !manifest) {
+    *error = "not an expression library";
+    return false;
+  }
+
+  TExpressionLibraryABI expectedABI = getExpressionLibraryABI();
+  if (abi->Magic != expectedABI.Magic || abi->Version != expectedABI.Version) {
+    *error = "built for expression library version " + std::to_string(abi->Version)
+      + ", expected " + std::to_string(expectedABI.Version);
+    return false;
+  }
+  if (memcmp(abi, &expectedABI, sizeof(expectedABI)) != 0) {
+    *error = "built against a different layout of YTTypes.h";
+    return false;
+  }
+
+  if (!Manifest.Parse(manifest, error)) {
+    return false;
+  }
+  if (!Manifest.Target.IsSupportedBy(getHostTargetFeatures())) {
+    *error = "built for " + Manifest.Target.GetKey() + ", which this host does not support";
+    return false;
+  }
+
+  for (auto entry = Manifest.Expressions.begin(); entry != Manifest.Expressions.end(); entry++) {
+    TLibraryExpression expression;
+    expression.Name = entry->Name;
+    expression.Type = entry->Type;
+    expression.Source = entry->Source;
+    expression.RowFunction = (TRowFunction)dlsym(Handle, entry->Name.c_str());
+    expression.BatchFunction = (TBatchFunction)dlsym(Handle, (entry->Name + "_batch").c_str());
+    if (!expression.RowFunction || !expression.BatchFunction) {
+      *error = "missing functions of expression " + entry->Name;
+      return false;
+    }
+    Expressions.push_back(expression);
+  }
+  return true;
+}
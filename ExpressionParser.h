@@ -0,0 +1,302 @@
+#pragma once
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "TExpressionInterpreter.h"
+#include "TExpressionTyper.h"
+using namespace TExpressionTyper;
+
+// Parses expressions written with C operators and precedence, e.g.
+//
+//   $0:Int64 * 2 + 1 > $1:Int64 && ($2:Boolean || f($3:Double) == 0.5)
+//
+// "$<index>:<type>" refers to a column of the row. Integer literals are
+// decimal and Int64 unless suffixed with "u", literals with a point or
+// exponent are Double, and true and false are Boolean. Unary minus, as in
+// -$0:Int64 or -(...), is 0 - operand. Functions are looked up in the
+// registry by name and argument types.
+class TExpressionParser {
+public:
+  explicit TExpressionParser(TExpressionArena* arena)
+    : Arena(arena)
+  { }
+
+  // Returns NULL and describes the problem in error if text is not a
+  // well-formed expression or does not type check.
+  TConstExpressionPtr Parse(StringRef text, std::string* error);
+
+private:
+  TExpressionArena* Arena;
+  StringRef Text;
+  size_t Position;
+  std::string Error;
+
+  static const int PrimaryPrecedence = 6;
+
+  TConstExpressionPtr ParseBinary(int precedence);
+  TConstExpressionPtr ParsePrimary();
+  TConstExpressionPtr ParseNumber();
+  TConstExpressionPtr ParseReference();
+  TConstExpressionPtr ParseCall(StringRef name);
+  bool ParseOperator(int precedence, EBinaryOp* opcode);
+  StringRef ParseIdentifier();
+  bool Consume(StringRef token);
+  void SkipSpace();
+  TConstExpressionPtr Fail(const std::string& message);
+};
+
+TConstExpressionPtr TExpressionParser::Parse(StringRef text, std::string* error)
+{
+  Text = text;
+  Position = 0;
+  Error.clear();
+
+  TConstExpressionPtr expr = ParseBinary(0);
+  if (expr) {
+    SkipSpace();
+    if (Position != Text.size()) {
+      expr = Fail(std::string("unexpected '") + Text[Position] + "'");
+    }
+  }
+  if (expr && typeOf(expr) == EValueType::Null) {
+    Position = 0;
+    expr = Fail("expression does not type check");
+  }
+
+  if (!expr && error) {
+    *error = Error;
+  }
+  return expr;
+}
+
+TConstExpressionPtr TExpressionParser::ParseBinary(int precedence)
+{
+  if (precedence == PrimaryPrecedence) {
+    return ParsePrimary();
+  }
+
+  // Left-associative: a - b - c is (a - b) - c.
+  TConstExpressionPtr lhs = ParseBinary(precedence + 1);
+  EBinaryOp opcode;
+  while (lhs && ParseOperator(precedence, &opcode)) {
+    TConstExpressionPtr rhs = ParseBinary(precedence + 1);
+    if (!rhs) {
+      return NULL;
+    }
+    lhs = Arena->NewBinaryOp(EValueType::Null, opcode, lhs, rhs);
+  }
+  return lhs;
+}
+
+bool TExpressionParser::ParseOperator(int precedence, EBinaryOp* opcode)
+{
+  struct TOperator {
+    const char* Token;
+    EBinaryOp Opcode;
+    int Precedence;
+  };
+  // Longer tokens come before their prefixes.
+  static const TOperator operators[] = {
+    { "||", Or, 0 },
+    { "&&", And, 1 },
+    { "==", Equal, 2 },
+    { "!=", NotEqual, 2 },
+    { "<=", LessOrEqual, 3 },
+    { ">=", GreaterOrEqual, 3 },
+    { "<", Less, 3 },
+    { ">", Greater, 3 },
+    { "+", Plus, 4 },
+    { "-", Minus, 4 },
+    { "*", Multiply, 5 },
+    { "/", Divide, 5 },
+    { "%", Modulo, 5 },
+  };
+
+  for (const TOperator& op : operators) {
+    if (op.Precedence == precedence && Consume(op.Token)) {
+      *opcode = op.Opcode;
+      return true;
+    }
+  }
+  return false;
+}
+
+TConstExpressionPtr TExpressionParser::ParsePrimary()
+{
+  SkipSpace();
+  if (Position == Text.size()) {
+    return Fail("unexpected end of expression");
+  }
+
+  char next = Text[Position];
+  if (Consume("(")) {
+    TConstExpressionPtr expr = ParseBinary(0);
+    if (expr && !Consume(")")) {
+      return Fail("expected ')'");
+    }
+    return expr;
+  }
+  if (next == '$') {
+    return ParseReference();
+  }
+  bool numberFollows = Position + 1 < Text.size()
+    && (isdigit(Text[Position + 1]) || Text[Position + 1] == '.');
+  if (isdigit(next) || next == '.' || (next == '-' && numberFollows)) {
+    return ParseNumber();
+  }
+  if (Consume("-")) {
+    TConstExpressionPtr operand = ParsePrimary();
+    if (!operand) {
+      return NULL;
+    }
+    // Null operands fail to type check later, whatever the zero.
+    EValueType type = typeOf(operand);
+    TValue zero = TExpressionInterpreter::makeValue(type == EValueType::Null ? EValueType::Int64 : type);
+    return Arena->NewBinaryOp(EValueType::Null, Minus, Arena->NewLiteral(zero), operand);
+  }
+
+  StringRef name = ParseIdentifier();
+  if (name.empty()) {
+    return Fail(std::string("unexpected '") + next + "'");
+  }
+  if (name == "true" || name == "false") {
+    TValue value = TExpressionInterpreter::makeValue(EValueType::Boolean);
+    value.Data.Boolean = name == "true";
+    return Arena->NewLiteral(value);
+  }
+  return ParseCall(name);
+}
+
+TConstExpressionPtr TExpressionParser::ParseNumber()
+{
+  // strtoll and friends need a terminated string.
+  std::string rest = Text.substr(Position).str();
+  const char* begin = rest.c_str();
+  char* integerEnd;
+  char* doubleEnd;
+  errno = 0;
+  strtoll(begin, &integerEnd, 10);
+  strtod(begin, &doubleEnd);
+  if (doubleEnd == begin) {
+    return Fail("expected a number");
+  }
+  // strtod also reads hexadecimal, infinities and NaNs.
+  for (const char* digit = begin; digit < doubleEnd; digit++) {
+    if (!isdigit(*digit) && !strchr(".eE+-", *digit)) {
+      return Fail("expected a decimal number");
+    }
+  }
+
+  TValue value;
+  char* end;
+  errno = 0;
+  if (doubleEnd > integerEnd) {
+    value = TExpressionInterpreter::makeValue(EValueType::Double);
+    value.Data.Double = strtod(begin, &end);
+  } else if (*integerEnd == 'u') {
+    if (*begin == '-') {
+      return Fail("unsigned literal is negative");
+    }
+    value = TExpressionInterpreter::makeValue(EValueType::Uint64);
+    value.Data.Uint64 = strtoull(begin, &end, 10);
+    end++;
+  } else {
+    value = TExpressionInterpreter::makeValue(EValueType::Int64);
+    value.Data.Int64 = strtoll(begin, &end, 10);
+  }
+  if (errno == ERANGE) {
+    return Fail("literal out of range");
+  }
+
+  Position += end - begin;
+  return Arena->NewLiteral(value);
+}
+
+TConstExpressionPtr TExpressionParser::ParseReference()
+{
+  // $<index>:<type>
+  Position++;
+  size_t start = Position;
+  while (Position < Text.size() && isdigit(Text[Position])) {
+    Position++;
+  }
+  if (Position == start) {
+    return Fail("expected a column index after '$'");
+  }
+  int columnIndex = atoi(Text.substr(start, Position - start).str().c_str());
+
+  EValueType type;
+  if (!Consume(":")) {
+    return Fail("expected ':' and the type of the column");
+  }
+  SkipSpace();
+  if (!parseValueTypeName(ParseIdentifier(), &type)) {
+    return Fail("unknown type");
+  }
+  return Arena->NewReference(type, columnIndex);
+}
+
+TConstExpressionPtr TExpressionParser::ParseCall(StringRef name)
+{
+  if (!registry->GetFunction(name.str())) {
+    Position -= name.size();
+    return Fail("unknown function " + name.str());
+  }
+  if (!Consume("(")) {
+    return Fail("expected '(' after function name");
+  }
+  TArguments arguments;
+  if (!Consume(")")) {
+    do {
+      TConstExpressionPtr argument = ParseBinary(0);
+      if (!argument) {
+        return NULL;
+      }
+      arguments.push_back(argument);
+    } while (Consume(","));
+    if (!Consume(")")) {
+      return Fail("expected ')' after arguments");
+    }
+  }
+  return Arena->NewFunction(EValueType::Null, name, arguments);
+}
+
+StringRef TExpressionParser::ParseIdentifier()
+{
+  size_t start = Position;
+  while (Position < Text.size()
+         && (isalnum(Text[Position]) || Text[Position] == '_')) {
+    if (Position == start && isdigit(Text[Position])) {
+      break;
+    }
+    Position++;
+  }
+  return Text.substr(start, Position - start);
+}
+
+bool TExpressionParser::Consume(StringRef token)
+{
+  SkipSpace();
+  if (Text.substr(Position).startswith(token)) {
+    Position += token.size();
+    return true;
+  }
+  return false;
+}
+
+void TExpressionParser::SkipSpace()
+{
+  while (Position < Text.size() && isspace(Text[Position])) {
+    Position++;
+  }
+}
+
+TConstExpressionPtr TExpressionParser::Fail(const std::string& message)
+{
+  if (Error.empty()) {
+    Error = "column " + std::to_string(Position + 1) + ": " + message;
+  }
+  return NULL;
+}
@@ -1,3 +1,4 @@
+#pragma once
 #include <unordered_map>
 #include <memory>
 #include "llvm/IR/IRBuilder.h"
@@ -7,11 +8,13 @@ struct FunctionSignature {
     std::string name,
     std::vector<EValueType> argumentTypes,
     EValueType returnType,
-    std::function<Module*(IRBuilder<>&)> irEmitter)
+    std::function<Module*(IRBuilder<>&)> irEmitter,
+    std::string symbolName = "")
     : Name(name)
     , ArgumentTypes(argumentTypes)
     , ReturnType(returnType)
     , IREmitter(irEmitter)
+    , SymbolName(symbolName.empty() ? name : symbolName)
   { }
 
   FunctionSignature(
@@ -20,6 +23,7 @@ struct FunctionSignature {
     , ArgumentTypes(other.ArgumentTypes)
     , ReturnType(other.ReturnType)
     , IREmitter(other.IREmitter)
+    , SymbolName(other.SymbolName)
    { }
 
   std::string Name;
@@ -28,11 +32,15 @@ struct FunctionSignature {
   // When called, IREmitter creates a Module containing this function's
   // definition and returns it
   std::function<Module*(IRBuilder<>&)> IREmitter;
+  // Name of the LLVM function defined by IREmitter. Overloads sharing a
+  // Name must use distinct symbol names to be linked into one module.
+  std::string SymbolName;
 };
 
 // Registry containing metadata about functions and operators.
 // Overloaded functions or operators can be retrieved by specifying
-// restrictions in the resultType and argTypes arguments of GetFunction
+// restrictions in the resultType and argTypes arguments of GetFunction,
+// which returns NULL when no function matches.
 class FunctionRegistry {
 public:
   void AddFunction(const FunctionSignature& function);
@@ -69,12 +77,15 @@ const FunctionSignature* FunctionRegistry::GetFunction(
   const EValueType resultType,
   const std::vector<EValueType>* argTypes)
 {
-  std::vector<FunctionSignature> overloads = FunctionMap.at(functionName);
+  auto entry = FunctionMap.find(functionName);
+  if (entry == FunctionMap.end()) {
+    return NULL;
+  }
+  const std::vector<FunctionSignature>& overloads = entry->second;
 
-  int i = 0;
   for (auto signature = overloads.begin();
        signature != overloads.end();
-       signature++, i++) {
+       signature++) {
     if (resultType != EValueType::Null
         && resultType != signature->ReturnType) {
       continue;
@@ -84,7 +95,7 @@ const FunctionSignature* FunctionRegistry::GetFunction(
         && *argTypes != signature->ArgumentTypes) {
       continue;
     }
-    return &FunctionMap.at(functionName)[i];
+    return &*signature;
   }
   return NULL;
 }
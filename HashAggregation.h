@@ -0,0 +1,284 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "Aggregates.h"
+#include "KeyHashing.h"
+#include "TArena.h"
+
+// SELECT <keys>, <aggregates> FROM rows GROUP BY <keys>. Keys must be of
+// fixed-width types (see isKeyType).
+struct TGroupBy {
+  std::vector<TConstExpressionPtr> Keys;
+  std::vector<TAggregate> Aggregates;
+};
+
+bool isValidGroupBy(const TGroupBy& groupBy)
+{
+  for (auto key = groupBy.Keys.begin(); key != groupBy.Keys.end(); key++) {
+    if (!isKeyType(typeOf(*key))) {
+      return false;
+    }
+  }
+  for (auto aggregate = groupBy.Aggregates.begin();
+       aggregate != groupBy.Aggregates.end();
+       aggregate++) {
+    if (getAggregateType(*aggregate) == EValueType::Null) {
+      return false;
+    }
+  }
+  return !groupBy.Keys.empty();
+}
+
+/* Hash table */
+
+// The table is open-addressed with linear probing over 16-byte slots,
+// four to a cache line, holding the hash of a group and its entry. Entries
+// are the key words (see KeyHashing.h) followed by the aggregate states
+// (see Aggregates.h) and are allocated from an arena sized for the expected
+// number of groups, so they never move.
+struct TGroupBySlot {
+  ui64 Hash;
+  // NULL for free slots.
+  ui64* Entry;
+};
+
+class TGroupByHashTable;
+
+// The part of the table generated code reads; LLVMCodegen relies on the
+// order of the fields.
+struct TGroupByTableHeader {
+  TGroupBySlot* Slots;
+  ui64 Mask;
+  TGroupByHashTable* Table;
+};
+
+// Aggregates count rows into table (see LLVMCodegen::EmitGroupByFunction).
+typedef void (*TGroupByFunction)(TRow* rows, i64 count, TGroupByTableHeader* table);
+
+class TGroupByHashTable {
+public:
+  static const size_t CacheLineSize = 64;
+
+  explicit TGroupByHashTable(const TGroupBy& groupBy, size_t expectedGroups = 1024);
+  ~TGroupByHashTable();
+
+  TGroupByHashTable(const TGroupByHashTable&) = delete;
+  void operator=(const TGroupByHashTable&) = delete;
+
+  TGroupByTableHeader* GetHeader()
+  {
+    return &Header;
+  }
+
+  size_t GetGroupCount() const
+  {
+    return Entries.size();
+  }
+
+  // The keys of the index-th group followed by its aggregates. Groups are
+  // numbered in the order they were first seen.
+  std::vector<TValue> GetGroup(size_t index) const;
+
+  // Adds the groups of other, which must have the same TGroupBy.
+  void Merge(const TGroupByHashTable& other);
+
+  // Adds a group for keys, whose hash is not in the table, at slot, the
+  // free slot its probe ended at. Returns the entry of the group, with its
+  // aggregate states initialized.
+  ui64* Insert(ui64 hash, const ui64* keys, ui64 slot);
+
+private:
+  TGroupByTableHeader Header;
+  std::vector<EValueType> KeyTypes;
+  std::vector<TAggregate> Aggregates;
+  int KeyCount;
+  int StateSlots;
+  TArena EntryArena;
+  std::vector<ui64*> Entries;
+
+  size_t GetEntrySize() const
+  {
+    return (KeyCount + StateSlots) * sizeof(ui64);
+  }
+
+  // Returns the entry of keys, or NULL and the free slot where it belongs.
+  ui64* Find(ui64 hash, const ui64* keys, ui64* slot) const;
+  void AllocateSlots(size_t capacity);
+  void Grow();
+};
+
+// Called by generated code.
+ui64* groupByInsert(TGroupByTableHeader* header, ui64 hash, const ui64* keys, ui64 slot)
+{
+  return header->Table->Insert(hash, keys, slot);
+}
+
+static size_t getGroupByCapacity(size_t groups)
+{
+  // At most half full.
+  size_t capacity = 16;
+  while (capacity < 2 * groups) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+// Room for the entries of all expected groups in the first chunk.
+static size_t getGroupByArenaSize(const TGroupBy& groupBy, size_t expectedGroups)
+{
+  size_t entrySize = (groupBy.Keys.size() + getAggregateStateSlots(groupBy.Aggregates)) * sizeof(ui64);
+  size_t size = expectedGroups * entrySize;
+  return size > TArena::DefaultChunkSize ? size : TArena::DefaultChunkSize;
+}
+
+TGroupByHashTable::TGroupByHashTable(const TGroupBy& groupBy, size_t expectedGroups)
+  : Aggregates(groupBy.Aggregates)
+  , KeyCount(groupBy.Keys.size())
+  , StateSlots(getAggregateStateSlots(groupBy.Aggregates))
+  , EntryArena(getGroupByArenaSize(groupBy, expectedGroups))
+{
+  for (auto key = groupBy.Keys.begin(); key != groupBy.Keys.end(); key++) {
+    KeyTypes.push_back(typeOf(*key));
+  }
+  Header.Table = this;
+  Header.Slots = NULL;
+  AllocateSlots(getGroupByCapacity(expectedGroups));
+  Entries.reserve(expectedGroups);
+}
+
+TGroupByHashTable::~TGroupByHashTable()
+{
+  free(Header.Slots);
+}
+
+void TGroupByHashTable::AllocateSlots(size_t capacity)
+{
+  void* slots = NULL;
+  // Grow runs from generated code, which cannot fail, so running out of
+  // memory is fatal, as it is for the std::vector of entries.
+  if (posix_memalign(&slots, CacheLineSize, capacity * sizeof(TGroupBySlot)) != 0) {
+    fprintf(stderr, "cannot allocate %zu group by slots\n", capacity);
+    abort();
+  }
+  memset(slots, 0, capacity * sizeof(TGroupBySlot));
+  Header.Slots = static_cast<TGroupBySlot*>(slots);
+  Header.Mask = capacity - 1;
+}
+
+void TGroupByHashTable::Grow()
+{
+  TGroupBySlot* oldSlots = Header.Slots;
+  size_t oldCapacity = Header.Mask + 1;
+  AllocateSlots(2 * oldCapacity);
+  for (size_t i = 0; i < oldCapacity; i++) {
+    if (oldSlots[i].Entry) {
+      ui64 slot = oldSlots[i].Hash & Header.Mask;
+      while (Header.Slots[slot].Entry) {
+        slot = (slot + 1) & Header.Mask;
+      }
+      Header.Slots[slot] = oldSlots[i];
+    }
+  }
+  free(oldSlots);
+}
+
+ui64* TGroupByHashTable::Insert(ui64 hash, const ui64* keys, ui64 slot)
+{
+  ui64* entry = static_cast<ui64*>(EntryArena.Allocate(GetEntrySize(), sizeof(ui64)));
+  memcpy(entry, keys, KeyCount * sizeof(ui64));
+  initAggregateStates(Aggregates, entry + KeyCount);
+  Entries.push_back(entry);
+
+  Header.Slots[slot].Hash = hash;
+  Header.Slots[slot].Entry = entry;
+  if (2 * Entries.size() > Header.Mask + 1) {
+    Grow();
+  }
+  return entry;
+}
+
+ui64* TGroupByHashTable::Find(ui64 hash, const ui64* keys, ui64* slot) const
+{
+  ui64 index = hash & Header.Mask;
+  while (true) {
+    const TGroupBySlot& candidate = Header.Slots[index];
+    if (!candidate.Entry) {
+      *slot = index;
+      return NULL;
+    }
+    if (candidate.Hash == hash
+        && memcmp(candidate.Entry, keys, KeyCount * sizeof(ui64)) == 0) {
+      return candidate.Entry;
+    }
+    index = (index + 1) & Header.Mask;
+  }
+}
+
+void TGroupByHashTable::Merge(const TGroupByHashTable& other)
+{
+  for (auto otherEntry = other.Entries.begin(); otherEntry != other.Entries.end(); otherEntry++) {
+    ui64 hash = hashKeyWords(*otherEntry, KeyCount);
+    ui64 slot;
+    ui64* entry = Find(hash, *otherEntry, &slot);
+    if (!entry) {
+      entry = Insert(hash, *otherEntry, slot);
+    }
+    mergeAggregateStates(Aggregates, entry + KeyCount, *otherEntry + KeyCount);
+  }
+}
+
+std::vector<TValue> TGroupByHashTable::GetGroup(size_t index) const
+{
+  const ui64* entry = Entries[index];
+  std::vector<TValue> group;
+  for (int i = 0; i < KeyCount; i++) {
+    group.push_back(makeKeyValue(entry[i], KeyTypes[i]));
+  }
+  std::vector<TValue> aggregates = finalizeAggregateStates(Aggregates, entry + KeyCount);
+  group.insert(group.end(), aggregates.begin(), aggregates.end());
+  return group;
+}
+
+/* Parallel aggregation */
+
+// Aggregates count rows with threadCount threads, each into a partial
+// table of its own over a contiguous range of rows, and merges the partial
+// tables into the returned one.
+TGroupByHashTable* aggregateInParallel(
+  TGroupByFunction function,
+  const TGroupBy& groupBy,
+  TRow* rows,
+  i64 count,
+  int threadCount,
+  size_t expectedGroups = 1024)
+{
+  threadCount = std::max(1, threadCount);
+  std::vector<TGroupByHashTable*> partials;
+  for (int t = 0; t < threadCount; t++) {
+    partials.push_back(new TGroupByHashTable(groupBy, expectedGroups));
+  }
+
+  std::vector<std::thread> threads;
+  i64 rangeSize = (count + threadCount - 1) / threadCount;
+  for (int t = 0; t < threadCount; t++) {
+    i64 begin = std::min(count, t * rangeSize);
+    i64 end = std::min(count, begin + rangeSize);
+    TGroupByTableHeader* header = partials[t]->GetHeader();
+    threads.push_back(std::thread([=] () {
+      function(rows + begin, end - begin, header);
+    }));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (int t = 1; t < threadCount; t++) {
+    partials[0]->Merge(*partials[t]);
+    delete partials[t];
+  }
+  return partials[0];
+}
@@ -0,0 +1,288 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstring>
+#include <vector>
+#include "KeyHashing.h"
+#include "TExpressionTyper.h"
+using namespace TExpressionTyper;
+
+// Inner equi-join of two row streams:
+//
+//   SELECT * FROM build JOIN probe ON BuildKeys[i] = ProbeKeys[i]
+//
+// The build side is hashed into a TJoinHashTable, then probe rows are
+// looked up in it (see LLVMCodegen::EmitJoinBuildFunction and
+// EmitJoinProbeFunction). Keys must be of fixed-width types (see isKeyType)
+// and pairwise of the same type.
+struct TJoin {
+  std::vector<TConstExpressionPtr> BuildKeys;
+  std::vector<TConstExpressionPtr> ProbeKeys;
+};
+
+bool isValidJoin(const TJoin& join)
+{
+  if (join.BuildKeys.empty() || join.BuildKeys.size() != join.ProbeKeys.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < join.BuildKeys.size(); i++) {
+    EValueType type = typeOf(join.BuildKeys[i]);
+    if (!isKeyType(type) || typeOf(join.ProbeKeys[i]) != type) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Output */
+
+struct TJoinMatch {
+  TRow Probe;
+  TRow Build;
+};
+
+// Matches appended by probe functions. Generated code relies on the order of
+// the fields.
+struct TJoinOutput {
+  TJoinMatch* Data;
+  i64 Size;
+  i64 Capacity;
+
+  explicit TJoinOutput(i64 capacity = 1024)
+    : Data(static_cast<TJoinMatch*>(malloc(capacity * sizeof(TJoinMatch))))
+    , Size(0)
+    , Capacity(capacity)
+  { }
+
+  ~TJoinOutput()
+  {
+    free(Data);
+  }
+
+  TJoinOutput(const TJoinOutput&) = delete;
+  void operator=(const TJoinOutput&) = delete;
+
+  void Clear()
+  {
+    Size = 0;
+  }
+};
+
+// Called by generated code when output is full. Generated code cannot
+// handle failure, so running out of memory is fatal.
+void joinGrowOutput(TJoinOutput* output)
+{
+  output->Capacity *= 2;
+  void* data = realloc(output->Data, output->Capacity * sizeof(TJoinMatch));
+  if (!data) {
+    fprintf(stderr, "cannot allocate %lld join matches\n", (long long)output->Capacity);
+    abort();
+  }
+  output->Data = static_cast<TJoinMatch*>(data);
+}
+
+/* Hash table */
+
+// Computes the hash of the build keys of count rows into hashes[i] and
+// their key words (see KeyHashing.h) into keys[i * keyCount + j].
+typedef void (*TJoinBuildFunction)(TRow* rows, i64 count, ui64* hashes, ui64* keys);
+
+// The table is split by the top bits of the hash into partitions, each an
+// open-addressed table with linear probing over 16-byte slots holding the
+// hash of a build row and its entry: the key words followed by the row.
+// Rows with equal keys all lie between the start slot of their hash and the
+// next free slot, but other keys may lie in between, so a probe compares
+// hashes and keys of every slot up to the free one.
+//
+// The slots of a partition are allocated cache-line aligned. Large build
+// sides are split so that each partition fits in the L2 cache while it is
+// being built, instead of inserting into one table far larger than the
+// cache.
+struct TJoinSlot {
+  ui64 Hash;
+  // NULL for free slots.
+  ui64* Entry;
+};
+
+struct TJoinPartition {
+  TJoinSlot* Slots;
+  ui64 Mask;
+};
+
+// A partition is picked by (hash >> JoinPartitionShift) & PartitionMask and
+// a slot in it by hash & Mask.
+const int JoinPartitionShift = 48;
+const int MaxJoinPartitionBits = 12;
+const size_t JoinPartitionBytes = 256 * 1024;
+
+// A blocked bloom filter over the build hashes, checked before probing so
+// that probe rows without a match skip the cache misses of the table: each
+// hash sets two bits in the 64-bit word (hash >> JoinBloomShift) & BloomMask.
+const int JoinBloomShift = 24;
+const int JoinBloomBitsPerRow = 16;
+
+ui64 getJoinBloomBits(ui64 hash)
+{
+  return (1ULL << (hash & 63)) | (1ULL << ((hash >> 6) & 63));
+}
+
+// The part of the table probe functions read; LLVMCodegen relies on the
+// order of the fields.
+struct TJoinTableHeader {
+  TJoinPartition* Partitions;
+  ui64 PartitionMask;
+  ui64* Bloom;
+  ui64 BloomMask;
+};
+
+// Probe rows are hashed and their slots prefetched this many at a time.
+const int JoinProbeBatchSize = 16;
+
+// Appends the matches of count rows in table to output.
+typedef void (*TJoinProbeFunction)(TRow* rows, i64 count, TJoinTableHeader* table, TJoinOutput* output);
+
+class TJoinHashTable {
+public:
+  static const size_t CacheLineSize = 64;
+
+  explicit TJoinHashTable(int keyCount)
+    : KeyCount(keyCount)
+  {
+    Header.Partitions = NULL;
+    Header.PartitionMask = 0;
+    Header.Bloom = NULL;
+    Header.BloomMask = 0;
+  }
+
+  ~TJoinHashTable()
+  {
+    FreePartitions();
+  }
+
+  TJoinHashTable(const TJoinHashTable&) = delete;
+  void operator=(const TJoinHashTable&) = delete;
+
+  // Replaces the contents of the table with count rows, hashed by build.
+  // With partitionBits < 0 the number of partitions is picked from the size
+  // of the build side.
+  void Build(TJoinBuildFunction build, TRow* rows, i64 count, int partitionBits = -1);
+
+  TJoinTableHeader* GetHeader()
+  {
+    return &Header;
+  }
+
+  int GetPartitionCount() const
+  {
+    return Partitions.size();
+  }
+
+private:
+  TJoinTableHeader Header;
+  int KeyCount;
+  std::vector<TJoinPartition> Partitions;
+  std::vector<ui64> Entries;
+  std::vector<ui64> Bloom;
+
+  void FreePartitions()
+  {
+    for (auto partition = Partitions.begin(); partition != Partitions.end(); partition++) {
+      free(partition->Slots);
+    }
+    Partitions.clear();
+  }
+};
+
+static int getJoinPartitionBits(i64 count, int keyCount)
+{
+  // Slots at most half full, plus the entry.
+  size_t rowBytes = 2 * sizeof(TJoinSlot) + (keyCount + 1) * sizeof(ui64);
+  int bits = 0;
+  while (bits < MaxJoinPartitionBits && (count * rowBytes >> bits) > JoinPartitionBytes) {
+    bits++;
+  }
+  return bits;
+}
+
+static ui64 getJoinCapacity(i64 count)
+{
+  ui64 capacity = 4;
+  while (capacity < 2 * static_cast<ui64>(count)) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+void TJoinHashTable::Build(TJoinBuildFunction build, TRow* rows, i64 count, int partitionBits)
+{
+  std::vector<ui64> hashes(count);
+  std::vector<ui64> keys(count * KeyCount);
+  build(rows, count, hashes.data(), keys.data());
+
+  if (partitionBits < 0) {
+    partitionBits = getJoinPartitionBits(count, KeyCount);
+  }
+  int partitionCount = 1 << partitionBits;
+  ui64 partitionMask = partitionCount - 1;
+
+  // Radix partitioning: count the rows of each partition, then scatter the
+  // entries so that those of a partition are contiguous.
+  std::vector<i64> offsets(partitionCount + 1, 0);
+  for (i64 i = 0; i < count; i++) {
+    offsets[((hashes[i] >> JoinPartitionShift) & partitionMask) + 1]++;
+  }
+  for (int p = 0; p < partitionCount; p++) {
+    offsets[p + 1] += offsets[p];
+  }
+
+  int entryWords = KeyCount + 1;
+  Entries.assign(count * entryWords, 0);
+  std::vector<ui64> entryHashes(count);
+  std::vector<i64> positions(offsets.begin(), offsets.end() - 1);
+  for (i64 i = 0; i < count; i++) {
+    i64 position = positions[(hashes[i] >> JoinPartitionShift) & partitionMask]++;
+    ui64* entry = &Entries[position * entryWords];
+    memcpy(entry, &keys[i * KeyCount], KeyCount * sizeof(ui64));
+    entry[KeyCount] = reinterpret_cast<ui64>(rows[i]);
+    entryHashes[position] = hashes[i];
+  }
+
+  FreePartitions();
+  for (int p = 0; p < partitionCount; p++) {
+    TJoinPartition partition;
+    ui64 capacity = getJoinCapacity(offsets[p + 1] - offsets[p]);
+    void* slots = NULL;
+    // Fatal, as it is for the std::vector of entries.
+    if (posix_memalign(&slots, CacheLineSize, capacity * sizeof(TJoinSlot)) != 0) {
+      fprintf(stderr, "cannot allocate %llu join slots\n", (unsigned long long)capacity);
+      abort();
+    }
+    memset(slots, 0, capacity * sizeof(TJoinSlot));
+    partition.Slots = static_cast<TJoinSlot*>(slots);
+    partition.Mask = capacity - 1;
+
+    for (i64 position = offsets[p]; position < offsets[p + 1]; position++) {
+      ui64 slot = entryHashes[position] & partition.Mask;
+      while (partition.Slots[slot].Entry) {
+        slot = (slot + 1) & partition.Mask;
+      }
+      partition.Slots[slot].Hash = entryHashes[position];
+      partition.Slots[slot].Entry = &Entries[position * entryWords];
+    }
+    Partitions.push_back(partition);
+  }
+
+  ui64 bloomWords = 1;
+  while (bloomWords * 64 < static_cast<ui64>(count) * JoinBloomBitsPerRow) {
+    bloomWords *= 2;
+  }
+  Bloom.assign(bloomWords, 0);
+  for (i64 i = 0; i < count; i++) {
+    Bloom[(hashes[i] >> JoinBloomShift) & (bloomWords - 1)] |= getJoinBloomBits(hashes[i]);
+  }
+
+  Header.Partitions = Partitions.data();
+  Header.PartitionMask = partitionMask;
+  Header.Bloom = Bloom.data();
+  Header.BloomMask = bloomWords - 1;
+}
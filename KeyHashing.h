@@ -0,0 +1,111 @@
+#pragma once
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/IR/IRBuilder.h"
+#include "TExpressionInterpreter.h"
+using namespace llvm;
+
+// Keys of hash tables are hashed and compared as 64-bit words: integers as
+// they are, booleans as 0 or 1 and doubles as their bits, with -0.0 folded
+// into 0.0 and every NaN into CanonicalNaNWord so that equal keys have equal
+// words. Generated code and C++ compute the same words and hashes, so
+// tables can be filled by one and read by the other.
+
+bool isKeyType(EValueType type)
+{
+  return type == EValueType::Int64
+    || type == EValueType::Uint64
+    || type == EValueType::Double
+    || type == EValueType::Boolean;
+}
+
+// The bits of the positive quiet NaN.
+const ui64 CanonicalNaNWord = 0x7ff8000000000000ULL;
+
+ui64 getKeyWord(const TValue& value, EValueType type)
+{
+  switch (type) {
+    case EValueType::Boolean:
+      return value.Data.Boolean ? 1 : 0;
+    case EValueType::Double:
+      if (value.Data.Double != value.Data.Double) {
+        return CanonicalNaNWord;
+      }
+      return value.Data.Double == 0 ? 0 : value.Data.Uint64;
+    default:
+      return value.Data.Uint64;
+  }
+}
+
+TValue makeKeyValue(ui64 word, EValueType type)
+{
+  TValue value = TExpressionInterpreter::makeValue(type);
+  if (type == EValueType::Boolean) {
+    value.Data.Boolean = word != 0;
+  } else {
+    value.Data.Uint64 = word;
+  }
+  return value;
+}
+
+const ui64 KeyHashSeed = 0x9e3779b97f4a7c15ULL;
+const ui64 KeyHashMultiplier = 0xff51afd7ed558ccdULL;
+const ui64 KeyHashFinalMultiplier = 0xc4ceb9fe1a85ec53ULL;
+
+// Mixes every word in and finishes with the MurmurHash3 finalizer, so that
+// the low bits used to pick buckets depend on all bits of the keys.
+ui64 hashKeyWords(const ui64* words, int count)
+{
+  ui64 hash = KeyHashSeed;
+  for (int i = 0; i < count; i++) {
+    hash = (hash ^ words[i]) * KeyHashMultiplier;
+    hash ^= hash >> 32;
+  }
+  hash ^= hash >> 33;
+  hash *= KeyHashMultiplier;
+  hash ^= hash >> 33;
+  hash *= KeyHashFinalMultiplier;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+/* Code generation */
+
+// value is the LLVM value of a key of the given type, as LLVMCodegen
+// generates it (i1 for booleans).
+Value* emitKeyWord(IRBuilder<>& builder, Value* value, EValueType type)
+{
+  switch (type) {
+    case EValueType::Boolean:
+      return builder.CreateZExt(value, builder.getInt64Ty());
+    case EValueType::Double: {
+      Value* isZero = builder.CreateFCmpOEQ(
+        value,
+        ConstantFP::get(builder.getDoubleTy(), 0.0));
+      Value* word = builder.CreateSelect(
+        isZero,
+        builder.getInt64(0),
+        builder.CreateBitCast(value, builder.getInt64Ty()));
+      return builder.CreateSelect(
+        builder.CreateFCmpUNO(value, value),
+        builder.getInt64(CanonicalNaNWord),
+        word);
+    }
+    default:
+      return value;
+  }
+}
+
+Value* emitHashKeyWords(IRBuilder<>& builder, ArrayRef<Value*> words)
+{
+  Value* hash = builder.getInt64(KeyHashSeed);
+  for (size_t i = 0; i < words.size(); i++) {
+    hash = builder.CreateMul(builder.CreateXor(hash, words[i]), builder.getInt64(KeyHashMultiplier));
+    hash = builder.CreateXor(hash, builder.CreateLShr(hash, 32));
+  }
+  hash = builder.CreateXor(hash, builder.CreateLShr(hash, 33));
+  hash = builder.CreateMul(hash, builder.getInt64(KeyHashMultiplier));
+  hash = builder.CreateXor(hash, builder.CreateLShr(hash, 33));
+  hash = builder.CreateMul(hash, builder.getInt64(KeyHashFinalMultiplier));
+  hash = builder.CreateXor(hash, builder.CreateLShr(hash, 33));
+  return hash;
+}
@@ -1,16 +1,123 @@
+#pragma once
+#include <cstddef>
+#include <set>
+#include <unordered_map>
 #include "llvm/IR/TypeBuilder.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Linker/Linker.h"
 #include "TExpressionTyper.h"
+#include "TExpressionProfile.h"
+#include "Dictionary.h"
+#include "HashAggregation.h"
+#include "HashJoin.h"
+#include "Pipeline.h"
+#include "RowWriter.h"
+#include "Sorting.h"
+#include "ZoneMaps.h"
 using namespace TExpressionTyper;
 
+// Probability of boolean nodes being true, used to weight the branches of
+// short-circuit && and || on them.
+typedef std::unordered_map<TConstExpressionPtr, double> TBranchHints;
+
+// Asks for a row function specialized on a column that usually holds Value:
+// the expression is generated twice, once with the column replaced by the
+// constant, and a check of the column picks between the two.
+struct TSpecialization {
+  int ColumnIndex;
+  TValue Value;
+  // Fraction of rows expected to hold Value, used as branch weight.
+  double Frequency;
+};
+
 // Generates LLVM IR corresponding to given TExpressions
 class LLVMCodegen {
 public:
-  LLVMCodegen() : ExpressionModule(new Module("expr", getGlobalContext())) { }
+  LLVMCodegen()
+    : ExpressionModule(new Module("expr", getGlobalContext()))
+    , Row(NULL)
+    , Profile(NULL)
+    , Counters(NULL)
+    , BranchHints(NULL)
+    , Specialization(NULL)
+    , Substitute(false)
+    , PrefetchDistance(0)
+  { }
+
+  // Makes the row functions emitted afterwards count evaluations of the
+  // nodes instrumented in profile into it. The profile must outlive the
+  // generated code. Instrumented code still short-circuits && and ||: an
+  // operand is only counted on the rows where it is evaluated.
+  void SetProfile(TExpressionProfile* profile)
+  {
+    Profile = profile;
+  }
+
+  // Both must outlive code generation.
+  void SetBranchHints(const TBranchHints* branchHints)
+  {
+    BranchHints = branchHints;
+  }
+
+  void SetSpecialization(const TSpecialization* specialization)
+  {
+    Specialization = specialization;
+  }
+
+  // Makes the batch functions emitted afterwards prefetch the values each
+  // row reads distance rows ahead, for rows scattered across memory. 0, the
+  // default, prefetches nothing.
+  void SetPrefetchDistance(int distance)
+  {
+    PrefetchDistance = distance;
+  }
+
+  // Emits "expr", a function without arguments returning the value of expr.
+  Module* GetExpressionModule(TConstExpressionPtr expr);
+  // Emits "expr", evaluating expr against a row with the same ABI as func
+  // in llvm-experiments, and "expr_batch", which evaluates it against an
+  // array of rows (see TRowFunction and TBatchFunction).
+  Module* GetRowFunctionModule(TConstExpressionPtr expr);
+
+  // The two steps of the methods above, exposed separately so that
+  // callers can tell IR generation and linking apart. Row functions of
+  // several expressions can be emitted into one module under different
+  // names, e.g. "a" and "a_batch", "b" and "b_batch".
+  Function* EmitExpressionFunction(TConstExpressionPtr expr);
+  Function* EmitRowFunction(TConstExpressionPtr expr, const std::string& name = "expr");
+  // Emits a TPipelineFunction evaluating the whole pipeline in one loop.
+  Function* EmitPipelineFunction(const TPipeline& pipeline, const std::string& name = "pipeline");
+  // Emits a TGroupByFunction aggregating rows into a TGroupByHashTable.
+  Function* EmitGroupByFunction(const TGroupBy& groupBy, const std::string& name = "groupby");
+  // Emit a TJoinBuildFunction and a TJoinProbeFunction for join. The probe
+  // function hashes batchSize rows and prefetches their slots before
+  // probing any of them.
+  Function* EmitJoinBuildFunction(const TJoin& join, const std::string& name = "join_build");
+  Function* EmitJoinProbeFunction(
+    const TJoin& join,
+    int batchSize = JoinProbeBatchSize,
+    const std::string& name = "join_probe");
+  // Emit a TRowComparator and a TSortKeyFunction for orderBy.
+  Function* EmitComparatorFunction(const TOrderBy& orderBy, const std::string& name = "order_compare");
+  Function* EmitSortKeyFunction(const TOrderBy& orderBy, const std::string& name = "order_keys");
+  // Emits a TBlockFilterFunction for predicate, which bounds every node of
+  // predicate over a block with interval arithmetic on the statistics of
+  // its columns.
+  Function* EmitBlockFilterFunction(TConstExpressionPtr predicate, const std::string& name = "block_filter");
+  // Emits a TMaterializeFunction writing rows of the values of projections
+  // for the rows where predicate, unless NULL, is true.
+  Function* EmitMaterializeFunction(
+    TConstExpressionPtr predicate,
+    const std::vector<TConstExpressionPtr>& projections,
+    const std::string& name = "materialize");
+  // Emits a TCodeFilterFunction for predicate, which has its code or bitmap
+  // built in.
+  Function* EmitCodeFilterFunction(const TCodePredicate& predicate, const std::string& name = "code_filter");
+  Module* LinkFunctions();
 
-  Module* GetExpressionModule(std::shared_ptr<TExpression> expr);
   static Type* getLLVMType(EValueType type);
   static FunctionType* getLLVMType(const FunctionSignature* signature);
   static FunctionType* getLLVMType(EValueType resultType, std::vector<EValueType> argTypes);
@@ -18,17 +125,91 @@ public:
 private:
   Module* ExpressionModule;
   std::vector<const FunctionSignature*> FunctionsToEmit;
+  // Row argument of the function being generated, if it has one.
+  Value* Row;
+  TExpressionProfile* Profile;
+  // Counters the function being generated updates, if it is instrumented.
+  Value* Counters;
+  const TBranchHints* BranchHints;
+  const TSpecialization* Specialization;
+  // Whether references to the specialized column are being replaced.
+  bool Substitute;
+  int PrefetchDistance;
+
+  Value* Generate(TConstExpressionPtr expr, IRBuilder<>& builder);
+  Value* GenerateNode(TConstExpressionPtr expr, IRBuilder<>& builder);
+  Value* GenerateLiteral(IRBuilder<>& builder, const TValue& value, EValueType type);
+  Value* GenerateShortCircuit(const TBinaryOpExpression* expr, IRBuilder<>& builder);
+  Value* GenerateSpecialized(TConstExpressionPtr expr, IRBuilder<>& builder);
+  // Key words (see KeyHashing.h) of keys for the current row.
+  std::vector<Value*> GenerateKeyWords(
+    const std::vector<TConstExpressionPtr>& keys,
+    IRBuilder<>& builder);
+  void EmitPrefetch(IRBuilder<>& builder, Value* address);
 
-  Value* Generate(std::shared_ptr<TExpression> expr, IRBuilder<> builder);
+  // What is known of the values of an expression over the rows of a block.
+  struct TValueRange {
+    // Numeric expressions: all values are in [Min, Max] if Known.
+    Value* Known;
+    Value* Min;
+    Value* Max;
+    // Boolean expressions.
+    Value* MayBeTrue;
+    Value* MayBeFalse;
+  };
+  // Allocates size bytes, a multiple of TRowWriter::Alignment, from the
+  // writer with the given header, bumping its pointer inline and calling
+  // rowWriterRefill only when the chunk is full.
+  Value* EmitRowWriterAllocate(IRBuilder<>& builder, Value* writer, ui64 size);
+  // Appends row to the rows of the writer.
+  void EmitRowWriterAppend(IRBuilder<>& builder, Value* writer, Value* row);
+  // Returns whether codes, a 32-bit integer or a vector of them, match
+  // predicate, whose bitmap, if it spans several words, is at bitmap.
+  Value* GenerateCodeMatch(
+    const TCodePredicate& predicate,
+    Value* codes,
+    Value* bitmap,
+    IRBuilder<>& builder);
+  TValueRange GenerateRange(TConstExpressionPtr expr, Value* statistics, IRBuilder<>& builder);
+  TValueRange GenerateArithmeticRange(
+    EBinaryOp opcode,
+    EValueType type,
+    const TValueRange& lhs,
+    const TValueRange& rhs,
+    IRBuilder<>& builder);
+  MDNode* GetBranchWeights(double probability);
+  void EmitCounterUpdate(IRBuilder<>& builder, int id, EValueType type, Value* result);
+  Value* GetProfileCounters(IRBuilder<>& builder);
   Value* GetLLVMFunction(const FunctionSignature* signature, Module* module);
+  void EmitBatchFunction(
+    Function* rowFunction,
+    const std::set<int>& columns,
+    const std::string& name);
+
+  static Value* GetRowValues(IRBuilder<>& builder, Value* row);
+  static Value* LoadValueData(IRBuilder<>& builder, Value* values, int index, EValueType type);
+  static void StoreValueData(IRBuilder<>& builder, Value* data, Value* values, int index, EValueType type);
+  static void StoreValueHeader(IRBuilder<>& builder, Value* values, int index, int id, EValueType type);
 };
 
 
-Module* LLVMCodegen::GetExpressionModule(std::shared_ptr<TExpression> expr)
+Module* LLVMCodegen::GetExpressionModule(TConstExpressionPtr expr)
+{
+  EmitExpressionFunction(expr);
+  return LinkFunctions();
+}
+
+Module* LLVMCodegen::GetRowFunctionModule(TConstExpressionPtr expr)
+{
+  EmitRowFunction(expr);
+  return LinkFunctions();
+}
+
+Function* LLVMCodegen::EmitExpressionFunction(TConstExpressionPtr expr)
 {
   LLVMContext& context = getGlobalContext();
   IRBuilder<> builder(context);
-  FunctionType* funTp = getLLVMType(typeOf(expr.get()), std::vector<EValueType>());
+  FunctionType* funTp = getLLVMType(typeOf(expr), std::vector<EValueType>());
   Function* exprFun = Function::Create(
     funTp,
     Function::ExternalLinkage,
@@ -41,13 +222,1055 @@ Module* LLVMCodegen::GetExpressionModule(std::shared_ptr<TExpression> expr)
 
   verifyFunction(*exprFun);
 
+  return exprFun;
+}
+
+Function* LLVMCodegen::EmitRowFunction(
+  TConstExpressionPtr expr,
+  const std::string& name)
+{
+  LLVMContext& context = getGlobalContext();
+  IRBuilder<> builder(context);
+  FunctionType* funTp = TypeBuilder<void(TRow, TValue*), true>::get(context);
+
+  // With a profile, the expression is evaluated by
+  // expr_body(row, result, counters), which updates the counters it is
+  // given, and expr passes it the counters of the profile.
+  Function* bodyFun = NULL;
+  if (Profile) {
+    std::vector<Type*> bodyArgTypes(funTp->param_begin(), funTp->param_end());
+    bodyArgTypes.push_back(builder.getInt64Ty()->getPointerTo());
+    bodyFun = Function::Create(
+      FunctionType::get(builder.getVoidTy(), bodyArgTypes, false),
+      Function::InternalLinkage,
+      name + "_body",
+      ExpressionModule);
+  }
+
+  Function* exprFun = Function::Create(
+    funTp,
+    Function::ExternalLinkage,
+    name,
+    ExpressionModule);
+  Function* evaluateFun = bodyFun ? bodyFun : exprFun;
+
+  Function::arg_iterator args = evaluateFun->arg_begin();
+  Argument* rowArg = args;
+  rowArg->setName("row");
+  args++;
+  Argument* resultArg = args;
+  resultArg->setName("result");
+  args++;
+  if (bodyFun) {
+    Counters = args;
+    Counters->setName("counters");
+  }
+
+  BasicBlock* body = BasicBlock::Create(context, "entry", evaluateFun);
+  builder.SetInsertPoint(body);
+
+  Row = rowArg;
+  Value* result = Specialization
+    ? GenerateSpecialized(expr, builder)
+    : Generate(expr, builder);
+  Row = NULL;
+  Counters = NULL;
+
+  // result->Data = <expr>
+  StoreValueData(builder, result, resultArg, 0, typeOf(expr));
+  builder.CreateRetVoid();
+
+  verifyFunction(*evaluateFun);
+
+  if (bodyFun) {
+    // expr(row, result) = expr_body(row, result, <profile counters>)
+    builder.SetInsertPoint(BasicBlock::Create(context, "entry", exprFun));
+    Function::arg_iterator exprArgs = exprFun->arg_begin();
+    Argument* exprRowArg = exprArgs;
+    exprArgs++;
+    Argument* exprResultArg = exprArgs;
+    builder.CreateCall3(bodyFun, exprRowArg, exprResultArg, GetProfileCounters(builder));
+    builder.CreateRetVoid();
+
+    verifyFunction(*exprFun);
+  }
+
+  std::set<int> columns;
+  collectReferencedColumns(expr, &columns);
+  if (Specialization) {
+    columns.insert(Specialization->ColumnIndex);
+  }
+  EmitBatchFunction(evaluateFun, columns, name + "_batch");
+
+  return exprFun;
+}
+
+// columns are those the row function reads, for prefetching.
+void LLVMCodegen::EmitBatchFunction(
+  Function* rowFunction,
+  const std::set<int>& columns,
+  const std::string& name)
+{
+  LLVMContext& context = getGlobalContext();
+  IRBuilder<> builder(context);
+  FunctionType* funTp =
+    TypeBuilder<void(TRow*, TValue*, types::i<64>), true>::get(context);
+  Function* batchFun = Function::Create(
+    funTp,
+    Function::ExternalLinkage,
+    name,
+    ExpressionModule);
+
+  Function::arg_iterator args = batchFun->arg_begin();
+  Argument* rowsArg = args;
+  rowsArg->setName("rows");
+  args++;
+  Argument* resultsArg = args;
+  resultsArg->setName("results");
+  args++;
+  Argument* countArg = args;
+  countArg->setName("count");
+
+  BasicBlock* entry = BasicBlock::Create(context, "entry", batchFun);
+  BasicBlock* loop = BasicBlock::Create(context, "loop", batchFun);
+  BasicBlock* exit = BasicBlock::Create(context, "exit", batchFun);
+
+  builder.SetInsertPoint(entry);
+  // The batch counts into zeroed locals, which the optimizer keeps in
+  // registers, and adds them to the profile once at the end.
+  Value* localCounters = NULL;
+  if (Profile) {
+    int slotCount = 2 * Profile->GetNodeCount();
+    localCounters = builder.CreateAlloca(
+      builder.getInt64Ty(),
+      builder.getInt32(slotCount),
+      "counters");
+    builder.CreateMemSet(
+      localCounters,
+      builder.getInt8(0),
+      slotCount * sizeof(ui64),
+      sizeof(ui64));
+  }
+  builder.CreateCondBr(
+    builder.CreateICmpSGT(countArg, builder.getInt64(0)),
+    loop,
+    exit);
+
+  // for (i64 i = 0; i < count; i++) expr(rows[i], &results[i])
+  builder.SetInsertPoint(loop);
+  PHINode* index = builder.CreatePHI(builder.getInt64Ty(), 2, "i");
+  index->addIncoming(builder.getInt64(0), entry);
+  Value* row = builder.CreateLoad(builder.CreateInBoundsGEP(rowsArg, index), "row");
+  Value* result = builder.CreateInBoundsGEP(resultsArg, index, "result");
+  if (PrefetchDistance > 0 && !columns.empty()) {
+    // Prefetch the data of the columns of rows[min(i + distance, count - 1)],
+    // so that it has arrived by the time that row is evaluated. Near the end
+    // the last row is prefetched again rather than branching.
+    Value* ahead = builder.CreateAdd(index, builder.getInt64(PrefetchDistance));
+    ahead = builder.CreateSelect(
+      builder.CreateICmpSLT(ahead, countArg),
+      ahead,
+      builder.CreateSub(countArg, builder.getInt64(1)));
+    Value* aheadValues = GetRowValues(
+      builder,
+      builder.CreateLoad(builder.CreateInBoundsGEP(rowsArg, ahead), "aheadRow"));
+    for (auto column = columns.begin(); column != columns.end(); column++) {
+      EmitPrefetch(builder, builder.CreateConstInBoundsGEP2_32(aheadValues, *column, 3));
+    }
+  }
+  if (localCounters) {
+    builder.CreateCall3(rowFunction, row, result, localCounters);
+  } else {
+    builder.CreateCall2(rowFunction, row, result);
+  }
+  Value* next = builder.CreateAdd(index, builder.getInt64(1), "next");
+  index->addIncoming(next, loop);
+  builder.CreateCondBr(builder.CreateICmpSLT(next, countArg), loop, exit);
+
+  builder.SetInsertPoint(exit);
+  if (localCounters) {
+    Value* profileCounters = GetProfileCounters(builder);
+    for (int id = 0; id < Profile->GetNodeCount(); id++) {
+      if (!Profile->IsInstrumented(id)) {
+        continue;
+      }
+      for (int slot = 2 * id; slot < 2 * id + 2; slot++) {
+        Value* localPtr = builder.CreateConstInBoundsGEP1_32(localCounters, slot);
+        Value* profilePtr = builder.CreateConstInBoundsGEP1_32(profileCounters, slot);
+        builder.CreateStore(
+          builder.CreateAdd(builder.CreateLoad(profilePtr), builder.CreateLoad(localPtr)),
+          profilePtr);
+      }
+    }
+  }
+  builder.CreateRetVoid();
+
+  verifyFunction(*batchFun);
+}
+
+Function* LLVMCodegen::EmitPipelineFunction(
+  const TPipeline& pipeline,
+  const std::string& name)
+{
+  LLVMContext& context = getGlobalContext();
+  IRBuilder<> builder(context);
+  FunctionType* funTp = TypeBuilder<
+    types::i<64>(TRow*, types::i<64>, TValue*, types::i<64>*),
+    true>::get(context);
+  Function* pipelineFun = Function::Create(
+    funTp,
+    Function::ExternalLinkage,
+    name,
+    ExpressionModule);
+
+  Function::arg_iterator args = pipelineFun->arg_begin();
+  Argument* rowsArg = args;
+  rowsArg->setName("rows");
+  args++;
+  Argument* countArg = args;
+  countArg->setName("count");
+  args++;
+  Argument* outputArg = args;
+  outputArg->setName("output");
+  args++;
+  Argument* statesArg = args;
+  statesArg->setName("aggregateStates");
+
+  BasicBlock* entry = BasicBlock::Create(context, "entry", pipelineFun);
+  BasicBlock* loop = BasicBlock::Create(context, "loop", pipelineFun);
+  BasicBlock* consume = BasicBlock::Create(context, "consume", pipelineFun);
+  BasicBlock* next = BasicBlock::Create(context, "next", pipelineFun);
+  BasicBlock* exit = BasicBlock::Create(context, "exit", pipelineFun);
+
+  // Aggregate states and the output count live in locals for the whole
+  // loop, which the optimizer keeps in registers.
+  builder.SetInsertPoint(entry);
+  int slotCount = getAggregateStateSlots(pipeline.Aggregates);
+  Value* localStates = NULL;
+  if (slotCount) {
+    localStates = builder.CreateAlloca(
+      builder.getInt64Ty(),
+      builder.getInt32(slotCount),
+      "states");
+    builder.CreateMemCpy(localStates, statesArg, slotCount * sizeof(ui64), sizeof(ui64));
+  }
+  Value* outputCount = builder.CreateAlloca(builder.getInt64Ty(), NULL, "outputCount");
+  builder.CreateStore(builder.getInt64(0), outputCount);
+  builder.CreateCondBr(
+    builder.CreateICmpSGT(countArg, builder.getInt64(0)),
+    loop,
+    exit);
+
+  // Produce: for (i64 i = 0; i < count; i++) if (<predicate>(rows[i])) ...
+  builder.SetInsertPoint(loop);
+  PHINode* index = builder.CreatePHI(builder.getInt64Ty(), 2, "i");
+  index->addIncoming(builder.getInt64(0), entry);
+  Row = builder.CreateLoad(builder.CreateInBoundsGEP(rowsArg, index), "row");
+  if (pipeline.Predicate) {
+    builder.CreateCondBr(Generate(pipeline.Predicate, builder), consume, next);
+  } else {
+    builder.CreateBr(consume);
+  }
+
+  // Consume: project into output[k] and update the aggregates.
+  builder.SetInsertPoint(consume);
+  Value* k = builder.CreateLoad(outputCount, "k");
+  int projectionCount = pipeline.Projections.size();
+  if (projectionCount) {
+    Value* outputRow = builder.CreateInBoundsGEP(
+      outputArg,
+      builder.CreateMul(k, builder.getInt64(projectionCount)),
+      "outputRow");
+    for (int j = 0; j < projectionCount; j++) {
+      TConstExpressionPtr projection = pipeline.Projections[j];
+      Value* value = Generate(projection, builder);
+      StoreValueHeader(builder, outputRow, j, j, typeOf(projection));
+      StoreValueData(builder, value, outputRow, j, typeOf(projection));
+    }
+  }
+  builder.CreateStore(builder.CreateAdd(k, builder.getInt64(1)), outputCount);
+
+  int slot = 0;
+  for (auto aggregate = pipeline.Aggregates.begin();
+       aggregate != pipeline.Aggregates.end();
+       aggregate++) {
+    Value* argument = aggregate->Argument
+      ? Generate(aggregate->Argument, builder)
+      : NULL;
+    emitAggregateUpdate(
+      builder,
+      *aggregate,
+      builder.CreateConstInBoundsGEP1_32(localStates, slot),
+      argument);
+    slot += getAggregateStateSlots(*aggregate);
+  }
+  builder.CreateBr(next);
+  Row = NULL;
+
+  builder.SetInsertPoint(next);
+  Value* nextIndex = builder.CreateAdd(index, builder.getInt64(1), "nextIndex");
+  index->addIncoming(nextIndex, next);
+  builder.CreateCondBr(builder.CreateICmpSLT(nextIndex, countArg), loop, exit);
+
+  builder.SetInsertPoint(exit);
+  if (localStates) {
+    builder.CreateMemCpy(statesArg, localStates, slotCount * sizeof(ui64), sizeof(ui64));
+  }
+  builder.CreateRet(builder.CreateLoad(outputCount));
+
+  verifyFunction(*pipelineFun);
+
+  return pipelineFun;
+}
+
+Function* LLVMCodegen::EmitGroupByFunction(
+  const TGroupBy& groupBy,
+  const std::string& name)
+{
+  LLVMContext& context = getGlobalContext();
+  IRBuilder<> builder(context);
+  // The table header is passed as i64*: slots, mask, table (see
+  // TGroupByTableHeader).
+  FunctionType* funTp = TypeBuilder<
+    void(TRow*, types::i<64>, types::i<64>*),
+    true>::get(context);
+  Function* groupByFun = Function::Create(
+    funTp,
+    Function::ExternalLinkage,
+    name,
+    ExpressionModule);
+
+  Function::arg_iterator args = groupByFun->arg_begin();
+  Argument* rowsArg = args;
+  rowsArg->setName("rows");
+  args++;
+  Argument* countArg = args;
+  countArg->setName("count");
+  args++;
+  Argument* tableArg = args;
+  tableArg->setName("table");
+
+  BasicBlock* entry = BasicBlock::Create(context, "entry", groupByFun);
+  BasicBlock* loop = BasicBlock::Create(context, "loop", groupByFun);
+  BasicBlock* probe = BasicBlock::Create(context, "probe", groupByFun);
+  BasicBlock* checkHash = BasicBlock::Create(context, "checkHash", groupByFun);
+  BasicBlock* checkKeys = BasicBlock::Create(context, "checkKeys", groupByFun);
+  BasicBlock* probeNext = BasicBlock::Create(context, "probeNext", groupByFun);
+  BasicBlock* insert = BasicBlock::Create(context, "insert", groupByFun);
+  BasicBlock* update = BasicBlock::Create(context, "update", groupByFun);
+  BasicBlock* exit = BasicBlock::Create(context, "exit", groupByFun);
+
+  int keyCount = groupBy.Keys.size();
+  Type* entryType = builder.getInt64Ty()->getPointerTo();
+
+  builder.SetInsertPoint(entry);
+  Value* keysBuffer = builder.CreateAlloca(
+    builder.getInt64Ty(),
+    builder.getInt32(keyCount),
+    "keys");
+  builder.CreateCondBr(
+    builder.CreateICmpSGT(countArg, builder.getInt64(0)),
+    loop,
+    exit);
+
+  // Compute the key words and their hash in registers.
+  builder.SetInsertPoint(loop);
+  PHINode* index = builder.CreatePHI(builder.getInt64Ty(), 2, "i");
+  index->addIncoming(builder.getInt64(0), entry);
+  Row = builder.CreateLoad(builder.CreateInBoundsGEP(rowsArg, index), "row");
+  std::vector<Value*> words = GenerateKeyWords(groupBy.Keys, builder);
+  Value* hash = emitHashKeyWords(builder, words);
+  // Slots move when the table grows, so they are reloaded for every row.
+  Value* slots = builder.CreateIntToPtr(
+    builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(tableArg, 0)),
+    entryType,
+    "slots");
+  Value* mask = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(tableArg, 1), "mask");
+  Value* start = builder.CreateAnd(hash, mask);
+  BasicBlock* keysComputed = builder.GetInsertBlock();
+  builder.CreateBr(probe);
+
+  // Linear probing: a free slot means a new group.
+  builder.SetInsertPoint(probe);
+  PHINode* slotIndex = builder.CreatePHI(builder.getInt64Ty(), 2, "slot");
+  slotIndex->addIncoming(start, keysComputed);
+  Value* slotPtr = builder.CreateInBoundsGEP(
+    slots,
+    builder.CreateShl(slotIndex, 1),
+    "slotPtr");
+  Value* entryWord = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(slotPtr, 1));
+  builder.CreateCondBr(
+    builder.CreateICmpEQ(entryWord, builder.getInt64(0)),
+    insert,
+    checkHash,
+    GetBranchWeights(0.1));
+
+  builder.SetInsertPoint(checkHash);
+  Value* slotHash = builder.CreateLoad(slotPtr, "slotHash");
+  builder.CreateCondBr(
+    builder.CreateICmpEQ(slotHash, hash),
+    checkKeys,
+    probeNext,
+    GetBranchWeights(0.9));
+
+  builder.SetInsertPoint(checkKeys);
+  Value* foundEntry = builder.CreateIntToPtr(entryWord, entryType, "found");
+  Value* equal = builder.getTrue();
+  for (int j = 0; j < keyCount; j++) {
+    Value* stored = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(foundEntry, j));
+    equal = builder.CreateAnd(equal, builder.CreateICmpEQ(stored, words[j]));
+  }
+  builder.CreateCondBr(equal, update, probeNext, GetBranchWeights(0.9));
+
+  builder.SetInsertPoint(probeNext);
+  Value* nextSlot = builder.CreateAnd(builder.CreateAdd(slotIndex, builder.getInt64(1)), mask);
+  slotIndex->addIncoming(nextSlot, probeNext);
+  builder.CreateBr(probe);
+
+  // New groups are allocated and initialized by the table, which may grow.
+  builder.SetInsertPoint(insert);
+  for (int j = 0; j < keyCount; j++) {
+    builder.CreateStore(words[j], builder.CreateConstInBoundsGEP1_32(keysBuffer, j));
+  }
+  Type* insertArgs[] = {
+    entryType,
+    builder.getInt64Ty(),
+    entryType,
+    builder.getInt64Ty()
+  };
+  FunctionType* insertType = FunctionType::get(entryType, insertArgs, false);
+  Value* insertFun = builder.CreateIntToPtr(
+    builder.getInt64(reinterpret_cast<ui64>(&groupByInsert)),
+    insertType->getPointerTo());
+  Value* insertCallArgs[] = {tableArg, hash, keysBuffer, slotIndex};
+  Value* newEntry = builder.CreateCall(insertFun, insertCallArgs, "newEntry");
+  builder.CreateBr(update);
+
+  builder.SetInsertPoint(update);
+  PHINode* groupEntry = builder.CreatePHI(entryType, 2, "entry");
+  groupEntry->addIncoming(foundEntry, checkKeys);
+  groupEntry->addIncoming(newEntry, insert);
+  Value* states = builder.CreateConstInBoundsGEP1_32(groupEntry, keyCount, "states");
+  int slot = 0;
+  for (auto aggregate = groupBy.Aggregates.begin();
+       aggregate != groupBy.Aggregates.end();
+       aggregate++) {
+    Value* argument = aggregate->Argument
+      ? Generate(aggregate->Argument, builder)
+      : NULL;
+    emitAggregateUpdate(
+      builder,
+      *aggregate,
+      builder.CreateConstInBoundsGEP1_32(states, slot),
+      argument);
+    slot += getAggregateStateSlots(*aggregate);
+  }
+  Row = NULL;
+  Value* nextIndex = builder.CreateAdd(index, builder.getInt64(1), "nextIndex");
+  index->addIncoming(nextIndex, builder.GetInsertBlock());
+  builder.CreateCondBr(builder.CreateICmpSLT(nextIndex, countArg), loop, exit);
+
+  builder.SetInsertPoint(exit);
+  builder.CreateRetVoid();
+
+  verifyFunction(*groupByFun);
+
+  return groupByFun;
+}
+
+Function* LLVMCodegen::EmitJoinBuildFunction(
+  const TJoin& join,
+  const std::string& name)
+{
+  LLVMContext& context = getGlobalContext();
+  IRBuilder<> builder(context);
+  FunctionType* funTp = TypeBuilder<
+    void(TRow*, types::i<64>, types::i<64>*, types::i<64>*),
+    true>::get(context);
+  Function* buildFun = Function::Create(
+    funTp,
+    Function::ExternalLinkage,
+    name,
+    ExpressionModule);
+
+  Function::arg_iterator args = buildFun->arg_begin();
+  Argument* rowsArg = args;
+  rowsArg->setName("rows");
+  args++;
+  Argument* countArg = args;
+  countArg->setName("count");
+  args++;
+  Argument* hashesArg = args;
+  hashesArg->setName("hashes");
+  args++;
+  Argument* keysArg = args;
+  keysArg->setName("keys");
+
+  BasicBlock* entry = BasicBlock::Create(context, "entry", buildFun);
+  BasicBlock* loop = BasicBlock::Create(context, "loop", buildFun);
+  BasicBlock* exit = BasicBlock::Create(context, "exit", buildFun);
+
+  int keyCount = join.BuildKeys.size();
+
+  builder.SetInsertPoint(entry);
+  builder.CreateCondBr(
+    builder.CreateICmpSGT(countArg, builder.getInt64(0)),
+    loop,
+    exit);
+
+  builder.SetInsertPoint(loop);
+  PHINode* index = builder.CreatePHI(builder.getInt64Ty(), 2, "i");
+  index->addIncoming(builder.getInt64(0), entry);
+  Row = builder.CreateLoad(builder.CreateInBoundsGEP(rowsArg, index), "row");
+  std::vector<Value*> words = GenerateKeyWords(join.BuildKeys, builder);
+  builder.CreateStore(
+    emitHashKeyWords(builder, words),
+    builder.CreateInBoundsGEP(hashesArg, index));
+  Value* rowKeys = builder.CreateInBoundsGEP(
+    keysArg,
+    builder.CreateMul(index, builder.getInt64(keyCount)));
+  for (int j = 0; j < keyCount; j++) {
+    builder.CreateStore(words[j], builder.CreateConstInBoundsGEP1_32(rowKeys, j));
+  }
+  Row = NULL;
+  Value* nextIndex = builder.CreateAdd(index, builder.getInt64(1), "nextIndex");
+  index->addIncoming(nextIndex, builder.GetInsertBlock());
+  builder.CreateCondBr(builder.CreateICmpSLT(nextIndex, countArg), loop, exit);
+
+  builder.SetInsertPoint(exit);
+  builder.CreateRetVoid();
+
+  verifyFunction(*buildFun);
+
+  return buildFun;
+}
+
+Function* LLVMCodegen::EmitJoinProbeFunction(
+  const TJoin& join,
+  int batchSize,
+  const std::string& name)
+{
+  LLVMContext& context = getGlobalContext();
+  IRBuilder<> builder(context);
+  // The table header and the output are passed as i64* (see
+  // TJoinTableHeader and TJoinOutput).
+  FunctionType* funTp = TypeBuilder<
+    void(TRow*, types::i<64>, types::i<64>*, types::i<64>*),
+    true>::get(context);
+  Function* probeFun = Function::Create(
+    funTp,
+    Function::ExternalLinkage,
+    name,
+    ExpressionModule);
+
+  Function::arg_iterator args = probeFun->arg_begin();
+  Argument* rowsArg = args;
+  rowsArg->setName("rows");
+  args++;
+  Argument* countArg = args;
+  countArg->setName("count");
+  args++;
+  Argument* tableArg = args;
+  tableArg->setName("table");
+  args++;
+  Argument* outputArg = args;
+  outputArg->setName("output");
+
+  BasicBlock* entry = BasicBlock::Create(context, "entry", probeFun);
+  BasicBlock* batch = BasicBlock::Create(context, "batch", probeFun);
+  BasicBlock* hashRow = BasicBlock::Create(context, "hashRow", probeFun);
+  BasicBlock* probeStart = BasicBlock::Create(context, "probeStart", probeFun);
+  BasicBlock* probeRow = BasicBlock::Create(context, "probeRow", probeFun);
+  BasicBlock* probe = BasicBlock::Create(context, "probe", probeFun);
+  BasicBlock* checkHash = BasicBlock::Create(context, "checkHash", probeFun);
+  BasicBlock* checkKeys = BasicBlock::Create(context, "checkKeys", probeFun);
+  BasicBlock* emit = BasicBlock::Create(context, "emit", probeFun);
+  BasicBlock* grow = BasicBlock::Create(context, "grow", probeFun);
+  BasicBlock* append = BasicBlock::Create(context, "append", probeFun);
+  BasicBlock* probeNext = BasicBlock::Create(context, "probeNext", probeFun);
+  BasicBlock* probeRowNext = BasicBlock::Create(context, "probeRowNext", probeFun);
+  BasicBlock* batchNext = BasicBlock::Create(context, "batchNext", probeFun);
+  BasicBlock* exit = BasicBlock::Create(context, "exit", probeFun);
+
+  int keyCount = join.ProbeKeys.size();
+  Type* wordPtrType = builder.getInt64Ty()->getPointerTo();
+
+  // Returns the first slot of hash, setting slots and mask to those of its
+  // partition.
+  auto getStartSlot = [&] (
+    Value* partitions,
+    Value* partitionMask,
+    Value* hash,
+    Value** slots,
+    Value** mask)
+  {
+    Value* partitionIndex = builder.CreateAnd(
+      builder.CreateLShr(hash, JoinPartitionShift),
+      partitionMask);
+    Value* partition = builder.CreateInBoundsGEP(
+      partitions,
+      builder.CreateShl(partitionIndex, 1));
+    *slots = builder.CreateIntToPtr(
+      builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(partition, 0)),
+      wordPtrType,
+      "slots");
+    *mask = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(partition, 1), "mask");
+    return builder.CreateAnd(hash, *mask);
+  };
+
+  builder.SetInsertPoint(entry);
+  Value* hashesBuffer = builder.CreateAlloca(
+    builder.getInt64Ty(),
+    builder.getInt32(batchSize),
+    "hashes");
+  Value* keysBuffer = builder.CreateAlloca(
+    builder.getInt64Ty(),
+    builder.getInt32(batchSize * keyCount),
+    "keys");
+  Value* candidatesBuffer = builder.CreateAlloca(
+    builder.getInt64Ty(),
+    builder.getInt32(batchSize),
+    "candidates");
+  Value* partitions = builder.CreateIntToPtr(
+    builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(tableArg, 0)),
+    wordPtrType,
+    "partitions");
+  Value* partitionMask = builder.CreateLoad(
+    builder.CreateConstInBoundsGEP1_32(tableArg, 1),
+    "partitionMask");
+  Value* bloom = builder.CreateIntToPtr(
+    builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(tableArg, 2)),
+    wordPtrType,
+    "bloom");
+  Value* bloomMask = builder.CreateLoad(
+    builder.CreateConstInBoundsGEP1_32(tableArg, 3),
+    "bloomMask");
+  builder.CreateCondBr(
+    builder.CreateICmpSGT(countArg, builder.getInt64(0)),
+    batch,
+    exit);
+
+  // for (start = 0; start < count; start += batchSize)
+  builder.SetInsertPoint(batch);
+  PHINode* start = builder.CreatePHI(builder.getInt64Ty(), 2, "start");
+  start->addIncoming(builder.getInt64(0), entry);
+  Value* batchEnd = builder.CreateAdd(start, builder.getInt64(batchSize));
+  Value* end = builder.CreateSelect(
+    builder.CreateICmpSLT(batchEnd, countArg),
+    batchEnd,
+    countArg,
+    "end");
+  builder.CreateBr(hashRow);
+
+  // First pass: hash the rows of the batch, drop those the bloom filter
+  // rules out and prefetch the first slot of the others, so that the cache
+  // misses of the batch overlap instead of stalling one row at a time.
+  builder.SetInsertPoint(hashRow);
+  PHINode* index = builder.CreatePHI(builder.getInt64Ty(), 2, "i");
+  index->addIncoming(start, batch);
+  PHINode* candidateCount = builder.CreatePHI(builder.getInt64Ty(), 2, "candidateCount");
+  candidateCount->addIncoming(builder.getInt64(0), batch);
+  Row = builder.CreateLoad(builder.CreateInBoundsGEP(rowsArg, index), "row");
+  std::vector<Value*> words = GenerateKeyWords(join.ProbeKeys, builder);
+  Value* hash = emitHashKeyWords(builder, words);
+  Row = NULL;
+
+  // Written at the next candidate position, which is only taken if the
+  // row passes.
+  builder.CreateStore(index, builder.CreateInBoundsGEP(candidatesBuffer, candidateCount));
+  builder.CreateStore(hash, builder.CreateInBoundsGEP(hashesBuffer, candidateCount));
+  Value* candidateKeys = builder.CreateInBoundsGEP(
+    keysBuffer,
+    builder.CreateMul(candidateCount, builder.getInt64(keyCount)));
+  for (int j = 0; j < keyCount; j++) {
+    builder.CreateStore(words[j], builder.CreateConstInBoundsGEP1_32(candidateKeys, j));
+  }
+
+  Value* bloomWordPtr = builder.CreateInBoundsGEP(
+    bloom,
+    builder.CreateAnd(builder.CreateLShr(hash, JoinBloomShift), bloomMask));
+  Value* bloomBits = builder.CreateOr(
+    builder.CreateShl(builder.getInt64(1), builder.CreateAnd(hash, builder.getInt64(63))),
+    builder.CreateShl(
+      builder.getInt64(1),
+      builder.CreateAnd(builder.CreateLShr(hash, 6), builder.getInt64(63))));
+  Value* passes = builder.CreateICmpEQ(
+    builder.CreateAnd(builder.CreateLoad(bloomWordPtr), bloomBits),
+    bloomBits,
+    "passes");
+
+  Value* slots;
+  Value* mask;
+  Value* firstSlot = getStartSlot(partitions, partitionMask, hash, &slots, &mask);
+  Value* firstSlotPtr = builder.CreateInBoundsGEP(slots, builder.CreateShl(firstSlot, 1));
+  // Rows that do not pass prefetch the bloom word, which is already cached.
+  EmitPrefetch(
+    builder,
+    builder.CreateSelect(passes, firstSlotPtr, bloomWordPtr));
+
+  Value* nextCandidateCount = builder.CreateAdd(
+    candidateCount,
+    builder.CreateZExt(passes, builder.getInt64Ty()),
+    "nextCandidateCount");
+  Value* nextIndex = builder.CreateAdd(index, builder.getInt64(1), "nextIndex");
+  BasicBlock* hashRowEnd = builder.GetInsertBlock();
+  index->addIncoming(nextIndex, hashRowEnd);
+  candidateCount->addIncoming(nextCandidateCount, hashRowEnd);
+  builder.CreateCondBr(builder.CreateICmpSLT(nextIndex, end), hashRow, probeStart);
+
+  builder.SetInsertPoint(probeStart);
+  builder.CreateCondBr(
+    builder.CreateICmpSGT(nextCandidateCount, builder.getInt64(0)),
+    probeRow,
+    batchNext);
+
+  // Second pass: probe the candidates, emitting a match for every build row
+  // with equal keys.
+  builder.SetInsertPoint(probeRow);
+  PHINode* candidate = builder.CreatePHI(builder.getInt64Ty(), 2, "candidate");
+  candidate->addIncoming(builder.getInt64(0), probeStart);
+  Value* probeHash = builder.CreateLoad(
+    builder.CreateInBoundsGEP(hashesBuffer, candidate),
+    "hash");
+  Value* probeRowIndex = builder.CreateLoad(builder.CreateInBoundsGEP(candidatesBuffer, candidate));
+  Value* probeRowPtr = builder.CreateLoad(
+    builder.CreateInBoundsGEP(rowsArg, probeRowIndex),
+    "probeRow");
+  Value* probeKeys = builder.CreateInBoundsGEP(
+    keysBuffer,
+    builder.CreateMul(candidate, builder.getInt64(keyCount)));
+  std::vector<Value*> probeWords;
+  for (int j = 0; j < keyCount; j++) {
+    probeWords.push_back(builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(probeKeys, j)));
+  }
+  Value* probeSlots;
+  Value* probeMask;
+  Value* probeFirstSlot = getStartSlot(partitions, partitionMask, probeHash, &probeSlots, &probeMask);
+  builder.CreateBr(probe);
+
+  builder.SetInsertPoint(probe);
+  PHINode* slotIndex = builder.CreatePHI(builder.getInt64Ty(), 2, "slot");
+  slotIndex->addIncoming(probeFirstSlot, probeRow);
+  Value* slotPtr = builder.CreateInBoundsGEP(
+    probeSlots,
+    builder.CreateShl(slotIndex, 1),
+    "slotPtr");
+  Value* entryWord = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(slotPtr, 1));
+  builder.CreateCondBr(
+    builder.CreateICmpEQ(entryWord, builder.getInt64(0)),
+    probeRowNext,
+    checkHash);
+
+  builder.SetInsertPoint(checkHash);
+  Value* slotHash = builder.CreateLoad(slotPtr, "slotHash");
+  builder.CreateCondBr(builder.CreateICmpEQ(slotHash, probeHash), checkKeys, probeNext);
+
+  builder.SetInsertPoint(checkKeys);
+  Value* buildEntry = builder.CreateIntToPtr(entryWord, wordPtrType, "entry");
+  Value* equal = builder.getTrue();
+  for (int j = 0; j < keyCount; j++) {
+    Value* stored = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(buildEntry, j));
+    equal = builder.CreateAnd(equal, builder.CreateICmpEQ(stored, probeWords[j]));
+  }
+  builder.CreateCondBr(equal, emit, probeNext, GetBranchWeights(0.9));
+
+  // output->Data[output->Size++] = {probeRow, buildRow}
+  builder.SetInsertPoint(emit);
+  Value* sizePtr = builder.CreateConstInBoundsGEP1_32(outputArg, 1);
+  Value* size = builder.CreateLoad(sizePtr, "size");
+  Value* capacity = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(outputArg, 2));
+  builder.CreateCondBr(
+    builder.CreateICmpEQ(size, capacity),
+    grow,
+    append,
+    GetBranchWeights(0.01));
+
+  builder.SetInsertPoint(grow);
+  FunctionType* growType = FunctionType::get(
+    builder.getVoidTy(),
+    ArrayRef<Type*>(wordPtrType),
+    false);
+  Value* growFun = builder.CreateIntToPtr(
+    builder.getInt64(reinterpret_cast<ui64>(&joinGrowOutput)),
+    growType->getPointerTo());
+  builder.CreateCall(growFun, outputArg);
+  builder.CreateBr(append);
+
+  builder.SetInsertPoint(append);
+  Value* data = builder.CreateIntToPtr(
+    builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(outputArg, 0)),
+    wordPtrType,
+    "data");
+  Value* match = builder.CreateInBoundsGEP(data, builder.CreateShl(size, 1));
+  builder.CreateStore(
+    builder.CreatePtrToInt(probeRowPtr, builder.getInt64Ty()),
+    builder.CreateConstInBoundsGEP1_32(match, 0));
+  builder.CreateStore(
+    builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(buildEntry, keyCount)),
+    builder.CreateConstInBoundsGEP1_32(match, 1));
+  builder.CreateStore(builder.CreateAdd(size, builder.getInt64(1)), sizePtr);
+  builder.CreateBr(probeNext);
+
+  // Rows with equal keys all lie before the next free slot, though not
+  // necessarily next to each other, so probing goes on past a match, and
+  // past slots of other keys, until a free slot.
+  builder.SetInsertPoint(probeNext);
+  Value* nextSlot = builder.CreateAnd(
+    builder.CreateAdd(slotIndex, builder.getInt64(1)),
+    probeMask);
+  slotIndex->addIncoming(nextSlot, probeNext);
+  builder.CreateBr(probe);
+
+  builder.SetInsertPoint(probeRowNext);
+  Value* nextCandidate = builder.CreateAdd(candidate, builder.getInt64(1));
+  candidate->addIncoming(nextCandidate, probeRowNext);
+  builder.CreateCondBr(
+    builder.CreateICmpSLT(nextCandidate, nextCandidateCount),
+    probeRow,
+    batchNext);
+
+  builder.SetInsertPoint(batchNext);
+  start->addIncoming(end, batchNext);
+  builder.CreateCondBr(builder.CreateICmpSLT(end, countArg), batch, exit);
+
+  builder.SetInsertPoint(exit);
+  builder.CreateRetVoid();
+
+  verifyFunction(*probeFun);
+
+  return probeFun;
+}
+
+Function* LLVMCodegen::EmitComparatorFunction(
+  const TOrderBy& orderBy,
+  const std::string& name)
+{
+  LLVMContext& context = getGlobalContext();
+  IRBuilder<> builder(context);
+  FunctionType* funTp = TypeBuilder<types::i<64>(TRow, TRow), true>::get(context);
+  Function* compareFun = Function::Create(
+    funTp,
+    Function::ExternalLinkage,
+    name,
+    ExpressionModule);
+
+  Function::arg_iterator args = compareFun->arg_begin();
+  Argument* lhsArg = args;
+  lhsArg->setName("lhs");
+  args++;
+  Argument* rhsArg = args;
+  rhsArg->setName("rhs");
+
+  BasicBlock* before = BasicBlock::Create(context, "before", compareFun);
+  BasicBlock* after = BasicBlock::Create(context, "after", compareFun);
+  BasicBlock* key = BasicBlock::Create(context, "key", compareFun, before);
+
+  // if (lhs.key < rhs.key) return before; if (lhs.key > rhs.key) return
+  // after; then on to the next key.
+  for (auto sortKey = orderBy.Keys.begin(); sortKey != orderBy.Keys.end(); sortKey++) {
+    builder.SetInsertPoint(key);
+    EValueType type = typeOf(sortKey->Expression);
+    Row = lhsArg;
+    Value* lhs = Generate(sortKey->Expression, builder);
+    Row = rhsArg;
+    Value* rhs = Generate(sortKey->Expression, builder);
+    Row = NULL;
+
+    Value* less;
+    Value* greater;
+    if (type == EValueType::Double) {
+      // NaN sorts after everything else, as in the normalized keys.
+      Value* lhsIsNaN = builder.CreateFCmpUNO(lhs, lhs);
+      Value* rhsIsNaN = builder.CreateFCmpUNO(rhs, rhs);
+      less = builder.CreateOr(
+        builder.CreateFCmpOLT(lhs, rhs),
+        builder.CreateAnd(builder.CreateNot(lhsIsNaN), rhsIsNaN));
+      greater = builder.CreateOr(
+        builder.CreateFCmpOGT(lhs, rhs),
+        builder.CreateAnd(lhsIsNaN, builder.CreateNot(rhsIsNaN)));
+    } else if (type == EValueType::Int64) {
+      less = builder.CreateICmpSLT(lhs, rhs);
+      greater = builder.CreateICmpSGT(lhs, rhs);
+    } else {
+      less = builder.CreateICmpULT(lhs, rhs);
+      greater = builder.CreateICmpUGT(lhs, rhs);
+    }
+    if (sortKey->Descending) {
+      std::swap(less, greater);
+    }
+
+    BasicBlock* notBefore = BasicBlock::Create(context, "notBefore", compareFun, before);
+    BasicBlock* nextKey = BasicBlock::Create(context, "key", compareFun, before);
+    builder.CreateCondBr(less, before, notBefore);
+    builder.SetInsertPoint(notBefore);
+    builder.CreateCondBr(greater, after, nextKey);
+    key = nextKey;
+  }
+
+  builder.SetInsertPoint(key);
+  builder.CreateRet(builder.getInt64(0));
+  builder.SetInsertPoint(before);
+  builder.CreateRet(builder.getInt64(-1));
+  builder.SetInsertPoint(after);
+  builder.CreateRet(builder.getInt64(1));
+
+  verifyFunction(*compareFun);
+
+  return compareFun;
+}
+
+Function* LLVMCodegen::EmitSortKeyFunction(
+  const TOrderBy& orderBy,
+  const std::string& name)
+{
+  LLVMContext& context = getGlobalContext();
+  IRBuilder<> builder(context);
+  FunctionType* funTp = TypeBuilder<
+    void(TRow*, types::i<64>, types::i<64>*),
+    true>::get(context);
+  Function* keysFun = Function::Create(
+    funTp,
+    Function::ExternalLinkage,
+    name,
+    ExpressionModule);
+
+  Function::arg_iterator args = keysFun->arg_begin();
+  Argument* rowsArg = args;
+  rowsArg->setName("rows");
+  args++;
+  Argument* countArg = args;
+  countArg->setName("count");
+  args++;
+  Argument* entriesArg = args;
+  entriesArg->setName("entries");
+
+  BasicBlock* entry = BasicBlock::Create(context, "entry", keysFun);
+  BasicBlock* loop = BasicBlock::Create(context, "loop", keysFun);
+  BasicBlock* exit = BasicBlock::Create(context, "exit", keysFun);
+
+  int keyCount = orderBy.Keys.size();
+  Type* wordType = builder.getInt64Ty();
+  Function* bswap = Intrinsic::getDeclaration(
+    ExpressionModule,
+    Intrinsic::bswap,
+    ArrayRef<Type*>(wordType));
+  Value* signBit = builder.getInt64(1ULL << 63);
+
+  builder.SetInsertPoint(entry);
+  builder.CreateCondBr(
+    builder.CreateICmpSGT(countArg, builder.getInt64(0)),
+    loop,
+    exit);
+
+  builder.SetInsertPoint(loop);
+  PHINode* index = builder.CreatePHI(wordType, 2, "i");
+  index->addIncoming(builder.getInt64(0), entry);
+  Row = builder.CreateLoad(builder.CreateInBoundsGEP(rowsArg, index), "row");
+  Value* rowEntry = builder.CreateInBoundsGEP(
+    entriesArg,
+    builder.CreateMul(index, builder.getInt64(keyCount + 1)),
+    "entry");
+  for (int j = 0; j < keyCount; j++) {
+    const TSortKey& sortKey = orderBy.Keys[j];
+    EValueType type = typeOf(sortKey.Expression);
+    // Key words fold -0.0 into 0.0 and NaNs into one NaN, which the
+    // comparator finds equal.
+    Value* word = emitKeyWord(builder, Generate(sortKey.Expression, builder), type);
+    if (type == EValueType::Int64) {
+      word = builder.CreateXor(word, signBit);
+    } else if (type == EValueType::Double) {
+      // Negative doubles order backwards by their bits.
+      Value* flip = builder.CreateOr(builder.CreateAShr(word, 63), signBit);
+      word = builder.CreateXor(word, flip);
+    }
+    if (sortKey.Descending) {
+      word = builder.CreateNot(word);
+    }
+    builder.CreateStore(
+      builder.CreateCall(bswap, word),
+      builder.CreateConstInBoundsGEP1_32(rowEntry, j));
+  }
+  builder.CreateStore(
+    builder.CreatePtrToInt(Row, wordType),
+    builder.CreateConstInBoundsGEP1_32(rowEntry, keyCount));
+  Row = NULL;
+  Value* nextIndex = builder.CreateAdd(index, builder.getInt64(1), "nextIndex");
+  index->addIncoming(nextIndex, builder.GetInsertBlock());
+  builder.CreateCondBr(builder.CreateICmpSLT(nextIndex, countArg), loop, exit);
+
+  builder.SetInsertPoint(exit);
+  builder.CreateRetVoid();
+
+  verifyFunction(*keysFun);
+
+  return keysFun;
+}
+
+Function* LLVMCodegen::EmitBlockFilterFunction(
+  TConstExpressionPtr predicate,
+  const std::string& name)
+{
+  LLVMContext& context = getGlobalContext();
+  IRBuilder<> builder(context);
+  FunctionType* funTp = TypeBuilder<
+    types::i<64>(types::i<64>*, types::i<64>),
+    true>::get(context);
+  Function* filterFun = Function::Create(
+    funTp,
+    Function::ExternalLinkage,
+    name,
+    ExpressionModule);
+
+  Function::arg_iterator args = filterFun->arg_begin();
+  Argument* statisticsArg = args;
+  statisticsArg->setName("statistics");
+  args++;
+  Argument* columnCountArg = args;
+  columnCountArg->setName("columnCount");
+
+  BasicBlock* entry = BasicBlock::Create(context, "entry", filterFun);
+  BasicBlock* analyze = BasicBlock::Create(context, "analyze", filterFun);
+  BasicBlock* unknown = BasicBlock::Create(context, "unknown", filterFun);
+
+  // Blocks without statistics for some referenced column may match.
+  builder.SetInsertPoint(entry);
+  std::set<int> columns;
+  collectReferencedColumns(predicate, &columns);
+  int maxColumn = columns.empty() ? -1 : *columns.rbegin();
+  builder.CreateCondBr(
+    builder.CreateICmpSGT(columnCountArg, builder.getInt64(maxColumn)),
+    analyze,
+    unknown);
+
+  builder.SetInsertPoint(analyze);
+  TValueRange range = GenerateRange(predicate, statisticsArg, builder);
+  builder.CreateRet(builder.CreateZExt(range.MayBeTrue, builder.getInt64Ty()));
+
+  builder.SetInsertPoint(unknown);
+  builder.CreateRet(builder.getInt64(1));
+
+  verifyFunction(*filterFun);
+
+  return filterFun;
+}
+
+Module* LLVMCodegen::LinkFunctions()
+{
+  IRBuilder<> builder(getGlobalContext());
   Linker linker(ExpressionModule);
+  std::set<const FunctionSignature*> linked;
   for (auto functionSigs = FunctionsToEmit.begin();
        functionSigs != FunctionsToEmit.end();
        functionSigs++) {
+    // Expressions usually call the same function many times, but each
+    // definition can be linked in only once.
+    if (!linked.insert(*functionSigs).second) {
+      continue;
+    }
     Module* functionModule = (*functionSigs)->IREmitter(builder);
     linker.linkInModule(functionModule, NULL);
   }
+  FunctionsToEmit.clear();
 
   return ExpressionModule;
 }
@@ -85,64 +1308,1005 @@ FunctionType* LLVMCodegen::getLLVMType(EValueType resultType, std::vector<EValue
   return FunctionType::get(result, ArrayRef<Type*>(args), false);
 }
 
-Value* LLVMCodegen::Generate(std::shared_ptr<TExpression> expr, IRBuilder<> builder)
+Value* LLVMCodegen::Generate(TConstExpressionPtr expr, IRBuilder<>& builder)
 {
-  LLVMContext& context = getGlobalContext();
-  if (expr->As<TLiteralExpression>()) {
-    TLiteralExpression* literalExpr = expr->As<TLiteralExpression>();
-    switch (expr->Type) {
-      case EValueType::Int64:
-      case EValueType::Uint64: {
-        i64 literal = literalExpr->Value->Data.Int64;
-        return builder.getInt64(literal);
+  Value* result = GenerateNode(expr, builder);
+  if (Counters && Profile->IsInstrumented(Profile->GetId(expr))) {
+    EmitCounterUpdate(builder, Profile->GetId(expr), typeOf(expr), result);
+  }
+  return result;
+}
+
+Value* LLVMCodegen::GenerateNode(TConstExpressionPtr expr, IRBuilder<>& builder)
+{
+  switch (expr->Kind) {
+    case EExpressionKind::Literal: {
+      const TLiteralExpression* literalExpr = static_cast<const TLiteralExpression*>(expr);
+      return GenerateLiteral(builder, literalExpr->Value, expr->Type);
+    }
+
+    case EExpressionKind::Reference: {
+      const TReferenceExpression* referenceExpr = static_cast<const TReferenceExpression*>(expr);
+      if (Substitute && referenceExpr->ColumnIndex == Specialization->ColumnIndex) {
+        return GenerateLiteral(builder, Specialization->Value, expr->Type);
       }
-      case EValueType::Double: {
-        double literal = literalExpr->Value->Data.Double;
-        return ConstantFP::get(Type::getDoubleTy(context), literal);
+      if (!Row) {
+        return NULL;
       }
-      case EValueType::Boolean: {
-        bool literal = literalExpr->Value->Data.Boolean;
-        return builder.getInt1(literal);
+      return LoadValueData(
+        builder,
+        GetRowValues(builder, Row),
+        referenceExpr->ColumnIndex,
+        expr->Type);
+    }
+
+    case EExpressionKind::BinaryOp: {
+      const TBinaryOpExpression* binOpExpr = static_cast<const TBinaryOpExpression*>(expr);
+      if ((binOpExpr->Opcode == EBinaryOp::And || binOpExpr->Opcode == EBinaryOp::Or)
+          && typeOf(binOpExpr) == EValueType::Boolean) {
+        return GenerateShortCircuit(binOpExpr, builder);
       }
-      case EValueType::String: {
-        //TODO
+      Value* lhs = Generate(binOpExpr->Lhs, builder);
+      Value* rhs = Generate(binOpExpr->Rhs, builder);
+      std::vector<EValueType> argTypes({
+        typeOf(binOpExpr->Lhs), typeOf(binOpExpr->Rhs)
+      });
+      auto binOpSig = registry->GetFunction(
+        binOpExpr->Opcode,
+        typeOf(binOpExpr),
+        &argTypes);
+      FunctionsToEmit.push_back(binOpSig);
+      auto function = GetLLVMFunction(binOpSig, ExpressionModule);
+      return builder.CreateCall2(function, lhs, rhs);
+    }
+
+    case EExpressionKind::Function: {
+      const TFunctionExpression* funExpr = static_cast<const TFunctionExpression*>(expr);
+      std::vector<Value*> llvmArgs;
+      for (auto args = funExpr->Arguments.begin();
+           args != funExpr->Arguments.end();
+           args++) {
+        llvmArgs.push_back(Generate(*args, builder));
       }
-      default:
-        return NULL;
+      auto funSig = registry->GetFunction(
+        funExpr->FunctionName.str(),
+        typeOf(funExpr));
+      FunctionsToEmit.push_back(funSig);
+      auto function = GetLLVMFunction(funSig, ExpressionModule);
+      return builder.CreateCall(function, ArrayRef<Value*>(llvmArgs));
     }
-  } else if (expr->As<TBinaryOpExpression>()) {
-    TBinaryOpExpression* binOpExpr = expr->As<TBinaryOpExpression>();
-    Value* lhs = Generate(binOpExpr->Lhs, builder);
-    Value* rhs = Generate(binOpExpr->Rhs, builder);
-    auto binOpSig = registry->GetFunction(
-      binOpExpr->Opcode,
-      typeOf(binOpExpr));
-    FunctionsToEmit.push_back(binOpSig);
-    auto function = GetLLVMFunction(binOpSig, ExpressionModule);
-    return builder.CreateCall2(function, lhs, rhs);
-  } else if (expr->As<TFunctionExpression>()) {
-    TFunctionExpression* funExpr = expr->As<TFunctionExpression>();
-    std::vector<Value*> llvmArgs;
-    for (auto args = funExpr->Arguments.begin();
-         args != funExpr->Arguments.end();
-         args++) {
-      llvmArgs.push_back(Generate(*args, builder));
-    }
-    auto funSig = registry->GetFunction(
-      funExpr->FunctionName,
-      typeOf(funExpr));
-    FunctionsToEmit.push_back(funSig);
-    auto function = GetLLVMFunction(funSig, ExpressionModule);
-    return builder.CreateCall(function, ArrayRef<Value*>(llvmArgs));
-  }
-  
+  }
 
   return NULL;
 }
 
+Value* LLVMCodegen::GenerateLiteral(
+  IRBuilder<>& builder,
+  const TValue& value,
+  EValueType type)
+{
+  LLVMContext& context = getGlobalContext();
+  switch (type) {
+    case EValueType::Int64:
+    case EValueType::Uint64: {
+      i64 literal = value.Data.Int64;
+      return builder.getInt64(literal);
+    }
+    case EValueType::Double: {
+      double literal = value.Data.Double;
+      return ConstantFP::get(Type::getDoubleTy(context), literal);
+    }
+    case EValueType::Boolean: {
+      bool literal = value.Data.Boolean;
+      return builder.getInt1(literal);
+    }
+    case EValueType::String: {
+      //TODO
+    }
+    default:
+      return NULL;
+  }
+}
+
+Value* LLVMCodegen::GenerateShortCircuit(
+  const TBinaryOpExpression* expr,
+  IRBuilder<>& builder)
+{
+  // lhs && rhs: if (lhs) result = rhs; else result = false;
+  // lhs || rhs: if (lhs) result = true; else result = rhs;
+  LLVMContext& context = getGlobalContext();
+  Function* function = builder.GetInsertBlock()->getParent();
+  bool isAnd = expr->Opcode == EBinaryOp::And;
+
+  Value* lhs = Generate(expr->Lhs, builder);
+  BasicBlock* lhsEnd = builder.GetInsertBlock();
+  BasicBlock* rhsBlock = BasicBlock::Create(context, isAnd ? "and.rhs" : "or.rhs", function);
+  BasicBlock* endBlock = BasicBlock::Create(context, isAnd ? "and.end" : "or.end", function);
+  MDNode* weights = NULL;
+  if (BranchHints) {
+    auto hint = BranchHints->find(expr->Lhs);
+    if (hint != BranchHints->end()) {
+      weights = GetBranchWeights(hint->second);
+    }
+  }
+  builder.CreateCondBr(
+    lhs,
+    isAnd ? rhsBlock : endBlock,
+    isAnd ? endBlock : rhsBlock,
+    weights);
+
+  builder.SetInsertPoint(rhsBlock);
+  Value* rhs = Generate(expr->Rhs, builder);
+  BasicBlock* rhsEnd = builder.GetInsertBlock();
+  builder.CreateBr(endBlock);
+
+  builder.SetInsertPoint(endBlock);
+  PHINode* result = builder.CreatePHI(builder.getInt1Ty(), 2);
+  result->addIncoming(builder.getInt1(!isAnd), lhsEnd);
+  result->addIncoming(rhs, rhsEnd);
+  return result;
+}
+
+Value* LLVMCodegen::GenerateSpecialized(
+  TConstExpressionPtr expr,
+  IRBuilder<>& builder)
+{
+  // if (row[column] == value) result = expr[column := value];
+  // else result = expr;
+  LLVMContext& context = getGlobalContext();
+  Function* function = builder.GetInsertBlock()->getParent();
+  EValueType columnType = static_cast<EValueType>(Specialization->Value.Type);
+
+  Value* actual = LoadValueData(
+    builder,
+    GetRowValues(builder, Row),
+    Specialization->ColumnIndex,
+    columnType);
+  Value* expected = GenerateLiteral(builder, Specialization->Value, columnType);
+  if (columnType == EValueType::Double) {
+    // Doubles match by bits, as TValueSampler keys them: 0.0 must not take
+    // the path specialized on -0.0.
+    actual = builder.CreateBitCast(actual, builder.getInt64Ty());
+    expected = builder.CreateBitCast(expected, builder.getInt64Ty());
+  }
+  Value* matches = builder.CreateICmpEQ(actual, expected);
+
+  BasicBlock* specializedBlock = BasicBlock::Create(context, "specialized", function);
+  BasicBlock* genericBlock = BasicBlock::Create(context, "generic", function);
+  BasicBlock* joinBlock = BasicBlock::Create(context, "join", function);
+  builder.CreateCondBr(
+    matches,
+    specializedBlock,
+    genericBlock,
+    GetBranchWeights(Specialization->Frequency));
+
+  builder.SetInsertPoint(specializedBlock);
+  Substitute = true;
+  Value* specialized = Generate(expr, builder);
+  Substitute = false;
+  BasicBlock* specializedEnd = builder.GetInsertBlock();
+  builder.CreateBr(joinBlock);
+
+  builder.SetInsertPoint(genericBlock);
+  Value* generic = Generate(expr, builder);
+  BasicBlock* genericEnd = builder.GetInsertBlock();
+  builder.CreateBr(joinBlock);
+
+  builder.SetInsertPoint(joinBlock);
+  PHINode* result = builder.CreatePHI(getLLVMType(typeOf(expr)), 2);
+  result->addIncoming(specialized, specializedEnd);
+  result->addIncoming(generic, genericEnd);
+  return result;
+}
+
+std::vector<Value*> LLVMCodegen::GenerateKeyWords(
+  const std::vector<TConstExpressionPtr>& keys,
+  IRBuilder<>& builder)
+{
+  std::vector<Value*> words;
+  for (auto key = keys.begin(); key != keys.end(); key++) {
+    words.push_back(emitKeyWord(builder, Generate(*key, builder), typeOf(*key)));
+  }
+  return words;
+}
+
+// Prefetches the cache line of address for reading, to be kept in all
+// cache levels.
+void LLVMCodegen::EmitPrefetch(IRBuilder<>& builder, Value* address)
+{
+  Function* prefetch = Intrinsic::getDeclaration(ExpressionModule, Intrinsic::prefetch);
+  builder.CreateCall4(
+    prefetch,
+    builder.CreatePointerCast(address, builder.getInt8PtrTy()),
+    builder.getInt32(0),
+    builder.getInt32(3),
+    builder.getInt32(1));
+}
+
+Function* LLVMCodegen::EmitMaterializeFunction(
+  TConstExpressionPtr predicate,
+  const std::vector<TConstExpressionPtr>& projections,
+  const std::string& name)
+{
+  LLVMContext& context = getGlobalContext();
+  IRBuilder<> builder(context);
+  FunctionType* funTp = TypeBuilder<
+    types::i<64>(TRow*, types::i<64>, types::i<64>*),
+    true>::get(context);
+  Function* materializeFun = Function::Create(
+    funTp,
+    Function::ExternalLinkage,
+    name,
+    ExpressionModule);
+
+  Function::arg_iterator args = materializeFun->arg_begin();
+  Argument* rowsArg = args;
+  rowsArg->setName("rows");
+  args++;
+  Argument* countArg = args;
+  countArg->setName("count");
+  args++;
+  Argument* writerArg = args;
+  writerArg->setName("writer");
+
+  BasicBlock* entry = BasicBlock::Create(context, "entry", materializeFun);
+  BasicBlock* loop = BasicBlock::Create(context, "loop", materializeFun);
+  BasicBlock* write = BasicBlock::Create(context, "write", materializeFun);
+  BasicBlock* next = BasicBlock::Create(context, "next", materializeFun);
+  BasicBlock* exit = BasicBlock::Create(context, "exit", materializeFun);
+
+  builder.SetInsertPoint(entry);
+  Value* writtenCount = builder.CreateAlloca(builder.getInt64Ty(), NULL, "writtenCount");
+  builder.CreateStore(builder.getInt64(0), writtenCount);
+  builder.CreateCondBr(
+    builder.CreateICmpSGT(countArg, builder.getInt64(0)),
+    loop,
+    exit);
+
+  builder.SetInsertPoint(loop);
+  PHINode* index = builder.CreatePHI(builder.getInt64Ty(), 2, "i");
+  index->addIncoming(builder.getInt64(0), entry);
+  Row = builder.CreateLoad(builder.CreateInBoundsGEP(rowsArg, index), "row");
+  if (predicate) {
+    builder.CreateCondBr(Generate(predicate, builder), write, next);
+  } else {
+    builder.CreateBr(write);
+  }
+
+  // The values are computed before the row is allocated, so that slow
+  // paths of the allocation do not split the code generating them.
+  builder.SetInsertPoint(write);
+  int projectionCount = projections.size();
+  std::vector<Value*> values;
+  for (int j = 0; j < projectionCount; j++) {
+    values.push_back(Generate(projections[j], builder));
+  }
+  Row = NULL;
+
+  Type* rowType = TypeBuilder<TRowHeader, true>::get(context);
+  Type* valueType = TypeBuilder<TValue, true>::get(context);
+  Value* outputRow = builder.CreateBitCast(
+    EmitRowWriterAllocate(
+      builder,
+      writerArg,
+      sizeof(TRowHeader) + projectionCount * sizeof(TValue)),
+    rowType->getPointerTo(),
+    "outputRow");
+  builder.CreateStore(builder.getInt32(projectionCount), builder.CreateConstInBoundsGEP2_32(outputRow, 0, 0));
+  builder.CreateStore(builder.getInt32(0), builder.CreateConstInBoundsGEP2_32(outputRow, 0, 1));
+  Value* outputValues = builder.CreateBitCast(
+    builder.CreateConstInBoundsGEP1_32(outputRow, 1),
+    valueType->getPointerTo());
+  for (int j = 0; j < projectionCount; j++) {
+    EValueType type = typeOf(projections[j]);
+    StoreValueHeader(builder, outputValues, j, j, type);
+    StoreValueData(builder, values[j], outputValues, j, type);
+  }
+  EmitRowWriterAppend(builder, writerArg, outputRow);
+  builder.CreateStore(
+    builder.CreateAdd(builder.CreateLoad(writtenCount), builder.getInt64(1)),
+    writtenCount);
+  builder.CreateBr(next);
+
+  builder.SetInsertPoint(next);
+  Value* nextIndex = builder.CreateAdd(index, builder.getInt64(1), "nextIndex");
+  index->addIncoming(nextIndex, next);
+  builder.CreateCondBr(builder.CreateICmpSLT(nextIndex, countArg), loop, exit);
+
+  builder.SetInsertPoint(exit);
+  builder.CreateRet(builder.CreateLoad(writtenCount));
+
+  verifyFunction(*materializeFun);
+
+  return materializeFun;
+}
+
+Value* LLVMCodegen::EmitRowWriterAllocate(
+  IRBuilder<>& builder,
+  Value* writer,
+  ui64 size)
+{
+  LLVMContext& context = getGlobalContext();
+  Function* function = builder.GetInsertBlock()->getParent();
+  BasicBlock* refill = BasicBlock::Create(context, "refill", function);
+  BasicBlock* bump = BasicBlock::Create(context, "bump", function);
+  BasicBlock* allocated = BasicBlock::Create(context, "allocated", function);
+
+  size = (size + TRowWriter::Alignment - 1) & ~(TRowWriter::Alignment - 1);
+
+  // if (writer->End - writer->Current < size) refill
+  Value* currentPtr = builder.CreateConstInBoundsGEP1_32(writer, 0);
+  Value* current = builder.CreateLoad(currentPtr, "current");
+  Value* end = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(writer, 1), "end");
+  builder.CreateCondBr(
+    builder.CreateICmpULT(builder.CreateSub(end, current), builder.getInt64(size)),
+    refill,
+    bump,
+    GetBranchWeights(0.01));
+
+  builder.SetInsertPoint(refill);
+  Type* wordType = builder.getInt64Ty();
+  Type* refillArgs[] = { writer->getType(), wordType };
+  FunctionType* refillType = FunctionType::get(wordType, refillArgs, false);
+  Value* refillFun = builder.CreateIntToPtr(
+    builder.getInt64(reinterpret_cast<ui64>(&rowWriterRefill)),
+    refillType->getPointerTo());
+  Value* refilled = builder.CreateCall2(refillFun, writer, builder.getInt64(size));
+  builder.CreateBr(allocated);
+
+  builder.SetInsertPoint(bump);
+  builder.CreateStore(builder.CreateAdd(current, builder.getInt64(size)), currentPtr);
+  builder.CreateBr(allocated);
+
+  builder.SetInsertPoint(allocated);
+  PHINode* memory = builder.CreatePHI(wordType, 2, "memory");
+  memory->addIncoming(refilled, refill);
+  memory->addIncoming(current, bump);
+  return builder.CreateIntToPtr(memory, builder.getInt8PtrTy());
+}
+
+void LLVMCodegen::EmitRowWriterAppend(
+  IRBuilder<>& builder,
+  Value* writer,
+  Value* row)
+{
+  LLVMContext& context = getGlobalContext();
+  Function* function = builder.GetInsertBlock()->getParent();
+  BasicBlock* grow = BasicBlock::Create(context, "growRows", function);
+  BasicBlock* append = BasicBlock::Create(context, "appendRow", function);
+
+  // if (writer->RowCount == writer->RowCapacity) grow
+  Value* rowCountPtr = builder.CreateConstInBoundsGEP1_32(writer, 3);
+  Value* rowCount = builder.CreateLoad(rowCountPtr, "rowCount");
+  Value* rowCapacity = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(writer, 4));
+  builder.CreateCondBr(
+    builder.CreateICmpEQ(rowCount, rowCapacity),
+    grow,
+    append,
+    GetBranchWeights(0.01));
+
+  builder.SetInsertPoint(grow);
+  FunctionType* growType = FunctionType::get(
+    builder.getVoidTy(),
+    ArrayRef<Type*>(writer->getType()),
+    false);
+  Value* growFun = builder.CreateIntToPtr(
+    builder.getInt64(reinterpret_cast<ui64>(&rowWriterGrowRows)),
+    growType->getPointerTo());
+  builder.CreateCall(growFun, writer);
+  builder.CreateBr(append);
+
+  // writer->Rows[writer->RowCount++] = row
+  builder.SetInsertPoint(append);
+  Value* rows = builder.CreateIntToPtr(
+    builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(writer, 2)),
+    writer->getType(),
+    "rows");
+  builder.CreateStore(
+    builder.CreatePtrToInt(row, builder.getInt64Ty()),
+    builder.CreateInBoundsGEP(rows, rowCount));
+  builder.CreateStore(builder.CreateAdd(rowCount, builder.getInt64(1)), rowCountPtr);
+}
+
+Function* LLVMCodegen::EmitCodeFilterFunction(
+  const TCodePredicate& predicate,
+  const std::string& name)
+{
+  LLVMContext& context = getGlobalContext();
+  IRBuilder<> builder(context);
+  FunctionType* funTp = TypeBuilder<
+    types::i<64>(types::i<32>*, types::i<64>, types::i<8>*),
+    true>::get(context);
+  Function* filterFun = Function::Create(
+    funTp,
+    Function::ExternalLinkage,
+    name,
+    ExpressionModule);
+
+  Function::arg_iterator args = filterFun->arg_begin();
+  Argument* codesArg = args;
+  codesArg->setName("codes");
+  args++;
+  Argument* countArg = args;
+  countArg->setName("count");
+  args++;
+  Argument* matchesArg = args;
+  matchesArg->setName("matches");
+
+  // Bitmaps of more than one word are looked up in a constant of the module.
+  Value* bitmap = NULL;
+  if (predicate.IsBitmap && predicate.Bitmap.size() > 1) {
+    std::vector<uint64_t> words(predicate.Bitmap.begin(), predicate.Bitmap.end());
+    GlobalVariable* global = new GlobalVariable(
+      *ExpressionModule,
+      ArrayType::get(builder.getInt64Ty(), words.size()),
+      true,
+      GlobalValue::PrivateLinkage,
+      ConstantDataArray::get(context, words),
+      name + ".bitmap");
+    bitmap = builder.CreateConstInBoundsGEP2_32(global, 0, 0);
+  }
+
+  BasicBlock* entry = BasicBlock::Create(context, "entry", filterFun);
+  BasicBlock* vectorLoop = BasicBlock::Create(context, "vectorLoop", filterFun);
+  BasicBlock* vectorExit = BasicBlock::Create(context, "vectorExit", filterFun);
+  BasicBlock* scalarLoop = BasicBlock::Create(context, "scalarLoop", filterFun);
+  BasicBlock* exit = BasicBlock::Create(context, "exit", filterFun);
+
+  const int width = CodeFilterVectorWidth;
+  Type* indexType = builder.getInt64Ty();
+  Type* countVectorType = VectorType::get(builder.getInt32Ty(), width);
+  Value* zeroCounts = Constant::getNullValue(countVectorType);
+
+  builder.SetInsertPoint(entry);
+  Value* vectorCount = builder.CreateAnd(countArg, builder.getInt64(-width), "vectorCount");
+  builder.CreateCondBr(
+    builder.CreateICmpSGT(vectorCount, builder.getInt64(0)),
+    vectorLoop,
+    vectorExit);
+
+  // Whole vectors of codes, with a count of matches per lane.
+  builder.SetInsertPoint(vectorLoop);
+  PHINode* vectorIndex = builder.CreatePHI(indexType, 2, "i");
+  vectorIndex->addIncoming(builder.getInt64(0), entry);
+  PHINode* counts = builder.CreatePHI(countVectorType, 2, "counts");
+  counts->addIncoming(zeroCounts, entry);
+  Value* codes = builder.CreateAlignedLoad(
+    builder.CreateBitCast(
+      builder.CreateInBoundsGEP(codesArg, vectorIndex),
+      countVectorType->getPointerTo()),
+    sizeof(ui32),
+    "codes");
+  Value* vectorMatches = GenerateCodeMatch(predicate, codes, bitmap, builder);
+  builder.CreateAlignedStore(
+    builder.CreateZExt(vectorMatches, VectorType::get(builder.getInt8Ty(), width)),
+    builder.CreateBitCast(
+      builder.CreateInBoundsGEP(matchesArg, vectorIndex),
+      VectorType::get(builder.getInt8Ty(), width)->getPointerTo()),
+    1);
+  Value* nextCounts = builder.CreateAdd(
+    counts,
+    builder.CreateZExt(vectorMatches, countVectorType),
+    "nextCounts");
+  counts->addIncoming(nextCounts, vectorLoop);
+  Value* nextVectorIndex = builder.CreateAdd(vectorIndex, builder.getInt64(width), "nextI");
+  vectorIndex->addIncoming(nextVectorIndex, vectorLoop);
+  builder.CreateCondBr(
+    builder.CreateICmpSLT(nextVectorIndex, vectorCount),
+    vectorLoop,
+    vectorExit);
+
+  builder.SetInsertPoint(vectorExit);
+  PHINode* tailIndex = builder.CreatePHI(indexType, 2, "tail");
+  tailIndex->addIncoming(builder.getInt64(0), entry);
+  tailIndex->addIncoming(nextVectorIndex, vectorLoop);
+  PHINode* laneCounts = builder.CreatePHI(countVectorType, 2, "laneCounts");
+  laneCounts->addIncoming(zeroCounts, entry);
+  laneCounts->addIncoming(nextCounts, vectorLoop);
+  Value* vectorTotal = builder.getInt64(0);
+  for (int lane = 0; lane < width; lane++) {
+    vectorTotal = builder.CreateAdd(
+      vectorTotal,
+      builder.CreateZExt(builder.CreateExtractElement(laneCounts, builder.getInt32(lane)), indexType));
+  }
+  builder.CreateCondBr(builder.CreateICmpSLT(tailIndex, countArg), scalarLoop, exit);
+
+  // The remaining codes, one at a time.
+  builder.SetInsertPoint(scalarLoop);
+  PHINode* index = builder.CreatePHI(indexType, 2, "j");
+  index->addIncoming(tailIndex, vectorExit);
+  PHINode* total = builder.CreatePHI(indexType, 2, "total");
+  total->addIncoming(vectorTotal, vectorExit);
+  Value* code = builder.CreateLoad(builder.CreateInBoundsGEP(codesArg, index), "code");
+  Value* match = GenerateCodeMatch(predicate, code, bitmap, builder);
+  builder.CreateStore(
+    builder.CreateZExt(match, builder.getInt8Ty()),
+    builder.CreateInBoundsGEP(matchesArg, index));
+  Value* nextTotal = builder.CreateAdd(total, builder.CreateZExt(match, indexType), "nextTotal");
+  total->addIncoming(nextTotal, scalarLoop);
+  Value* nextIndex = builder.CreateAdd(index, builder.getInt64(1), "nextJ");
+  index->addIncoming(nextIndex, scalarLoop);
+  builder.CreateCondBr(builder.CreateICmpSLT(nextIndex, countArg), scalarLoop, exit);
+
+  builder.SetInsertPoint(exit);
+  PHINode* result = builder.CreatePHI(indexType, 2, "result");
+  result->addIncoming(vectorTotal, vectorExit);
+  result->addIncoming(nextTotal, scalarLoop);
+  builder.CreateRet(result);
+
+  verifyFunction(*filterFun);
+
+  return filterFun;
+}
+
+Value* LLVMCodegen::GenerateCodeMatch(
+  const TCodePredicate& predicate,
+  Value* codes,
+  Value* bitmap,
+  IRBuilder<>& builder)
+{
+  VectorType* vectorType = dyn_cast<VectorType>(codes->getType());
+  auto constant = [&] (Constant* scalar) -> Value* {
+    return vectorType
+      ? ConstantVector::getSplat(vectorType->getNumElements(), scalar)
+      : scalar;
+  };
+
+  if (!predicate.IsBitmap) {
+    return builder.CreateICmpEQ(codes, constant(builder.getInt32(predicate.Code)));
+  }
+
+  ui64 bitCount = 64 * predicate.Bitmap.size();
+  Value* inRange = builder.CreateICmpULT(codes, constant(builder.getInt32(bitCount)));
+
+  if (predicate.Bitmap.size() <= 1) {
+    // One word: shifting it right by the code works on whole vectors.
+    ui64 word = predicate.Bitmap.empty() ? 0 : predicate.Bitmap[0];
+    Type* wideType = vectorType
+      ? static_cast<Type*>(VectorType::get(builder.getInt64Ty(), vectorType->getNumElements()))
+      : builder.getInt64Ty();
+    Value* shift = builder.CreateZExt(
+      builder.CreateAnd(codes, constant(builder.getInt32(63))),
+      wideType);
+    Value* bit = builder.CreateTrunc(
+      builder.CreateLShr(constant(builder.getInt64(word)), shift),
+      inRange->getType());
+    return builder.CreateAnd(bit, inRange);
+  }
+
+  if (vectorType) {
+    // There is no gather: look lanes up one by one.
+    Value* matches = UndefValue::get(inRange->getType());
+    for (unsigned lane = 0; lane < vectorType->getNumElements(); lane++) {
+      Value* code = builder.CreateExtractElement(codes, builder.getInt32(lane));
+      matches = builder.CreateInsertElement(
+        matches,
+        GenerateCodeMatch(predicate, code, bitmap, builder),
+        builder.getInt32(lane));
+    }
+    return matches;
+  }
+
+  Value* wideCode = builder.CreateZExt(codes, builder.getInt64Ty());
+  Value* wordIndex = builder.CreateSelect(
+    inRange,
+    builder.CreateLShr(wideCode, builder.getInt64(6)),
+    builder.getInt64(0));
+  Value* word = builder.CreateLoad(builder.CreateInBoundsGEP(bitmap, wordIndex));
+  Value* bit = builder.CreateTrunc(
+    builder.CreateLShr(word, builder.CreateAnd(wideCode, builder.getInt64(63))),
+    builder.getInt1Ty());
+  return builder.CreateAnd(bit, inRange);
+}
+
+// Ranges are computed without branches: every node yields its bounds and
+// whether they hold, and nodes that cannot be bounded (divisions, function
+// calls, overflowing arithmetic, columns with nulls or mixed types) give
+// "anything", which makes the predicate possibly true.
+LLVMCodegen::TValueRange LLVMCodegen::GenerateRange(
+  TConstExpressionPtr expr,
+  Value* statistics,
+  IRBuilder<>& builder)
+{
+  EValueType type = typeOf(expr);
+  TValueRange range;
+  range.Known = builder.getFalse();
+  range.Min = range.Max = type == EValueType::Double
+    ? ConstantFP::get(builder.getDoubleTy(), 0.0)
+    : static_cast<Value*>(builder.getInt64(0));
+  range.MayBeTrue = builder.getTrue();
+  range.MayBeFalse = builder.getTrue();
+
+  bool isNumeric = type == EValueType::Int64
+    || type == EValueType::Uint64
+    || type == EValueType::Double;
+  if (!isNumeric && type != EValueType::Boolean) {
+    return range;
+  }
+
+  switch (expr->Kind) {
+    case EExpressionKind::Literal: {
+      const TLiteralExpression* literalExpr = static_cast<const TLiteralExpression*>(expr);
+      Value* literal = GenerateLiteral(builder, literalExpr->Value, type);
+      if (type == EValueType::Boolean) {
+        range.MayBeTrue = literal;
+        range.MayBeFalse = builder.CreateNot(literal);
+      } else {
+        range.Known = builder.getTrue();
+        range.Min = range.Max = literal;
+      }
+      return range;
+    }
+
+    case EExpressionKind::Reference: {
+      int column = static_cast<const TReferenceExpression*>(expr)->ColumnIndex;
+      Value* columnStatistics = builder.CreateConstInBoundsGEP1_32(statistics, 4 * column);
+      Value* known = builder.CreateAnd(
+        builder.CreateICmpEQ(
+          builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(columnStatistics, 0)),
+          builder.getInt64(type)),
+        builder.CreateICmpEQ(
+          builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(columnStatistics, 1)),
+          builder.getInt64(0)));
+      Value* min = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(columnStatistics, 2));
+      Value* max = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(columnStatistics, 3));
+      if (type == EValueType::Boolean) {
+        Value* unknown = builder.CreateNot(known);
+        range.MayBeTrue = builder.CreateOr(unknown, builder.CreateICmpNE(max, builder.getInt64(0)));
+        range.MayBeFalse = builder.CreateOr(unknown, builder.CreateICmpEQ(min, builder.getInt64(0)));
+      } else {
+        range.Known = known;
+        range.Min = type == EValueType::Double
+          ? builder.CreateBitCast(min, builder.getDoubleTy())
+          : min;
+        range.Max = type == EValueType::Double
+          ? builder.CreateBitCast(max, builder.getDoubleTy())
+          : max;
+      }
+      return range;
+    }
+
+    case EExpressionKind::BinaryOp:
+      break;
+
+    default:
+      return range;
+  }
+
+  const TBinaryOpExpression* binaryOp = static_cast<const TBinaryOpExpression*>(expr);
+  TValueRange lhs = GenerateRange(binaryOp->Lhs, statistics, builder);
+  TValueRange rhs = GenerateRange(binaryOp->Rhs, statistics, builder);
+
+  switch (binaryOp->Opcode) {
+    case EBinaryOp::Plus:
+    case EBinaryOp::Minus:
+    case EBinaryOp::Multiply:
+      return GenerateArithmeticRange(binaryOp->Opcode, type, lhs, rhs, builder);
+
+    case EBinaryOp::And:
+      range.MayBeTrue = builder.CreateAnd(lhs.MayBeTrue, rhs.MayBeTrue);
+      range.MayBeFalse = builder.CreateOr(lhs.MayBeFalse, rhs.MayBeFalse);
+      return range;
+
+    case EBinaryOp::Or:
+      range.MayBeTrue = builder.CreateOr(lhs.MayBeTrue, rhs.MayBeTrue);
+      range.MayBeFalse = builder.CreateAnd(lhs.MayBeFalse, rhs.MayBeFalse);
+      return range;
+
+    case EBinaryOp::Equal:
+    case EBinaryOp::NotEqual:
+    case EBinaryOp::Less:
+    case EBinaryOp::LessOrEqual:
+    case EBinaryOp::Greater:
+    case EBinaryOp::GreaterOrEqual:
+      break;
+
+    default:
+      return range;
+  }
+
+  // Comparisons. Booleans compare as the range [0, 1] they may take.
+  EValueType operandType = typeOf(binaryOp->Lhs);
+  if (operandType == EValueType::Boolean) {
+    for (TValueRange* operand : { &lhs, &rhs }) {
+      operand->Known = builder.getTrue();
+      operand->Min = builder.CreateZExt(builder.CreateNot(operand->MayBeFalse), builder.getInt64Ty());
+      operand->Max = builder.CreateZExt(operand->MayBeTrue, builder.getInt64Ty());
+    }
+  }
+
+  auto less = [&] (Value* a, Value* b) {
+    switch (operandType) {
+      case EValueType::Double:
+        return builder.CreateFCmpOLT(a, b);
+      case EValueType::Int64:
+        return builder.CreateICmpSLT(a, b);
+      default:
+        return builder.CreateICmpULT(a, b);
+    }
+  };
+  auto lessOrEqual = [&] (Value* a, Value* b) {
+    switch (operandType) {
+      case EValueType::Double:
+        return builder.CreateFCmpOLE(a, b);
+      case EValueType::Int64:
+        return builder.CreateICmpSLE(a, b);
+      default:
+        return builder.CreateICmpULE(a, b);
+    }
+  };
+  auto equal = [&] (Value* a, Value* b) {
+    return operandType == EValueType::Double
+      ? builder.CreateFCmpOEQ(a, b)
+      : builder.CreateICmpEQ(a, b);
+  };
+
+  Value* mayBeTrue;
+  Value* mayBeFalse;
+  switch (binaryOp->Opcode) {
+    case EBinaryOp::Less:
+      mayBeTrue = less(lhs.Min, rhs.Max);
+      mayBeFalse = lessOrEqual(rhs.Min, lhs.Max);
+      break;
+    case EBinaryOp::LessOrEqual:
+      mayBeTrue = lessOrEqual(lhs.Min, rhs.Max);
+      mayBeFalse = less(rhs.Min, lhs.Max);
+      break;
+    case EBinaryOp::Greater:
+      mayBeTrue = less(rhs.Min, lhs.Max);
+      mayBeFalse = lessOrEqual(lhs.Min, rhs.Max);
+      break;
+    case EBinaryOp::GreaterOrEqual:
+      mayBeTrue = lessOrEqual(rhs.Min, lhs.Max);
+      mayBeFalse = less(lhs.Min, rhs.Max);
+      break;
+    default: {
+      // Ranges overlap / both are the same single value.
+      Value* overlap = builder.CreateAnd(
+        lessOrEqual(lhs.Min, rhs.Max),
+        lessOrEqual(rhs.Min, lhs.Max));
+      Value* sameConstant = builder.CreateAnd(
+        builder.CreateAnd(equal(lhs.Min, lhs.Max), equal(rhs.Min, rhs.Max)),
+        equal(lhs.Min, rhs.Min));
+      mayBeTrue = overlap;
+      mayBeFalse = builder.CreateNot(sameConstant);
+      if (binaryOp->Opcode == EBinaryOp::NotEqual) {
+        std::swap(mayBeTrue, mayBeFalse);
+      }
+      break;
+    }
+  }
+
+  Value* unknown = builder.CreateNot(builder.CreateAnd(lhs.Known, rhs.Known));
+  range.MayBeTrue = builder.CreateOr(unknown, mayBeTrue);
+  range.MayBeFalse = builder.CreateOr(unknown, mayBeFalse);
+  return range;
+}
+
+LLVMCodegen::TValueRange LLVMCodegen::GenerateArithmeticRange(
+  EBinaryOp opcode,
+  EValueType type,
+  const TValueRange& lhs,
+  const TValueRange& rhs,
+  IRBuilder<>& builder)
+{
+  TValueRange range = lhs;
+  range.Known = builder.CreateAnd(lhs.Known, rhs.Known);
+
+  if (type == EValueType::Double) {
+    // Infinite bounds may give NaN (inf - inf, 0 * inf), which bounds
+    // nothing.
+    auto isNumber = [&] (Value* value) {
+      return builder.CreateFCmpORD(value, value);
+    };
+    if (opcode == EBinaryOp::Multiply) {
+      Value* products[] = {
+        builder.CreateFMul(lhs.Min, rhs.Min),
+        builder.CreateFMul(lhs.Min, rhs.Max),
+        builder.CreateFMul(lhs.Max, rhs.Min),
+        builder.CreateFMul(lhs.Max, rhs.Max)
+      };
+      range.Min = range.Max = products[0];
+      for (Value* product : products) {
+        range.Known = builder.CreateAnd(range.Known, isNumber(product));
+        range.Min = builder.CreateSelect(builder.CreateFCmpOLT(product, range.Min), product, range.Min);
+        range.Max = builder.CreateSelect(builder.CreateFCmpOGT(product, range.Max), product, range.Max);
+      }
+      return range;
+    }
+    if (opcode == EBinaryOp::Plus) {
+      range.Min = builder.CreateFAdd(lhs.Min, rhs.Min);
+      range.Max = builder.CreateFAdd(lhs.Max, rhs.Max);
+    } else {
+      range.Min = builder.CreateFSub(lhs.Min, rhs.Max);
+      range.Max = builder.CreateFSub(lhs.Max, rhs.Min);
+    }
+    range.Known = builder.CreateAnd(
+      range.Known,
+      builder.CreateAnd(isNumber(range.Min), isNumber(range.Max)));
+    return range;
+  }
+
+  // Integer bounds are computed with overflow checks: rows wrap around
+  // where the bounds would not.
+  bool isSigned = type == EValueType::Int64;
+  Intrinsic::ID intrinsic;
+  switch (opcode) {
+    case EBinaryOp::Plus:
+      intrinsic = isSigned ? Intrinsic::sadd_with_overflow : Intrinsic::uadd_with_overflow;
+      break;
+    case EBinaryOp::Minus:
+      intrinsic = isSigned ? Intrinsic::ssub_with_overflow : Intrinsic::usub_with_overflow;
+      break;
+    default:
+      intrinsic = isSigned ? Intrinsic::smul_with_overflow : Intrinsic::umul_with_overflow;
+      break;
+  }
+  Function* withOverflow = Intrinsic::getDeclaration(
+    ExpressionModule,
+    intrinsic,
+    ArrayRef<Type*>(builder.getInt64Ty()));
+  auto apply = [&] (Value* a, Value* b) {
+    Value* result = builder.CreateCall2(withOverflow, a, b);
+    range.Known = builder.CreateAnd(
+      range.Known,
+      builder.CreateNot(builder.CreateExtractValue(result, 1)));
+    return builder.CreateExtractValue(result, 0);
+  };
+
+  if (opcode == EBinaryOp::Plus) {
+    range.Min = apply(lhs.Min, rhs.Min);
+    range.Max = apply(lhs.Max, rhs.Max);
+  } else if (opcode == EBinaryOp::Minus) {
+    range.Min = apply(lhs.Min, rhs.Max);
+    range.Max = apply(lhs.Max, rhs.Min);
+  } else if (!isSigned) {
+    range.Min = apply(lhs.Min, rhs.Min);
+    range.Max = apply(lhs.Max, rhs.Max);
+  } else {
+    Value* products[] = {
+      apply(lhs.Min, rhs.Min),
+      apply(lhs.Min, rhs.Max),
+      apply(lhs.Max, rhs.Min),
+      apply(lhs.Max, rhs.Max)
+    };
+    range.Min = range.Max = products[0];
+    for (Value* product : products) {
+      range.Min = builder.CreateSelect(builder.CreateICmpSLT(product, range.Min), product, range.Min);
+      range.Max = builder.CreateSelect(builder.CreateICmpSGT(product, range.Max), product, range.Max);
+    }
+  }
+  return range;
+}
+
+// Returns branch weights for a condition that is true with the given
+// probability.
+MDNode* LLVMCodegen::GetBranchWeights(double probability)
+{
+  const double scale = 1 << 20;
+  ui32 trueWeight = std::max<ui32>(1, probability * scale);
+  ui32 falseWeight = std::max<ui32>(1, (1 - probability) * scale);
+  return MDBuilder(getGlobalContext()).createBranchWeights(trueWeight, falseWeight);
+}
+
+void LLVMCodegen::EmitCounterUpdate(
+  IRBuilder<>& builder,
+  int id,
+  EValueType type,
+  Value* result)
+{
+  // counters[id].Rows++
+  Value* rowsPtr = builder.CreateConstInBoundsGEP1_32(Counters, 2 * id);
+  builder.CreateStore(
+    builder.CreateAdd(builder.CreateLoad(rowsPtr), builder.getInt64(1)),
+    rowsPtr);
+
+  // counters[id].True += result
+  if (type == EValueType::Boolean) {
+    Value* truePtr = builder.CreateConstInBoundsGEP1_32(Counters, 2 * id + 1);
+    builder.CreateStore(
+      builder.CreateAdd(
+        builder.CreateLoad(truePtr),
+        builder.CreateZExt(result, builder.getInt64Ty())),
+      truePtr);
+  }
+}
+
+Value* LLVMCodegen::GetProfileCounters(IRBuilder<>& builder)
+{
+  return builder.CreateIntToPtr(
+    builder.getInt64(reinterpret_cast<ui64>(Profile->GetCountersData())),
+    builder.getInt64Ty()->getPointerTo());
+}
+
 Value* LLVMCodegen::GetLLVMFunction(const FunctionSignature* signature, Module* module)
 {
   return module->getOrInsertFunction(
-    signature->Name,
+    signature->SymbolName,
     getLLVMType(signature));
 }
+
+Value* LLVMCodegen::GetRowValues(IRBuilder<>& builder, Value* row)
+{
+  // TValue* values = (TValue*)(row + 1)
+  Type* tvaluePtrTp = TypeBuilder<TValue*, true>::get(builder.getContext());
+  Value* rowIncPtr = builder.CreateConstInBoundsGEP1_32(row, 1);
+  return builder.CreatePointerCast(rowIncPtr, tvaluePtrTp, "values");
+}
+
+// Data is stored as i64 in the LLVM type of TValue, so pointers to it are
+// cast to the type actually held by the union.
+static Type* getValueDataType(EValueType type)
+{
+  LLVMContext& context = getGlobalContext();
+  switch (type) {
+    case EValueType::Double:
+      return Type::getDoubleTy(context);
+    case EValueType::Boolean:
+      return Type::getInt8Ty(context);
+    default:
+      return Type::getInt64Ty(context);
+  }
+}
+
+Value* LLVMCodegen::LoadValueData(
+  IRBuilder<>& builder,
+  Value* values,
+  int index,
+  EValueType type)
+{
+  // values[index].Data
+  Value* dataPtr = builder.CreateConstInBoundsGEP2_32(values, index, 3);
+  dataPtr = builder.CreatePointerCast(
+    dataPtr,
+    PointerType::getUnqual(getValueDataType(type)));
+  Value* data = builder.CreateLoad(dataPtr);
+  if (type == EValueType::Boolean) {
+    return builder.CreateICmpNE(data, builder.getInt8(0));
+  }
+  return data;
+}
+
+void LLVMCodegen::StoreValueData(
+  IRBuilder<>& builder,
+  Value* data,
+  Value* values,
+  int index,
+  EValueType type)
+{
+  // values[index].Data = data
+  Value* dataPtr = builder.CreateConstInBoundsGEP2_32(values, index, 3);
+  dataPtr = builder.CreatePointerCast(
+    dataPtr,
+    PointerType::getUnqual(getValueDataType(type)));
+  if (type == EValueType::Boolean) {
+    data = builder.CreateZExt(data, builder.getInt8Ty());
+  }
+  builder.CreateStore(data, dataPtr);
+}
+
+void LLVMCodegen::StoreValueHeader(
+  IRBuilder<>& builder,
+  Value* values,
+  int index,
+  int id,
+  EValueType type)
+{
+  // values[index].Id = id; values[index].Type = type; values[index].Length = 0
+  // The LLVM type of TValue does not match the C++ layout of these fields,
+  // so they are addressed by byte offset.
+  Value* valuePtr = builder.CreatePointerCast(
+    builder.CreateConstInBoundsGEP1_32(values, index),
+    builder.getInt8PtrTy());
+  builder.CreateStore(
+    builder.getInt8(id),
+    builder.CreateConstInBoundsGEP1_32(valuePtr, offsetof(TValue, Id)));
+  builder.CreateStore(
+    builder.getInt8(type),
+    builder.CreateConstInBoundsGEP1_32(valuePtr, offsetof(TValue, Type)));
+  builder.CreateStore(
+    builder.getInt32(0),
+    builder.CreatePointerCast(
+      builder.CreateConstInBoundsGEP1_32(valuePtr, offsetof(TValue, Length)),
+      builder.getInt32Ty()->getPointerTo()));
+}
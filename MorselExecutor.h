@@ -0,0 +1,316 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Pipeline.h"
+
+// Morsel-driven parallel evaluation: an input of rows is split into
+// morsels of a few thousand rows, small enough for the rows and the output
+// they produce to stay in cache while a compiled function runs over them,
+// and the morsels are run by a pool of worker threads. Each worker starts on
+// a contiguous share of the morsels and, once it runs out, steals morsels
+// from the end of the shares of the others, so that a slow or descheduled
+// worker does not hold up the whole input.
+
+struct TMorsel {
+  // Position of the morsel in the input, for putting results back in order.
+  i64 Index;
+  i64 Begin;
+  i64 End;
+};
+
+// Morsels are sized so that their rows and outputs take about this much.
+const i64 MorselBytes = 256 * 1024;
+const i64 MinMorselRows = 256;
+
+i64 getMorselRows(i64 bytesPerRow)
+{
+  return std::max(MinMorselRows, MorselBytes / std::max<i64>(1, bytesPerRow));
+}
+
+class TMorselExecutor {
+public:
+  typedef std::function<void(int worker, const TMorsel& morsel)> TTask;
+
+  explicit TMorselExecutor(int threadCount);
+  ~TMorselExecutor();
+
+  TMorselExecutor(const TMorselExecutor&) = delete;
+  void operator=(const TMorselExecutor&) = delete;
+
+  int GetThreadCount() const
+  {
+    return Workers.size();
+  }
+
+  // Runs task over [0, count) split into morsels of morselRows rows and
+  // returns once all of them are done. Workers are numbered from 0 to
+  // GetThreadCount() - 1, and a worker runs one morsel at a time, so tasks
+  // may keep per-worker state without locking. Only one Run may be in
+  // progress at a time.
+  void Run(i64 count, i64 morselRows, TTask task);
+
+  // Morsels run by another worker than the one they were assigned to, over
+  // all runs so far.
+  i64 GetStolenMorsels() const
+  {
+    return StolenMorsels;
+  }
+
+private:
+  struct TWorkerQueue {
+    std::mutex Mutex;
+    std::deque<TMorsel> Morsels;
+  };
+
+  std::vector<std::thread> Workers;
+  std::vector<TWorkerQueue> Queues;
+
+  std::mutex Mutex;
+  std::condition_variable RunStarted;
+  std::condition_variable RunFinished;
+  // Incremented by every Run, so that workers tell a new run from a spurious
+  // wakeup.
+  ui64 Generation;
+  int BusyWorkers;
+  bool Stopping;
+  TTask Task;
+  i64 StolenMorsels;
+
+  void WorkerMain(int worker);
+  bool PopMorsel(int worker, TMorsel* morsel);
+};
+
+TMorselExecutor::TMorselExecutor(int threadCount)
+  : Queues(std::max(1, threadCount))
+  , Generation(0)
+  , BusyWorkers(0)
+  , Stopping(false)
+  , StolenMorsels(0)
+{
+  for (size_t worker = 0; worker < Queues.size(); worker++) {
+    Workers.push_back(std::thread([this, worker] () {
+      WorkerMain(worker);
+    }));
+  }
+}
+
+TMorselExecutor::~TMorselExecutor()
+{
+  {
+    std::lock_guard<std::mutex> guard(Mutex);
+    Stopping = true;
+  }
+  RunStarted.notify_all();
+  for (auto& worker : Workers) {
+    worker.join();
+  }
+}
+
+void TMorselExecutor::Run(i64 count, i64 morselRows, TTask task)
+{
+  morselRows = std::max<i64>(1, morselRows);
+  i64 morselCount = (count + morselRows - 1) / morselRows;
+  if (morselCount == 0) {
+    return;
+  }
+
+  // Worker w gets morsels [w * share, (w + 1) * share).
+  int threadCount = Queues.size();
+  i64 share = (morselCount + threadCount - 1) / threadCount;
+  for (int worker = 0; worker < threadCount; worker++) {
+    std::lock_guard<std::mutex> guard(Queues[worker].Mutex);
+    for (i64 index = worker * share; index < std::min(morselCount, (worker + 1) * share); index++) {
+      TMorsel morsel;
+      morsel.Index = index;
+      morsel.Begin = index * morselRows;
+      morsel.End = std::min(count, morsel.Begin + morselRows);
+      Queues[worker].Morsels.push_back(morsel);
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(Mutex);
+  Task = task;
+  BusyWorkers = threadCount;
+  Generation++;
+  RunStarted.notify_all();
+  RunFinished.wait(lock, [this] () {
+    return BusyWorkers == 0;
+  });
+  Task = TTask();
+}
+
+bool TMorselExecutor::PopMorsel(int worker, TMorsel* morsel)
+{
+  {
+    TWorkerQueue& own = Queues[worker];
+    std::lock_guard<std::mutex> guard(own.Mutex);
+    if (!own.Morsels.empty()) {
+      *morsel = own.Morsels.front();
+      own.Morsels.pop_front();
+      return true;
+    }
+  }
+
+  // Steal from the back of the other queues, away from where their owners
+  // are working.
+  int threadCount = Queues.size();
+  for (int offset = 1; offset < threadCount; offset++) {
+    TWorkerQueue& victim = Queues[(worker + offset) % threadCount];
+    std::lock_guard<std::mutex> guard(victim.Mutex);
+    if (!victim.Morsels.empty()) {
+      *morsel = victim.Morsels.back();
+      victim.Morsels.pop_back();
+      std::lock_guard<std::mutex> statisticsGuard(Mutex);
+      StolenMorsels++;
+      return true;
+    }
+  }
+  return false;
+}
+
+void TMorselExecutor::WorkerMain(int worker)
+{
+  ui64 seenGeneration = 0;
+  while (true) {
+    TTask task;
+    {
+      std::unique_lock<std::mutex> lock(Mutex);
+      RunStarted.wait(lock, [&] () {
+        return Stopping || Generation != seenGeneration;
+      });
+      if (Stopping) {
+        return;
+      }
+      seenGeneration = Generation;
+      task = Task;
+    }
+
+    // Morsels are only added before a run starts, so once none is left
+    // anywhere, none will be.
+    TMorsel morsel;
+    while (PopMorsel(worker, &morsel)) {
+      task(worker, morsel);
+    }
+
+    std::lock_guard<std::mutex> guard(Mutex);
+    if (--BusyWorkers == 0) {
+      RunFinished.notify_one();
+    }
+  }
+}
+
+/* Compiled functions over morsels */
+
+// Evaluates a batch function over count rows. results[i] is the result of
+// rows[i], so results are in order whatever runs where.
+void evaluateInParallel(
+  TMorselExecutor* executor,
+  TBatchFunction function,
+  TRow* rows,
+  TValue* results,
+  i64 count,
+  i64 morselRows = 0)
+{
+  if (morselRows <= 0) {
+    i64 rowBytes = count > 0
+      ? sizeof(TRowHeader) + rows[0]->Count * sizeof(TValue)
+      : 0;
+    morselRows = getMorselRows(rowBytes + sizeof(TValue));
+  }
+  executor->Run(count, morselRows, [=] (int, const TMorsel& morsel) {
+    function(rows + morsel.Begin, results + morsel.Begin, morsel.End - morsel.Begin);
+  });
+}
+
+// Runs a pipeline function over count rows. Each worker writes the
+// projections of the rows that pass into a buffer of its own and updates
+// aggregate states of its own, which are merged at the end. With ordered,
+// output holds the projections in the order of the rows they come from;
+// otherwise in whatever order the morsels ran. aggregateStates receives the
+// merged states, ready for finalizeAggregateStates. Returns the number of
+// rows that passed.
+i64 runPipelineInParallel(
+  TMorselExecutor* executor,
+  TPipelineFunction function,
+  const TPipeline& pipeline,
+  TRow* rows,
+  i64 count,
+  bool ordered,
+  std::vector<TValue>* output,
+  std::vector<ui64>* aggregateStates,
+  i64 morselRows = 0)
+{
+  int projectionCount = pipeline.Projections.size();
+  int stateSlots = getAggregateStateSlots(pipeline.Aggregates);
+  if (morselRows <= 0) {
+    i64 rowBytes = count > 0
+      ? sizeof(TRowHeader) + rows[0]->Count * sizeof(TValue)
+      : 0;
+    morselRows = getMorselRows(rowBytes + projectionCount * sizeof(TValue));
+  }
+
+  // Where the output of a morsel went.
+  struct TMorselOutput {
+    i64 Index;
+    int Worker;
+    i64 Offset;
+    i64 Rows;
+  };
+
+  struct TWorkerOutput {
+    std::vector<TValue> Values;
+    std::vector<ui64> States;
+    std::vector<TMorselOutput> Morsels;
+  };
+
+  int threadCount = executor->GetThreadCount();
+  std::vector<TWorkerOutput> outputs(threadCount);
+  for (auto& workerOutput : outputs) {
+    workerOutput.States.resize(stateSlots);
+    initAggregateStates(pipeline.Aggregates, workerOutput.States.data());
+  }
+
+  executor->Run(count, morselRows, [&] (int worker, const TMorsel& morsel) {
+    TWorkerOutput& workerOutput = outputs[worker];
+    i64 offset = workerOutput.Values.size();
+    i64 rowCount = morsel.End - morsel.Begin;
+    workerOutput.Values.resize(offset + rowCount * projectionCount);
+    i64 passed = function(
+      rows + morsel.Begin,
+      rowCount,
+      workerOutput.Values.data() + offset,
+      workerOutput.States.data());
+    workerOutput.Values.resize(offset + passed * projectionCount);
+    workerOutput.Morsels.push_back({ morsel.Index, worker, offset, passed });
+  });
+
+  std::vector<TMorselOutput> morsels;
+  for (auto& workerOutput : outputs) {
+    morsels.insert(morsels.end(), workerOutput.Morsels.begin(), workerOutput.Morsels.end());
+  }
+  if (ordered) {
+    std::sort(morsels.begin(), morsels.end(), [] (const TMorselOutput& lhs, const TMorselOutput& rhs) {
+      return lhs.Index < rhs.Index;
+    });
+  }
+
+  i64 passed = 0;
+  output->clear();
+  for (auto morsel = morsels.begin(); morsel != morsels.end(); morsel++) {
+    const TValue* values = outputs[morsel->Worker].Values.data() + morsel->Offset;
+    output->insert(output->end(), values, values + morsel->Rows * projectionCount);
+    passed += morsel->Rows;
+  }
+
+  aggregateStates->assign(stateSlots, 0);
+  initAggregateStates(pipeline.Aggregates, aggregateStates->data());
+  for (auto& workerOutput : outputs) {
+    mergeAggregateStates(pipeline.Aggregates, aggregateStates->data(), workerOutput.States.data());
+  }
+  return passed;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include "YTTypes.h"
+
+// Hand-written C++ equivalents of generated functions, used as the
+// reference point when measuring generated code.
+
+void func(TRow row, TValue* result)
+{
+  TValue* values = (TValue*)(row + 1);
+  result->Data.Int64 = values[0].Data.Int64 + values[1].Data.Int64;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+using namespace llvm;
+
+// Runs the -O2 function and module pipelines over module, using the data
+// layout of the target it is going to be compiled for.
+void optimize(Module* module, const DataLayout* dataLayout) {
+  PassManagerBuilder passManagerBuilder;
+  passManagerBuilder.OptLevel = 2;
+  passManagerBuilder.SizeLevel = 0;
+  passManagerBuilder.Inliner = createFunctionInliningPass();
+
+  FunctionPassManager* functionPassManager = new legacy::FunctionPassManager(module);
+  PassManager* modulePassManager = new PassManager();
+
+  module->setDataLayout(dataLayout->getStringRepresentation());
+  functionPassManager->add(new DataLayoutPass(module));
+  passManagerBuilder.populateFunctionPassManager(*functionPassManager);
+
+  functionPassManager->doInitialization();
+  for (auto it = module->begin(), jt = module->end(); it != jt; ++it) {
+      if (!it->isDeclaration()) {
+          functionPassManager->run(*it);
+      }
+  }
+  functionPassManager->doFinalization();
+
+  modulePassManager->add(new DataLayoutPass(module));
+  passManagerBuilder.populateModulePassManager(*modulePassManager);
+
+  modulePassManager->run(*module);
+
+  delete functionPassManager;
+  delete modulePassManager;
+}
+
+void optimize(Module* module, ExecutionEngine* engine) {
+  optimize(module, engine->getDataLayout());
+}
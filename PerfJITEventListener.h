@@ -0,0 +1,259 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/ObjectImage.h"
+#include "llvm/Object/ObjectFile.h"
+#include "YTTypes.h"
+#ifdef __linux__
+#include <elf.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+using namespace llvm;
+using namespace object;
+
+// Makes generated code visible to perf. Every function MCJIT emits is
+// written to /tmp/perf-<pid>.map, which perf reads to symbolize samples in
+// anonymous memory, and optionally to a jitdump file, from which
+// "perf inject --jit" recovers the code itself for annotation.
+//
+// Enabled by the YT_JIT_PERF environment variable: "map" writes the map
+// only, "jitdump" writes both. The jitdump file goes to the directory in
+// YT_JIT_PERF_DIR, /tmp by default; record with "perf record -k 1" so
+// that its timestamps line up with perf's.
+
+// Label of the code being finalized on this thread, appended to the names
+// of its functions, e.g. "expr_batch[slow-query]".
+thread_local const char* perfLabel = NULL;
+
+class TPerfLabelScope {
+public:
+  explicit TPerfLabelScope(const char* label)
+    : Previous(perfLabel)
+  {
+    perfLabel = label;
+  }
+
+  ~TPerfLabelScope()
+  {
+    perfLabel = Previous;
+  }
+
+private:
+  const char* Previous;
+};
+
+#ifdef __linux__
+
+class TPerfJITEventListener : public JITEventListener {
+public:
+  TPerfJITEventListener(bool jitDump, const char* jitDumpDirectory);
+  virtual ~TPerfJITEventListener();
+
+  virtual void NotifyObjectEmitted(const ObjectImage& object);
+
+private:
+  // Layouts from tools/perf/Documentation/jitdump-specification.txt.
+  struct TJitDumpHeader {
+    ui32 Magic;
+    ui32 Version;
+    ui32 TotalSize;
+    ui32 ElfMachine;
+    ui32 Padding;
+    ui32 Pid;
+    ui64 Timestamp;
+    ui64 Flags;
+  };
+
+  struct TJitDumpCodeLoad {
+    ui32 Id;
+    ui32 TotalSize;
+    ui64 Timestamp;
+    ui32 Pid;
+    ui32 Tid;
+    ui64 Vma;
+    ui64 CodeAddress;
+    ui64 CodeSize;
+    ui64 CodeIndex;
+    // Followed by the NUL-terminated name and the code bytes.
+  };
+
+  static const ui32 JitDumpMagic = 0x4A695444;
+  static const ui32 JitCodeLoad = 0;
+
+  std::mutex Lock;
+  FILE* PerfMap;
+  FILE* JitDump;
+  void* JitDumpMarker;
+  ui64 CodeIndex;
+
+  void WriteFunction(const std::string& name, ui64 address, ui64 size);
+
+  static ui64 getTimestamp()
+  {
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000ULL + time.tv_nsec;
+  }
+};
+
+TPerfJITEventListener::TPerfJITEventListener(bool jitDump, const char* jitDumpDirectory)
+  : PerfMap(NULL)
+  , JitDump(NULL)
+  , JitDumpMarker(NULL)
+  , CodeIndex(0)
+{
+  char path[256];
+  snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+  PerfMap = fopen(path, "a");
+
+  if (!jitDump) {
+    return;
+  }
+
+  snprintf(path, sizeof(path), "%s/jit-%d.dump", jitDumpDirectory, getpid());
+  JitDump = fopen(path, "w+");
+  if (!JitDump) {
+    return;
+  }
+
+  // perf only picks up the dump if the process maps it executable.
+  JitDumpMarker = mmap(
+    NULL,
+    sysconf(_SC_PAGESIZE),
+    PROT_READ | PROT_EXEC,
+    MAP_PRIVATE,
+    fileno(JitDump),
+    0);
+  if (JitDumpMarker == MAP_FAILED) {
+    JitDumpMarker = NULL;
+  }
+
+  TJitDumpHeader header;
+  memset(&header, 0, sizeof(header));
+  header.Magic = JitDumpMagic;
+  header.Version = 1;
+  header.TotalSize = sizeof(header);
+#if defined(__x86_64__)
+  header.ElfMachine = EM_X86_64;
+#elif defined(__aarch64__)
+  header.ElfMachine = EM_AARCH64;
+#endif
+  header.Pid = getpid();
+  header.Timestamp = getTimestamp();
+  fwrite(&header, sizeof(header), 1, JitDump);
+  fflush(JitDump);
+}
+
+TPerfJITEventListener::~TPerfJITEventListener()
+{
+  if (JitDumpMarker) {
+    munmap(JitDumpMarker, sysconf(_SC_PAGESIZE));
+  }
+  if (JitDump) {
+    fclose(JitDump);
+  }
+  if (PerfMap) {
+    fclose(PerfMap);
+  }
+}
+
+void TPerfJITEventListener::NotifyObjectEmitted(const ObjectImage& object)
+{
+  for (symbol_iterator symbol = object.begin_symbols(), end = object.end_symbols();
+       symbol != end;
+       ++symbol) {
+    SymbolRef::Type type;
+    if (symbol->getType(type) || type != SymbolRef::ST_Function) {
+      continue;
+    }
+    StringRef name;
+    uint64_t address;
+    uint64_t size;
+    if (symbol->getName(name)
+        || symbol->getAddress(address)
+        || symbol->getSize(size)
+        || !size) {
+      continue;
+    }
+
+    std::string fullName = name.str();
+    if (perfLabel) {
+      fullName += std::string("[") + perfLabel + "]";
+    }
+    WriteFunction(fullName, address, size);
+  }
+}
+
+void TPerfJITEventListener::WriteFunction(
+  const std::string& name,
+  ui64 address,
+  ui64 size)
+{
+  std::lock_guard<std::mutex> guard(Lock);
+
+  if (PerfMap) {
+    fprintf(PerfMap, "%llx %llx %s\n",
+      (unsigned long long)address,
+      (unsigned long long)size,
+      name.c_str());
+    fflush(PerfMap);
+  }
+
+  if (JitDump) {
+    TJitDumpCodeLoad record;
+    memset(&record, 0, sizeof(record));
+    record.Id = JitCodeLoad;
+    record.TotalSize = sizeof(record) + name.size() + 1 + size;
+    record.Timestamp = getTimestamp();
+    record.Pid = getpid();
+    record.Tid = syscall(SYS_gettid);
+    record.Vma = address;
+    record.CodeAddress = address;
+    record.CodeSize = size;
+    record.CodeIndex = CodeIndex++;
+    fwrite(&record, sizeof(record), 1, JitDump);
+    fwrite(name.c_str(), name.size() + 1, 1, JitDump);
+    fwrite(reinterpret_cast<const void*>(address), size, 1, JitDump);
+    fflush(JitDump);
+  }
+}
+
+// Returns the process-wide listener, or NULL when YT_JIT_PERF is not set.
+JITEventListener* getPerfJITEventListener()
+{
+  static TPerfJITEventListener* listener = [] () -> TPerfJITEventListener* {
+    const char* mode = getenv("YT_JIT_PERF");
+    if (!mode || !*mode) {
+      return NULL;
+    }
+    const char* directory = getenv("YT_JIT_PERF_DIR");
+    return new TPerfJITEventListener(
+      strcmp(mode, "jitdump") == 0,
+      directory ? directory : "/tmp");
+  }();
+  return listener;
+}
+
+#else
+
+JITEventListener* getPerfJITEventListener()
+{
+  return NULL;
+}
+
+#endif
+
+void registerPerfJITEventListener(ExecutionEngine* engine)
+{
+  if (JITEventListener* listener = getPerfJITEventListener()) {
+    engine->RegisterJITEventListener(listener);
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <vector>
+#include "Aggregates.h"
+
+// A scan fused into one loop over rows (see
+// LLVMCodegen::EmitPipelineFunction):
+//
+//   SELECT <projections>, <aggregates> FROM rows WHERE <predicate>
+//
+// Each row is read once. The predicate, the projections and the arguments
+// of the aggregates are computed in registers. Only the projected values of
+// the rows that pass are written out, and aggregate states are stored once
+// per call.
+struct TPipeline {
+  // NULL to keep every row.
+  TConstExpressionPtr Predicate = NULL;
+  std::vector<TConstExpressionPtr> Projections;
+  std::vector<TAggregate> Aggregates;
+};
+
+// Processes count rows. Writes the projections of the k-th row that passes
+// the predicate to output[k * projectionCount + j] and updates the
+// aggregate states (see Aggregates.h), which carry over between calls.
+// Returns the number of rows that passed.
+typedef i64 (*TPipelineFunction)(TRow* rows, i64 count, TValue* output, ui64* aggregateStates);
+
+// Returns false if some expression of the pipeline does not type check or
+// the predicate is not boolean.
+bool isValidPipeline(const TPipeline& pipeline)
+{
+  if (pipeline.Predicate && typeOf(pipeline.Predicate) != EValueType::Boolean) {
+    return false;
+  }
+  for (auto projection = pipeline.Projections.begin();
+       projection != pipeline.Projections.end();
+       projection++) {
+    if (typeOf(*projection) == EValueType::Null) {
+      return false;
+    }
+  }
+  for (auto aggregate = pipeline.Aggregates.begin();
+       aggregate != pipeline.Aggregates.end();
+       aggregate++) {
+    if (getAggregateType(*aggregate) == EValueType::Null) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,542 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "YTTypes.h"
+#include "ZoneMaps.h"
+
+// Row files store rows in blocks laid out exactly as rows are in memory, so
+// that compiled expressions run over the mapped pages of the file:
+//
+//   file header | block | ... | block | block index
+//   block: block header | column statistics | rows | string heap
+//
+// A row is a TRowHeader followed by its TValues. On disk the Data.String of
+// a string value is the offset of its bytes in the heap of its block, which
+// readers turn into a pointer. Headers, blocks, and the rows and heap of
+// each block start on RowFileAlignment boundaries, and rows are padded so
+// that their values start on RowFileValueAlignment boundaries and can be
+// read with aligned vector loads. The block index at the end holds the
+// offset of every block. The statistics of a block (see ZoneMaps.h) let
+// scans skip it without touching its rows.
+//
+// Files are in host byte order and only readable by builds with the same
+// layout of TValue and TRowHeader, which the header records.
+
+const ui32 RowFileMagic = 0x57525459; // "YTRW"
+const ui32 RowFileVersion = 2;
+const size_t RowFileAlignment = 64;
+const size_t RowFileValueAlignment = 16;
+const size_t DefaultRowsPerBlock = 4096;
+
+struct TRowFileHeader {
+  ui32 Magic;
+  ui32 Version;
+  ui32 ValueSize;
+  ui32 RowHeaderSize;
+  ui64 BlockCount;
+  ui64 RowCount;
+  ui64 IndexOffset;
+  ui64 Reserved[3];
+};
+
+enum ERowFileBlockFlags {
+  // Some value of the block is a string.
+  RowFileBlockHasStrings = 1
+};
+
+struct TRowFileBlockHeader {
+  ui64 RowCount;
+  // Index of the first row of the block in the file.
+  ui64 FirstRow;
+  // Offsets are from the start of the block header.
+  ui64 RowsOffset;
+  ui64 RowsSize;
+  ui64 HeapOffset;
+  ui64 HeapSize;
+  ui32 Flags;
+  // Number of TColumnStatistics at StatisticsOffset, one per column of the
+  // longest row.
+  ui32 ColumnCount;
+  ui64 StatisticsOffset;
+};
+
+static_assert(sizeof(TRowFileHeader) == RowFileAlignment, "row file header must fill an aligned slot");
+static_assert(sizeof(TRowFileBlockHeader) == RowFileAlignment, "block header must fill an aligned slot");
+
+static size_t alignRowFileOffset(size_t offset)
+{
+  return (offset + RowFileAlignment - 1) & ~(RowFileAlignment - 1);
+}
+
+// Where a row at offset or after it starts, for its values to be aligned.
+// Offsets are from an aligned base.
+static size_t alignRowOffset(size_t offset)
+{
+  size_t valuesOffset = offset + sizeof(TRowHeader);
+  size_t aligned = (valuesOffset + RowFileValueAlignment - 1) & ~(RowFileValueAlignment - 1);
+  return aligned - sizeof(TRowHeader);
+}
+
+/* Writing */
+
+class TRowFileWriter {
+public:
+  // Returns NULL and describes the problem in error if path cannot be
+  // created.
+  static TRowFileWriter* Create(
+    const std::string& path,
+    std::string* error,
+    size_t rowsPerBlock = DefaultRowsPerBlock);
+
+  ~TRowFileWriter()
+  {
+    if (File) {
+      fclose(File);
+    }
+  }
+
+  // Appends a row of count values. String values are copied into the heap
+  // of the current block.
+  bool AddRow(const TValue* values, int count, std::string* error);
+
+  bool AddRow(TRow row, std::string* error)
+  {
+    return AddRow(reinterpret_cast<const TValue*>(row + 1), row->Count, error);
+  }
+
+  // Writes the last block and the block index. The file is not readable
+  // until then.
+  bool Close(std::string* error);
+
+private:
+  TRowFileWriter(FILE* file, const std::string& path, size_t rowsPerBlock)
+    : File(file)
+    , Path(path)
+    , RowsPerBlock(rowsPerBlock)
+    , BlockRowCount(0)
+    , BlockFlags(0)
+    , RowCount(0)
+    , Offset(0)
+  { }
+
+  TRowFileWriter(const TRowFileWriter&) = delete;
+  void operator=(const TRowFileWriter&) = delete;
+
+  FILE* File;
+  std::string Path;
+  size_t RowsPerBlock;
+  std::vector<char> Rows;
+  std::vector<char> Heap;
+  std::vector<TColumnStatistics> Statistics;
+  ui64 BlockRowCount;
+  ui32 BlockFlags;
+  std::vector<ui64> BlockOffsets;
+  ui64 RowCount;
+  ui64 Offset;
+
+  bool Write(const void* data, size_t size, std::string* error);
+  bool PadTo(size_t offset, std::string* error);
+  bool FlushBlock(std::string* error);
+};
+
+TRowFileWriter* TRowFileWriter::Create(
+  const std::string& path,
+  std::string* error,
+  size_t rowsPerBlock)
+{
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) {
+    *error = path + ": " + strerror(errno);
+    return NULL;
+  }
+
+  TRowFileWriter* writer = new TRowFileWriter(file, path, rowsPerBlock);
+  // Rewritten by Close.
+  TRowFileHeader header = {};
+  if (!writer->Write(&header, sizeof(header), error)) {
+    delete writer;
+    return NULL;
+  }
+  return writer;
+}
+
+bool TRowFileWriter::Write(const void* data, size_t size, std::string* error)
+{
+  if (fwrite(data, 1, size, File) != size) {
+    *error = Path + ": " + strerror(errno);
+    return false;
+  }
+  Offset += size;
+  return true;
+}
+
+bool TRowFileWriter::PadTo(size_t offset, std::string* error)
+{
+  static const char zeros[RowFileAlignment] = {};
+  return Write(zeros, offset - Offset, error);
+}
+
+bool TRowFileWriter::AddRow(const TValue* values, int count, std::string* error)
+{
+  // Rows start at RowsOffset, which is aligned.
+  Rows.resize(alignRowOffset(Rows.size()), 0);
+  TRowHeader rowHeader;
+  rowHeader.Count = count;
+  rowHeader.Padding = 0;
+  updateBlockStatistics(&Statistics, BlockRowCount, values, count);
+  const char* headerBytes = reinterpret_cast<const char*>(&rowHeader);
+  Rows.insert(Rows.end(), headerBytes, headerBytes + sizeof(rowHeader));
+
+  for (int i = 0; i < count; i++) {
+    TValue value = values[i];
+    if (value.Type == EValueType::String) {
+      size_t heapOffset = Heap.size();
+      Heap.insert(Heap.end(), value.Data.String, value.Data.String + value.Length);
+      // NUL-terminated for code that expects C strings.
+      Heap.push_back('\0');
+      value.Data.Uint64 = heapOffset;
+      BlockFlags |= RowFileBlockHasStrings;
+    }
+    const char* valueBytes = reinterpret_cast<const char*>(&value);
+    Rows.insert(Rows.end(), valueBytes, valueBytes + sizeof(value));
+  }
+
+  RowCount++;
+  if (++BlockRowCount == RowsPerBlock) {
+    return FlushBlock(error);
+  }
+  return true;
+}
+
+bool TRowFileWriter::FlushBlock(std::string* error)
+{
+  if (!BlockRowCount) {
+    return true;
+  }
+
+  TRowFileBlockHeader header = {};
+  header.RowCount = BlockRowCount;
+  header.FirstRow = RowCount - BlockRowCount;
+  header.ColumnCount = Statistics.size();
+  header.StatisticsOffset = sizeof(header);
+  header.RowsOffset = alignRowFileOffset(
+    header.StatisticsOffset + Statistics.size() * sizeof(TColumnStatistics));
+  header.RowsSize = Rows.size();
+  header.HeapOffset = alignRowFileOffset(header.RowsOffset + header.RowsSize);
+  header.HeapSize = Heap.size();
+  header.Flags = BlockFlags;
+
+  ui64 blockOffset = alignRowFileOffset(Offset);
+  if (!PadTo(blockOffset, error)
+      || !Write(&header, sizeof(header), error)
+      || !Write(Statistics.data(), Statistics.size() * sizeof(TColumnStatistics), error)
+      || !PadTo(blockOffset + header.RowsOffset, error)
+      || !Write(Rows.data(), Rows.size(), error)
+      || !PadTo(blockOffset + header.HeapOffset, error)
+      || !Write(Heap.data(), Heap.size(), error)) {
+    return false;
+  }
+  BlockOffsets.push_back(blockOffset);
+
+  Rows.clear();
+  Heap.clear();
+  Statistics.clear();
+  BlockRowCount = 0;
+  BlockFlags = 0;
+  return true;
+}
+
+bool TRowFileWriter::Close(std::string* error)
+{
+  if (!FlushBlock(error)) {
+    return false;
+  }
+
+  TRowFileHeader header = {};
+  header.Magic = RowFileMagic;
+  header.Version = RowFileVersion;
+  header.ValueSize = sizeof(TValue);
+  header.RowHeaderSize = sizeof(TRowHeader);
+  header.BlockCount = BlockOffsets.size();
+  header.RowCount = RowCount;
+  header.IndexOffset = alignRowFileOffset(Offset);
+  if (!PadTo(header.IndexOffset, error)
+      || !Write(BlockOffsets.data(), BlockOffsets.size() * sizeof(ui64), error)) {
+    return false;
+  }
+
+  bool written = fseek(File, 0, SEEK_SET) == 0
+    && fwrite(&header, 1, sizeof(header), File) == sizeof(header);
+  written = fclose(File) == 0 && written;
+  File = NULL;
+  if (!written) {
+    *error = Path + ": " + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+/* Reading */
+
+// A row file mapped into memory. Rows returned by ReadBlock point into the
+// mapping and are valid for the lifetime of the object.
+class TRowFileReader {
+public:
+  // Returns NULL and describes the problem in error if path cannot be
+  // mapped or is not a row file written with the layout of YTTypes.h.
+  static TRowFileReader* Open(const std::string& path, std::string* error);
+
+  ~TRowFileReader()
+  {
+    munmap(Data, Size);
+  }
+
+  ui64 GetBlockCount() const
+  {
+    return Header->BlockCount;
+  }
+
+  ui64 GetRowCount() const
+  {
+    return Header->RowCount;
+  }
+
+  const TRowFileBlockHeader* GetBlockHeader(ui64 index) const
+  {
+    return reinterpret_cast<const TRowFileBlockHeader*>(Data + BlockOffsets[index]);
+  }
+
+  // Returns NULL if the statistics of the index-th block are out of
+  // bounds.
+  const TColumnStatistics* GetBlockStatistics(ui64 index, ui64* columnCount) const;
+
+  // Sets rows to the rows of the index-th block, in place. The first time
+  // a block with strings is read, its string offsets are replaced with
+  // pointers; only pages holding string values are copied for that. Not
+  // safe to call concurrently for the same block.
+  bool ReadBlock(ui64 index, std::vector<TRow>* rows, std::string* error);
+
+  // Asks the kernel to start reading the index-th block in.
+  void Prefetch(ui64 index) const;
+
+private:
+  TRowFileReader(char* data, size_t size)
+    : Data(data)
+    , Size(size)
+    , Header(reinterpret_cast<const TRowFileHeader*>(data))
+    , BlockOffsets(NULL)
+  { }
+
+  TRowFileReader(const TRowFileReader&) = delete;
+  void operator=(const TRowFileReader&) = delete;
+
+  char* Data;
+  size_t Size;
+  const TRowFileHeader* Header;
+  const ui64* BlockOffsets;
+  std::vector<bool> Resolved;
+
+  bool Initialize(std::string* error);
+};
+
+TRowFileReader* TRowFileReader::Open(const std::string& path, std::string* error)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    *error = path + ": " + strerror(errno);
+    return NULL;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    *error = path + ": " + strerror(errno);
+    close(fd);
+    return NULL;
+  }
+  size_t size = info.st_size;
+  if (size < sizeof(TRowFileHeader)) {
+    *error = path + ": not a row file";
+    close(fd);
+    return NULL;
+  }
+
+  // Private and writable so that string offsets can be resolved in place;
+  // pages that are only read stay shared with the page cache.
+  void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    *error = path + ": " + strerror(errno);
+    return NULL;
+  }
+  // Scans read blocks in order: read ahead aggressively and drop pages
+  // behind.
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  TRowFileReader* reader = new TRowFileReader(static_cast<char*>(data), size);
+  if (!reader->Initialize(error)) {
+    *error = path + ": " + *error;
+    delete reader;
+    return NULL;
+  }
+  return reader;
+}
+
+bool TRowFileReader::Initialize(std::string* error)
+{
+  if (Header->Magic != RowFileMagic) {
+    *error = "not a row file";
+    return false;
+  }
+  if (Header->Version != RowFileVersion) {
+    *error = "row file version " + std::to_string(Header->Version)
+      + ", expected " + std::to_string(RowFileVersion);
+    return false;
+  }
+  if (Header->ValueSize != sizeof(TValue) || Header->RowHeaderSize != sizeof(TRowHeader)) {
+    *error = "written with a different layout of YTTypes.h";
+    return false;
+  }
+  if (Header->IndexOffset % sizeof(ui64) != 0
+      || Header->IndexOffset > Size
+      || Header->BlockCount > (Size - Header->IndexOffset) / sizeof(ui64)) {
+    *error = "block index out of bounds";
+    return false;
+  }
+
+  BlockOffsets = reinterpret_cast<const ui64*>(Data + Header->IndexOffset);
+  for (ui64 i = 0; i < Header->BlockCount; i++) {
+    ui64 offset = BlockOffsets[i];
+    if (offset % RowFileAlignment != 0
+        || offset > Header->IndexOffset
+        || Header->IndexOffset - offset < sizeof(TRowFileBlockHeader)) {
+      *error = "block " + std::to_string(i) + " out of bounds";
+      return false;
+    }
+  }
+  Resolved.assign(Header->BlockCount, false);
+  return true;
+}
+
+bool TRowFileReader::ReadBlock(ui64 index, std::vector<TRow>* rows, std::string* error)
+{
+  char* block = Data + BlockOffsets[index];
+  const TRowFileBlockHeader* header = GetBlockHeader(index);
+  size_t available = Size - BlockOffsets[index];
+  if (header->RowsOffset % RowFileAlignment != 0
+      || header->RowsOffset > available
+      || header->RowsSize > available - header->RowsOffset
+      || header->HeapOffset > available
+      || header->HeapSize > available - header->HeapOffset) {
+    *error = "block " + std::to_string(index) + " out of bounds";
+    return false;
+  }
+
+  // Rows are walked to find where each starts; their values are not
+  // copied.
+  rows->clear();
+  char* row = block + header->RowsOffset;
+  char* rowsEnd = row + header->RowsSize;
+  char* heap = block + header->HeapOffset;
+  bool resolve = (header->Flags & RowFileBlockHasStrings) && !Resolved[index];
+  for (ui64 i = 0; i < header->RowCount; i++) {
+    row = block + header->RowsOffset + alignRowOffset(row - block - header->RowsOffset);
+    TRow rowHeader = reinterpret_cast<TRow>(row);
+    if (row > rowsEnd
+        || static_cast<size_t>(rowsEnd - row) < sizeof(TRowHeader)
+        || rowHeader->Count < 0
+        || static_cast<size_t>(rowsEnd - row - sizeof(TRowHeader)) / sizeof(TValue)
+          < static_cast<size_t>(rowHeader->Count)) {
+      *error = "row " + std::to_string(header->FirstRow + i) + " out of bounds";
+      return false;
+    }
+    TValue* values = reinterpret_cast<TValue*>(rowHeader + 1);
+    if (resolve) {
+      for (int j = 0; j < rowHeader->Count; j++) {
+        if (values[j].Type == EValueType::String) {
+          if (values[j].Data.Uint64 >= header->HeapSize
+              || values[j].Length < 0
+              || static_cast<ui64>(values[j].Length) >= header->HeapSize - values[j].Data.Uint64) {
+            *error = "string in row " + std::to_string(header->FirstRow + i) + " out of bounds";
+            return false;
+          }
+          values[j].Data.String = heap + values[j].Data.Uint64;
+        }
+      }
+    }
+    rows->push_back(rowHeader);
+    row = reinterpret_cast<char*>(values + rowHeader->Count);
+  }
+  if (resolve) {
+    Resolved[index] = true;
+  }
+  return true;
+}
+
+const TColumnStatistics* TRowFileReader::GetBlockStatistics(ui64 index, ui64* columnCount) const
+{
+  const TRowFileBlockHeader* header = GetBlockHeader(index);
+  size_t available = Size - BlockOffsets[index];
+  if (header->StatisticsOffset % sizeof(ui64) != 0
+      || header->StatisticsOffset > available
+      || header->ColumnCount > (available - header->StatisticsOffset) / sizeof(TColumnStatistics)) {
+    return NULL;
+  }
+  *columnCount = header->ColumnCount;
+  return reinterpret_cast<const TColumnStatistics*>(
+    Data + BlockOffsets[index] + header->StatisticsOffset);
+}
+
+void TRowFileReader::Prefetch(ui64 index) const
+{
+  const TRowFileBlockHeader* header = GetBlockHeader(index);
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  size_t begin = BlockOffsets[index] & ~(pageSize - 1);
+  size_t end = std::min(Size, BlockOffsets[index] + header->HeapOffset + header->HeapSize);
+  madvise(Data + begin, end - begin, MADV_WILLNEED);
+}
+
+/* Scanning */
+
+// Calls consume(TRow* rows, i64 count) with the rows of every block in
+// order, asking for the next block to be read in while the current one is
+// consumed. With a filter, blocks it rules out are skipped without reading
+// their rows and counted in skippedBlocks. Returns false if some block is
+// corrupt.
+template <class TConsume>
+bool scanRowFile(
+  TRowFileReader* reader,
+  TConsume consume,
+  std::string* error,
+  TBlockFilterFunction filter = NULL,
+  ui64* skippedBlocks = NULL)
+{
+  std::vector<TRow> rows;
+  ui64 blockCount = reader->GetBlockCount();
+  for (ui64 block = 0; block < blockCount; block++) {
+    if (filter) {
+      ui64 columnCount;
+      const TColumnStatistics* statistics = reader->GetBlockStatistics(block, &columnCount);
+      if (statistics && !filter(statistics, columnCount)) {
+        if (skippedBlocks) {
+          (*skippedBlocks)++;
+        }
+        continue;
+      }
+    }
+    if (block + 1 < blockCount) {
+      reader->Prefetch(block + 1);
+    }
+    if (!reader->ReadBlock(block, &rows, error)) {
+      return false;
+    }
+    consume(rows.data(), static_cast<i64>(rows.size()));
+  }
+  return true;
+}
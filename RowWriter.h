@@ -0,0 +1,172 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstring>
+#include "TArena.h"
+#include "YTTypes.h"
+
+// Output rows, and the strings they point to, written batch by batch into
+// memory that is reused from one batch to the next. Rows and strings are
+// bump-allocated from chunks of an arena, which Reset takes back all at
+// once, so after the first batches writing output does not touch the
+// allocator at all. Generated code allocates inline (see
+// LLVMCodegen::EmitMaterializeFunction) and only calls into the writer when
+// a chunk or the row list runs out.
+
+class TRowWriter;
+
+// The part of the writer generated code reads and writes; LLVMCodegen
+// relies on the order of the fields.
+struct TRowWriterHeader {
+  // Free part of the current chunk.
+  char* Current;
+  char* End;
+  // Rows written since the last Reset.
+  TRow* Rows;
+  i64 RowCount;
+  i64 RowCapacity;
+  TRowWriter* Writer;
+};
+
+// Writes the rows that pass a predicate, projected, to a writer. Returns
+// the number of rows written.
+typedef i64 (*TMaterializeFunction)(TRow* rows, i64 count, TRowWriterHeader* writer);
+
+class TRowWriter {
+public:
+  // Rows and strings are 8-byte aligned.
+  static const size_t Alignment = sizeof(ui64);
+
+  explicit TRowWriter(size_t chunkSize = TArena::DefaultChunkSize)
+    : ChunkSize(chunkSize)
+    , Arena(chunkSize + Alignment)
+  {
+    Header.Current = NULL;
+    Header.End = NULL;
+    Header.RowCapacity = 1024;
+    Header.Rows = static_cast<TRow*>(malloc(Header.RowCapacity * sizeof(TRow)));
+    Header.RowCount = 0;
+    Header.Writer = this;
+  }
+
+  ~TRowWriter()
+  {
+    free(Header.Rows);
+  }
+
+  TRowWriter(const TRowWriter&) = delete;
+  void operator=(const TRowWriter&) = delete;
+
+  TRowWriterHeader* GetHeader()
+  {
+    return &Header;
+  }
+
+  void* Allocate(size_t size)
+  {
+    size = (size + Alignment - 1) & ~(Alignment - 1);
+    if (static_cast<size_t>(Header.End - Header.Current) < size) {
+      return Refill(size);
+    }
+    char* memory = Header.Current;
+    Header.Current += size;
+    return memory;
+  }
+
+  // Appends a row of count values, all Null, and returns its values.
+  TValue* AddRow(int count)
+  {
+    TRow row = static_cast<TRow>(Allocate(sizeof(TRowHeader) + count * sizeof(TValue)));
+    row->Count = count;
+    row->Padding = 0;
+    TValue* values = reinterpret_cast<TValue*>(row + 1);
+    for (int j = 0; j < count; j++) {
+      values[j].Id = j;
+      values[j].Type = EValueType::Null;
+      values[j].Length = 0;
+      values[j].Data.Int64 = 0;
+    }
+    AppendRow(row);
+    return values;
+  }
+
+  // Makes value a string holding a copy of length bytes of data, which
+  // lives until the next Reset.
+  void SetString(TValue* value, const char* data, i32 length)
+  {
+    char* copy = static_cast<char*>(Allocate(length));
+    memcpy(copy, data, length);
+    value->Type = EValueType::String;
+    value->Length = length;
+    value->Data.String = copy;
+  }
+
+  void AppendRow(TRow row)
+  {
+    if (Header.RowCount == Header.RowCapacity) {
+      GrowRows();
+    }
+    Header.Rows[Header.RowCount++] = row;
+  }
+
+  TRow* GetRows() const
+  {
+    return Header.Rows;
+  }
+
+  i64 GetRowCount() const
+  {
+    return Header.RowCount;
+  }
+
+  // Forgets everything written since the last Reset, keeping the memory for
+  // what comes next. Costs the same however much was written.
+  void Reset()
+  {
+    Arena.Clear();
+    Header.Current = NULL;
+    Header.End = NULL;
+    Header.RowCount = 0;
+  }
+
+  // Starts a new chunk with room for size bytes and returns them.
+  void* Refill(size_t size)
+  {
+    size_t chunkSize = size > ChunkSize ? size : ChunkSize;
+    char* chunk = static_cast<char*>(Arena.Allocate(chunkSize, Alignment));
+    Header.Current = chunk + size;
+    Header.End = chunk + chunkSize;
+    return chunk;
+  }
+
+  // Called by generated code, which cannot handle failure, so running out
+  // of memory is fatal.
+  void GrowRows()
+  {
+    Header.RowCapacity *= 2;
+    void* rows = realloc(Header.Rows, Header.RowCapacity * sizeof(TRow));
+    if (!rows) {
+      fprintf(stderr, "cannot allocate %lld output rows\n", (long long)Header.RowCapacity);
+      abort();
+    }
+    Header.Rows = static_cast<TRow*>(rows);
+  }
+
+private:
+  TRowWriterHeader Header;
+  size_t ChunkSize;
+  TArena Arena;
+};
+
+// Called by generated code when the current chunk is full. size is a
+// multiple of TRowWriter::Alignment.
+char* rowWriterRefill(TRowWriterHeader* header, i64 size)
+{
+  return static_cast<char*>(header->Writer->Refill(size));
+}
+
+// Called by generated code when the row list is full.
+void rowWriterGrowRows(TRowWriterHeader* header)
+{
+  header->Writer->GrowRows();
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "KeyHashing.h"
+#include "TExpressionTyper.h"
+using namespace TExpressionTyper;
+
+// ORDER BY <keys> [LIMIT k]. Keys must be of fixed-width types (see
+// isKeyType).
+struct TSortKey {
+  TConstExpressionPtr Expression;
+  bool Descending;
+};
+
+struct TOrderBy {
+  std::vector<TSortKey> Keys;
+};
+
+bool isValidOrderBy(const TOrderBy& orderBy)
+{
+  for (auto key = orderBy.Keys.begin(); key != orderBy.Keys.end(); key++) {
+    if (!isKeyType(typeOf(key->Expression))) {
+      return false;
+    }
+  }
+  return !orderBy.Keys.empty();
+}
+
+/* Generated functions */
+
+// Returns a negative number if lhs sorts before rhs, a positive one if it
+// sorts after and 0 if their keys are equal. Keys are computed one at a
+// time, only as long as the previous ones are equal. Doubles compare as
+// with <, except that NaN sorts after +inf and equal to other NaNs, so that
+// the order is strict weak and the same as that of the normalized keys.
+typedef i64 (*TRowComparator)(TRow lhs, TRow rhs);
+
+// Writes an entry of keyCount + 1 words for each row: the normalized keys,
+// then the row. Normalized keys are big-endian, so that comparing the
+// entries of two rows with memcmp over the key words gives their order:
+// signed integers have their sign bit flipped, doubles have all bits
+// flipped when negative and only the sign bit otherwise (NaN being
+// canonical, see getKeyWord, it ends up after +inf), and descending keys
+// are inverted.
+typedef void (*TSortKeyFunction)(TRow* rows, i64 count, ui64* entries);
+
+/* Sorting */
+
+// Below this many rows std::sort with the comparator beats the passes of
+// radix sort.
+const i64 RadixSortThreshold = 512;
+
+// Sorts count entries of entryWords words with keyWords leading key words by
+// their key bytes, least significant first. Each pass is a stable counting
+// sort of one byte; passes over bytes equal in all entries are skipped,
+// which in practice drops most of the high bytes of small integers.
+void radixSortEntries(ui64* entries, i64 count, int keyWords, int entryWords)
+{
+  std::vector<ui64> scratch(count * entryWords);
+  ui64* from = entries;
+  ui64* to = scratch.data();
+  size_t entryBytes = entryWords * sizeof(ui64);
+
+  for (int byte = keyWords * sizeof(ui64) - 1; byte >= 0; byte--) {
+    i64 histogram[257] = {0};
+    for (i64 i = 0; i < count; i++) {
+      histogram[reinterpret_cast<const ui8*>(from + i * entryWords)[byte] + 1]++;
+    }
+    bool trivial = false;
+    for (int digit = 1; digit <= 256; digit++) {
+      trivial |= histogram[digit] == count;
+      histogram[digit] += histogram[digit - 1];
+    }
+    if (trivial) {
+      continue;
+    }
+    for (i64 i = 0; i < count; i++) {
+      const ui64* entry = from + i * entryWords;
+      ui8 digit = reinterpret_cast<const ui8*>(entry)[byte];
+      memcpy(to + histogram[digit]++ * entryWords, entry, entryBytes);
+    }
+    std::swap(from, to);
+  }
+
+  if (from != entries) {
+    memcpy(entries, from, count * entryBytes);
+  }
+}
+
+// Sorts rows by comparing them with compare for small inputs and by radix
+// sort of their normalized keys otherwise.
+void sortRows(
+  TRowComparator compare,
+  TSortKeyFunction sortKeys,
+  int keyCount,
+  TRow* rows,
+  i64 count)
+{
+  if (count < RadixSortThreshold) {
+    std::stable_sort(rows, rows + count, [=] (TRow lhs, TRow rhs) {
+      return compare(lhs, rhs) < 0;
+    });
+    return;
+  }
+
+  int entryWords = keyCount + 1;
+  std::vector<ui64> entries(count * entryWords);
+  sortKeys(rows, count, entries.data());
+  radixSortEntries(entries.data(), count, keyCount, entryWords);
+  for (i64 i = 0; i < count; i++) {
+    rows[i] = reinterpret_cast<TRow>(entries[i * entryWords + keyCount]);
+  }
+}
+
+/* Top-K */
+
+// The first Limit rows in order of a comparator, for ORDER BY ... LIMIT.
+// Keeps a max-heap of the best rows seen so far, so that most rows are
+// rejected by a single comparison with the worst of them.
+class TTopK {
+public:
+  TTopK(TRowComparator compare, size_t limit)
+    : Compare(compare)
+    , Limit(limit)
+  {
+    Heap.reserve(limit);
+  }
+
+  void Add(TRow* rows, i64 count)
+  {
+    auto less = [this] (TRow lhs, TRow rhs) {
+      return Compare(lhs, rhs) < 0;
+    };
+    for (i64 i = 0; i < count; i++) {
+      if (Heap.size() < Limit) {
+        Heap.push_back(rows[i]);
+        std::push_heap(Heap.begin(), Heap.end(), less);
+      } else if (Limit && less(rows[i], Heap.front())) {
+        std::pop_heap(Heap.begin(), Heap.end(), less);
+        Heap.back() = rows[i];
+        std::push_heap(Heap.begin(), Heap.end(), less);
+      }
+    }
+  }
+
+  // The rows kept, in order. Of rows with equal keys, which are kept is
+  // unspecified.
+  std::vector<TRow> GetRows() const
+  {
+    std::vector<TRow> rows(Heap);
+    std::sort(rows.begin(), rows.end(), [this] (TRow lhs, TRow rhs) {
+      return Compare(lhs, rhs) < 0;
+    });
+    return rows;
+  }
+
+private:
+  TRowComparator Compare;
+  size_t Limit;
+  std::vector<TRow> Heap;
+};
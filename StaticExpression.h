@@ -0,0 +1,319 @@
+#pragma once
+#include <type_traits>
+#include "YTTypes.h"
+#include "TExpression.h"
+
+namespace TStaticExpression {
+// Expressions fixed in C++ code, built as types at compile time:
+//
+//   auto filter = column<EValueType::Int64, 0>() < TInt64<500>()
+//     && column<EValueType::Double, 1>() >= TDouble<1, 2>();
+//   TRowFunction function = getRowFunction(filter);
+//
+// Every node is an empty type with a static Evaluate, so the row and batch
+// functions are ordinary C++ functions the compiler inlines and optimizes
+// like hand-written code, with no JIT involved. Operands must have the types
+// the builtin binary operators are registered for (see registerBuiltins);
+// anything else fails to compile. Results follow generated code: integer
+// arithmetic wraps, && and || short-circuit, and division by zero is as
+// undefined as it is there. toExpression gives the equivalent TExpression,
+// to check a static expression against the interpreter or the JIT.
+
+template <EValueType Type>
+struct TCppType;
+
+template <>
+struct TCppType<EValueType::Int64> {
+  typedef i64 T;
+  static T Get(const TValue& value) { return value.Data.Int64; }
+  static void Set(TValue* value, T data) { value->Data.Int64 = data; }
+};
+
+template <>
+struct TCppType<EValueType::Uint64> {
+  typedef ui64 T;
+  static T Get(const TValue& value) { return value.Data.Uint64; }
+  static void Set(TValue* value, T data) { value->Data.Uint64 = data; }
+};
+
+template <>
+struct TCppType<EValueType::Double> {
+  typedef double T;
+  static T Get(const TValue& value) { return value.Data.Double; }
+  static void Set(TValue* value, T data) { value->Data.Double = data; }
+};
+
+template <>
+struct TCppType<EValueType::Boolean> {
+  typedef bool T;
+  static T Get(const TValue& value) { return value.Data.Boolean; }
+  static void Set(TValue* value, T data) { value->Data.Boolean = data; }
+};
+
+// Base of all nodes, so that the operators below only apply to them.
+struct TStaticNode { };
+
+template <class TNode>
+struct TIsStaticNode : std::is_base_of<TStaticNode, TNode> { };
+
+/* Leaves */
+
+template <EValueType Type, int ColumnIndex>
+struct TColumn : TStaticNode {
+  static const EValueType ResultType = Type;
+
+  static typename TCppType<Type>::T Evaluate(const TValue* values)
+  {
+    return TCppType<Type>::Get(values[ColumnIndex]);
+  }
+
+  static TConstExpressionPtr ToExpression(TExpressionArena& arena)
+  {
+    return arena.NewReference(Type, ColumnIndex);
+  }
+};
+
+template <EValueType Type, int ColumnIndex>
+constexpr TColumn<Type, ColumnIndex> column()
+{
+  return TColumn<Type, ColumnIndex>();
+}
+
+template <class TLiteralNode, EValueType Type>
+struct TLiteral : TStaticNode {
+  static const EValueType ResultType = Type;
+
+  static typename TCppType<Type>::T Evaluate(const TValue*)
+  {
+    return TLiteralNode::Value();
+  }
+
+  static TConstExpressionPtr ToExpression(TExpressionArena& arena)
+  {
+    TValue value;
+    value.Id = 0;
+    value.Type = Type;
+    value.Length = 0;
+    value.Data.Int64 = 0;
+    TCppType<Type>::Set(&value, TLiteralNode::Value());
+    return arena.NewLiteral(value);
+  }
+};
+
+template <i64 Data>
+struct TInt64 : TLiteral<TInt64<Data>, EValueType::Int64> {
+  static constexpr i64 Value() { return Data; }
+};
+
+template <ui64 Data>
+struct TUint64 : TLiteral<TUint64<Data>, EValueType::Uint64> {
+  static constexpr ui64 Value() { return Data; }
+};
+
+template <bool Data>
+struct TBoolean : TLiteral<TBoolean<Data>, EValueType::Boolean> {
+  static constexpr bool Value() { return Data; }
+};
+
+// Numerator / Denominator, as doubles cannot be template arguments.
+template <i64 Numerator, i64 Denominator = 1>
+struct TDouble : TLiteral<TDouble<Numerator, Denominator>, EValueType::Double> {
+  static constexpr double Value() { return static_cast<double>(Numerator) / Denominator; }
+};
+
+/* Binary operators */
+
+// The result type of the builtin for opcode on lhs and rhs, or Null if
+// there is none.
+constexpr EValueType getBinaryOpType(EBinaryOp opcode, EValueType lhs, EValueType rhs)
+{
+  return lhs != rhs ? EValueType::Null
+    : opcode == Plus || opcode == Minus || opcode == Multiply || opcode == Divide
+      ? (lhs == EValueType::Boolean ? EValueType::Null : lhs)
+    : opcode == Modulo
+      ? (lhs == EValueType::Int64 || lhs == EValueType::Uint64 ? lhs : EValueType::Null)
+    : opcode == And || opcode == Or
+      ? (lhs == EValueType::Boolean ? lhs : EValueType::Null)
+    : opcode == Equal || opcode == NotEqual
+      ? EValueType::Boolean
+    : lhs == EValueType::Boolean ? EValueType::Null : EValueType::Boolean;
+}
+
+template <EBinaryOp Opcode>
+struct TOperator;
+
+// Integer arithmetic is done unsigned, where it wraps as in generated code.
+template <>
+struct TOperator<Plus> {
+  template <class T> static T Apply(T lhs, T rhs) { return static_cast<T>(static_cast<ui64>(lhs) + static_cast<ui64>(rhs)); }
+  static double Apply(double lhs, double rhs) { return lhs + rhs; }
+};
+
+template <>
+struct TOperator<Minus> {
+  template <class T> static T Apply(T lhs, T rhs) { return static_cast<T>(static_cast<ui64>(lhs) - static_cast<ui64>(rhs)); }
+  static double Apply(double lhs, double rhs) { return lhs - rhs; }
+};
+
+template <>
+struct TOperator<Multiply> {
+  template <class T> static T Apply(T lhs, T rhs) { return static_cast<T>(static_cast<ui64>(lhs) * static_cast<ui64>(rhs)); }
+  static double Apply(double lhs, double rhs) { return lhs * rhs; }
+};
+
+template <>
+struct TOperator<Divide> {
+  template <class T> static T Apply(T lhs, T rhs) { return lhs / rhs; }
+};
+
+template <>
+struct TOperator<Modulo> {
+  template <class T> static T Apply(T lhs, T rhs) { return lhs % rhs; }
+};
+
+template <>
+struct TOperator<Equal> {
+  template <class T> static bool Apply(T lhs, T rhs) { return lhs == rhs; }
+};
+
+template <>
+struct TOperator<NotEqual> {
+  template <class T> static bool Apply(T lhs, T rhs) { return lhs != rhs; }
+};
+
+template <>
+struct TOperator<Less> {
+  template <class T> static bool Apply(T lhs, T rhs) { return lhs < rhs; }
+};
+
+template <>
+struct TOperator<LessOrEqual> {
+  template <class T> static bool Apply(T lhs, T rhs) { return lhs <= rhs; }
+};
+
+template <>
+struct TOperator<Greater> {
+  template <class T> static bool Apply(T lhs, T rhs) { return lhs > rhs; }
+};
+
+template <>
+struct TOperator<GreaterOrEqual> {
+  template <class T> static bool Apply(T lhs, T rhs) { return lhs >= rhs; }
+};
+
+template <EBinaryOp Opcode, class TLhs, class TRhs>
+struct TBinaryOp : TStaticNode {
+  static const EValueType ResultType = getBinaryOpType(Opcode, TLhs::ResultType, TRhs::ResultType);
+  static_assert(ResultType != EValueType::Null, "no builtin operator for these operand types");
+
+  static typename TCppType<ResultType>::T Evaluate(const TValue* values)
+  {
+    return TOperator<Opcode>::Apply(TLhs::Evaluate(values), TRhs::Evaluate(values));
+  }
+
+  static TConstExpressionPtr ToExpression(TExpressionArena& arena)
+  {
+    return arena.NewBinaryOp(
+      ResultType,
+      Opcode,
+      TLhs::ToExpression(arena),
+      TRhs::ToExpression(arena));
+  }
+};
+
+// && and || evaluate their right operand only when needed, as generated
+// code does.
+template <class TLhs, class TRhs>
+struct TBinaryOp<And, TLhs, TRhs> : TStaticNode {
+  static const EValueType ResultType = getBinaryOpType(And, TLhs::ResultType, TRhs::ResultType);
+  static_assert(ResultType != EValueType::Null, "&& needs boolean operands");
+
+  static bool Evaluate(const TValue* values)
+  {
+    return TLhs::Evaluate(values) && TRhs::Evaluate(values);
+  }
+
+  static TConstExpressionPtr ToExpression(TExpressionArena& arena)
+  {
+    return arena.NewBinaryOp(ResultType, And, TLhs::ToExpression(arena), TRhs::ToExpression(arena));
+  }
+};
+
+template <class TLhs, class TRhs>
+struct TBinaryOp<Or, TLhs, TRhs> : TStaticNode {
+  static const EValueType ResultType = getBinaryOpType(Or, TLhs::ResultType, TRhs::ResultType);
+  static_assert(ResultType != EValueType::Null, "|| needs boolean operands");
+
+  static bool Evaluate(const TValue* values)
+  {
+    return TLhs::Evaluate(values) || TRhs::Evaluate(values);
+  }
+
+  static TConstExpressionPtr ToExpression(TExpressionArena& arena)
+  {
+    return arena.NewBinaryOp(ResultType, Or, TLhs::ToExpression(arena), TRhs::ToExpression(arena));
+  }
+};
+
+#define STATIC_EXPRESSION_OPERATOR(op, opcode) \
+  template <class TLhs, class TRhs> \
+  constexpr typename std::enable_if< \
+    TIsStaticNode<TLhs>::value && TIsStaticNode<TRhs>::value, \
+    TBinaryOp<opcode, TLhs, TRhs>>::type \
+  operator op(TLhs, TRhs) \
+  { \
+    return TBinaryOp<opcode, TLhs, TRhs>(); \
+  }
+
+STATIC_EXPRESSION_OPERATOR(+, Plus)
+STATIC_EXPRESSION_OPERATOR(-, Minus)
+STATIC_EXPRESSION_OPERATOR(*, Multiply)
+STATIC_EXPRESSION_OPERATOR(/, Divide)
+STATIC_EXPRESSION_OPERATOR(%, Modulo)
+STATIC_EXPRESSION_OPERATOR(&&, And)
+STATIC_EXPRESSION_OPERATOR(||, Or)
+STATIC_EXPRESSION_OPERATOR(==, Equal)
+STATIC_EXPRESSION_OPERATOR(!=, NotEqual)
+STATIC_EXPRESSION_OPERATOR(<, Less)
+STATIC_EXPRESSION_OPERATOR(<=, LessOrEqual)
+STATIC_EXPRESSION_OPERATOR(>, Greater)
+STATIC_EXPRESSION_OPERATOR(>=, GreaterOrEqual)
+
+#undef STATIC_EXPRESSION_OPERATOR
+
+/* Functions */
+
+// Same ABI as the generated row and batch functions: only the data of the
+// result is written.
+template <class TExpr>
+void evaluateRow(TRow row, TValue* result)
+{
+  TCppType<TExpr::ResultType>::Set(result, TExpr::Evaluate(reinterpret_cast<const TValue*>(row + 1)));
+}
+
+template <class TExpr>
+void evaluateBatch(TRow* rows, TValue* results, i64 count)
+{
+  for (i64 i = 0; i < count; i++) {
+    evaluateRow<TExpr>(rows[i], &results[i]);
+  }
+}
+
+template <class TExpr>
+TRowFunction getRowFunction(TExpr)
+{
+  return &evaluateRow<TExpr>;
+}
+
+template <class TExpr>
+TBatchFunction getBatchFunction(TExpr)
+{
+  return &evaluateBatch<TExpr>;
+}
+
+template <class TExpr>
+TConstExpressionPtr toExpression(TExpr, TExpressionArena& arena)
+{
+  return TExpr::ToExpression(arena);
+}
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Bump allocator handing out memory from a list of fixed-size chunks.
+// Objects allocated from an arena are never destroyed individually: the
+// whole arena is released at once, so only trivially destructible types
+// should be placed in it.
+class TArena {
+public:
+  static const size_t DefaultChunkSize = 64 * 1024;
+
+  explicit TArena(size_t chunkSize = DefaultChunkSize)
+    : ChunkSize(chunkSize)
+    , CurrentChunk(0)
+    , Current(NULL)
+    , End(NULL)
+  { }
+
+  TArena(const TArena&) = delete;
+  void operator=(const TArena&) = delete;
+
+  ~TArena()
+  {
+    for (auto chunk = Chunks.begin(); chunk != Chunks.end(); chunk++) {
+      free(*chunk);
+    }
+  }
+
+  void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+  {
+    char* aligned = Align(Current, alignment);
+    if (!Current || aligned + size > End) {
+      NextChunk(size + alignment);
+      aligned = Align(Current, alignment);
+    }
+    Current = aligned + size;
+    return aligned;
+  }
+
+  template <class T, class... TArgs>
+  T* New(TArgs&&... args)
+  {
+    void* memory = Allocate(sizeof(T), alignof(T));
+    return new (memory) T(std::forward<TArgs>(args)...);
+  }
+
+  template <class T>
+  T* NewArray(size_t count)
+  {
+    return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+  }
+
+  // Copies a string into the arena and returns a NUL-terminated copy.
+  const char* CopyString(const char* data, size_t length)
+  {
+    char* copy = NewArray<char>(length + 1);
+    memcpy(copy, data, length);
+    copy[length] = '\0';
+    return copy;
+  }
+
+  // Forgets every allocation but keeps the chunks around for reuse.
+  void Clear()
+  {
+    CurrentChunk = 0;
+    Current = NULL;
+    End = NULL;
+  }
+
+private:
+  const size_t ChunkSize;
+  std::vector<char*> Chunks;
+  std::vector<size_t> ChunkSizes;
+  size_t CurrentChunk;
+  char* Current;
+  char* End;
+
+  static char* Align(char* ptr, size_t alignment)
+  {
+    uintptr_t value = reinterpret_cast<uintptr_t>(ptr);
+    return reinterpret_cast<char*>((value + alignment - 1) & ~(alignment - 1));
+  }
+
+  void NextChunk(size_t minSize)
+  {
+    // Reuse chunks left over from before the last Clear() when they fit.
+    if (Current) {
+      CurrentChunk++;
+    }
+    while (CurrentChunk < Chunks.size() && ChunkSizes[CurrentChunk] < minSize) {
+      CurrentChunk++;
+    }
+    if (CurrentChunk == Chunks.size()) {
+      size_t size = minSize > ChunkSize ? minSize : ChunkSize;
+      Chunks.push_back(static_cast<char*>(malloc(size)));
+      ChunkSizes.push_back(size);
+    }
+    Current = Chunks[CurrentChunk];
+    End = Current + ChunkSizes[CurrentChunk];
+  }
+};
@@ -1,3 +1,9 @@
+#pragma once
+#include <set>
+#include <string>
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "TArena.h"
 
 using namespace llvm;
 
@@ -21,12 +27,24 @@ enum EBinaryOp {
     GreaterOrEqual
 };
 
+// Node kind tag, used by visitors to switch over expression nodes instead
+// of probing them with dynamic_cast.
+enum class EExpressionKind {
+    Literal,
+    Reference,
+    BinaryOp,
+    Function
+};
+
+// Expression nodes are trivially destructible and are meant to be
+// allocated from a TExpressionArena, which owns the whole tree.
 struct TExpression {
-  TExpression(EValueType type) : Type(type)
+  TExpression(EExpressionKind kind, EValueType type)
+    : Kind(kind)
+    , Type(type)
   { }
 
-  virtual ~TExpression() { }
-
+  const EExpressionKind Kind;
   const EValueType Type;
 
   std::string GetName() const;
@@ -34,68 +52,84 @@ struct TExpression {
   template <class TDerived>
   const TDerived* As() const
   {
-      return dynamic_cast<const TDerived*>(this);
+      return Kind == TDerived::StaticKind
+          ? static_cast<const TDerived*>(this)
+          : NULL;
   }
 
   template <class TDerived>
   TDerived* As()
   {
-      return dynamic_cast<TDerived*>(this);
+      return Kind == TDerived::StaticKind
+          ? static_cast<TDerived*>(this)
+          : NULL;
   }
 };
 
+typedef const TExpression* TConstExpressionPtr;
+typedef std::vector<TConstExpressionPtr> TArguments;
+
 struct TLiteralExpression
     : public TExpression
 {
-    TLiteralExpression(EValueType type) : TExpression(type)
-    { }
-
-    virtual ~TLiteralExpression() { }
+    static const EExpressionKind StaticKind = EExpressionKind::Literal;
 
     TLiteralExpression(
         EValueType type,
-        std::shared_ptr<TValue> value)
-        : TExpression(type)
+        const TValue& value)
+        : TExpression(StaticKind, type)
         , Value(value)
     { }
 
-    std::shared_ptr<TValue> Value;
+    TValue Value;
 };
 
-typedef std::shared_ptr<TExpression> TConstExpressionPtr;
-typedef std::vector<TConstExpressionPtr> TArguments;
+// Refers to a value of the row the expression is evaluated against.
+struct TReferenceExpression
+    : public TExpression
+{
+    static const EExpressionKind StaticKind = EExpressionKind::Reference;
+
+    TReferenceExpression(
+        EValueType type,
+        int columnIndex)
+        : TExpression(StaticKind, type)
+        , ColumnIndex(columnIndex)
+    { }
+
+    int ColumnIndex;
+};
 
 struct TFunctionExpression
     : public TExpression
 {
-    TFunctionExpression(EValueType type) : TExpression(type)
-    { }
+    static const EExpressionKind StaticKind = EExpressionKind::Function;
 
     TFunctionExpression(
         EValueType type,
-        const std::string& functionName,
-        const TArguments& arguments)
-        : TExpression(type)
+        StringRef functionName,
+        ArrayRef<TConstExpressionPtr> arguments)
+        : TExpression(StaticKind, type)
         , FunctionName(functionName)
         , Arguments(arguments)
     { }
 
-    std::string FunctionName;
-    TArguments Arguments;
+    // Both point into the arena owning this node.
+    StringRef FunctionName;
+    ArrayRef<TConstExpressionPtr> Arguments;
 };
 
 struct TBinaryOpExpression
     : public TExpression
 {
-    TBinaryOpExpression(EValueType type) : TExpression(type)
-    { }
+    static const EExpressionKind StaticKind = EExpressionKind::BinaryOp;
 
     TBinaryOpExpression(
         EValueType type,
         EBinaryOp opcode,
-        const TConstExpressionPtr& lhs,
-        const TConstExpressionPtr& rhs)
-        : TExpression(type)
+        TConstExpressionPtr lhs,
+        TConstExpressionPtr rhs)
+        : TExpression(StaticKind, type)
         , Opcode(opcode)
         , Lhs(lhs)
         , Rhs(rhs)
@@ -105,3 +139,176 @@ struct TBinaryOpExpression
     TConstExpressionPtr Lhs;
     TConstExpressionPtr Rhs;
 };
+
+// Owns the nodes of one or more expression trees. Nodes, literal values,
+// function names and argument lists all live in the arena and are freed
+// together when it is destroyed.
+class TExpressionArena {
+public:
+  TConstExpressionPtr NewLiteral(const TValue& value)
+  {
+    return Arena.New<TLiteralExpression>(
+      static_cast<EValueType>(value.Type),
+      value);
+  }
+
+  TConstExpressionPtr NewReference(EValueType type, int columnIndex)
+  {
+    return Arena.New<TReferenceExpression>(type, columnIndex);
+  }
+
+  TConstExpressionPtr NewBinaryOp(
+    EValueType type,
+    EBinaryOp opcode,
+    TConstExpressionPtr lhs,
+    TConstExpressionPtr rhs)
+  {
+    return Arena.New<TBinaryOpExpression>(type, opcode, lhs, rhs);
+  }
+
+  TConstExpressionPtr NewFunction(
+    EValueType type,
+    StringRef functionName,
+    ArrayRef<TConstExpressionPtr> arguments)
+  {
+    const char* name = Arena.CopyString(functionName.data(), functionName.size());
+    TConstExpressionPtr* args = Arena.NewArray<TConstExpressionPtr>(arguments.size());
+    std::copy(arguments.begin(), arguments.end(), args);
+    return Arena.New<TFunctionExpression>(
+      type,
+      StringRef(name, functionName.size()),
+      ArrayRef<TConstExpressionPtr>(args, arguments.size()));
+  }
+
+private:
+  TArena Arena;
+};
+
+// Structural hash of an expression tree (FNV-1a over its nodes). Unlike
+// pointer identity it is stable across processes, so it can name compiled
+// code in profiles and key caches of it.
+ui64 hashExpression(TConstExpressionPtr expr, ui64 hash = 14695981039346656037ULL)
+{
+  auto mix = [&] (const void* data, size_t size) {
+    const ui8* bytes = static_cast<const ui8*>(data);
+    for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+  };
+  auto mixValue = [&] (ui64 value) { mix(&value, sizeof(value)); };
+
+  mixValue(static_cast<ui64>(expr->Kind));
+  mixValue(static_cast<ui64>(expr->Type));
+  switch (expr->Kind) {
+    case EExpressionKind::Literal: {
+      const TLiteralExpression* literalExpr = static_cast<const TLiteralExpression*>(expr);
+      mixValue(literalExpr->Value.Type);
+      if (literalExpr->Value.Type == EValueType::String) {
+        mixValue(literalExpr->Value.Length);
+        mix(literalExpr->Value.Data.String, literalExpr->Value.Length);
+      } else {
+        mixValue(literalExpr->Value.Data.Uint64);
+      }
+      break;
+    }
+    case EExpressionKind::Reference:
+      mixValue(static_cast<const TReferenceExpression*>(expr)->ColumnIndex);
+      break;
+    case EExpressionKind::BinaryOp: {
+      const TBinaryOpExpression* binOpExpr = static_cast<const TBinaryOpExpression*>(expr);
+      mixValue(binOpExpr->Opcode);
+      hash = hashExpression(binOpExpr->Lhs, hash);
+      hash = hashExpression(binOpExpr->Rhs, hash);
+      break;
+    }
+    case EExpressionKind::Function: {
+      const TFunctionExpression* funExpr = static_cast<const TFunctionExpression*>(expr);
+      mix(funExpr->FunctionName.data(), funExpr->FunctionName.size());
+      mixValue(funExpr->Arguments.size());
+      for (auto args = funExpr->Arguments.begin();
+           args != funExpr->Arguments.end();
+           args++) {
+        hash = hashExpression(*args, hash);
+      }
+      break;
+    }
+  }
+  return hash;
+}
+
+// The whole structure of an expression tree as a string, equal for two
+// trees exactly when they are structurally the same, unlike their hashes.
+// Stored with cached code to tell colliding hashes apart.
+std::string serializeExpression(TConstExpressionPtr expr)
+{
+  std::string result;
+  auto appendBytes = [&] (StringRef bytes) {
+    result += std::to_string(bytes.size()) + ":";
+    result.append(bytes.data(), bytes.size());
+  };
+
+  result += std::to_string(static_cast<int>(expr->Kind)) + ","
+    + std::to_string(static_cast<int>(expr->Type)) + ",";
+  switch (expr->Kind) {
+    case EExpressionKind::Literal: {
+      const TLiteralExpression* literalExpr = static_cast<const TLiteralExpression*>(expr);
+      result += std::to_string(static_cast<int>(literalExpr->Value.Type)) + ",";
+      if (literalExpr->Value.Type == EValueType::String) {
+        appendBytes(StringRef(literalExpr->Value.Data.String, literalExpr->Value.Length));
+      } else {
+        result += std::to_string(literalExpr->Value.Data.Uint64);
+      }
+      break;
+    }
+    case EExpressionKind::Reference:
+      result += std::to_string(static_cast<const TReferenceExpression*>(expr)->ColumnIndex);
+      break;
+    case EExpressionKind::BinaryOp: {
+      const TBinaryOpExpression* binOpExpr = static_cast<const TBinaryOpExpression*>(expr);
+      result += std::to_string(static_cast<int>(binOpExpr->Opcode))
+        + "(" + serializeExpression(binOpExpr->Lhs)
+        + " " + serializeExpression(binOpExpr->Rhs) + ")";
+      break;
+    }
+    case EExpressionKind::Function: {
+      const TFunctionExpression* funExpr = static_cast<const TFunctionExpression*>(expr);
+      appendBytes(funExpr->FunctionName);
+      result += "(";
+      for (auto args = funExpr->Arguments.begin();
+           args != funExpr->Arguments.end();
+           args++) {
+        result += (args == funExpr->Arguments.begin() ? "" : " ") + serializeExpression(*args);
+      }
+      result += ")";
+      break;
+    }
+  }
+  return result;
+}
+
+// Adds the indexes of the columns expr references to columns.
+void collectReferencedColumns(TConstExpressionPtr expr, std::set<int>* columns)
+{
+  switch (expr->Kind) {
+    case EExpressionKind::Literal:
+      break;
+    case EExpressionKind::Reference:
+      columns->insert(static_cast<const TReferenceExpression*>(expr)->ColumnIndex);
+      break;
+    case EExpressionKind::BinaryOp: {
+      const TBinaryOpExpression* binOpExpr = static_cast<const TBinaryOpExpression*>(expr);
+      collectReferencedColumns(binOpExpr->Lhs, columns);
+      collectReferencedColumns(binOpExpr->Rhs, columns);
+      break;
+    }
+    case EExpressionKind::Function: {
+      const TFunctionExpression* funExpr = static_cast<const TFunctionExpression*>(expr);
+      for (auto args = funExpr->Arguments.begin();
+           args != funExpr->Arguments.end();
+           args++) {
+        collectReferencedColumns(*args, columns);
+      }
+      break;
+    }
+  }
+}
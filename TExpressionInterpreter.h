@@ -0,0 +1,154 @@
+#pragma once
+#include "YTTypes.h"
+#include "TExpression.h"
+
+namespace TExpressionInterpreter {
+// Evaluates expressions by walking the tree and switching on the type tag
+// of every intermediate TValue. This is what evaluation costs without
+// codegen, and serves as the baseline the generated code is measured and
+// checked against. Function calls are not supported and evaluate to Null.
+
+TValue makeValue(EValueType type)
+{
+  TValue value;
+  value.Id = 0;
+  value.Type = type;
+  value.Length = 0;
+  value.Data.Int64 = 0;
+  return value;
+}
+
+void setData(TValue& value, i64 data) { value.Data.Int64 = data; }
+void setData(TValue& value, ui64 data) { value.Data.Uint64 = data; }
+void setData(TValue& value, double data) { value.Data.Double = data; }
+void setData(TValue& value, bool data) { value.Data.Boolean = data; }
+
+template <class T>
+TValue evaluateNumeric(EBinaryOp opcode, T lhs, T rhs, EValueType type)
+{
+  TValue result = makeValue(type);
+  switch (opcode) {
+    case Plus:
+      setData(result, static_cast<T>(lhs + rhs));
+      break;
+    case Minus:
+      setData(result, static_cast<T>(lhs - rhs));
+      break;
+    case Multiply:
+      setData(result, static_cast<T>(lhs * rhs));
+      break;
+    case Divide:
+      if (type != EValueType::Double && rhs == 0) {
+        return makeValue(EValueType::Null);
+      }
+      setData(result, static_cast<T>(lhs / rhs));
+      break;
+    case Equal:
+      result = makeValue(EValueType::Boolean);
+      setData(result, lhs == rhs);
+      break;
+    case NotEqual:
+      result = makeValue(EValueType::Boolean);
+      setData(result, lhs != rhs);
+      break;
+    case Less:
+      result = makeValue(EValueType::Boolean);
+      setData(result, lhs < rhs);
+      break;
+    case LessOrEqual:
+      result = makeValue(EValueType::Boolean);
+      setData(result, lhs <= rhs);
+      break;
+    case Greater:
+      result = makeValue(EValueType::Boolean);
+      setData(result, lhs > rhs);
+      break;
+    case GreaterOrEqual:
+      result = makeValue(EValueType::Boolean);
+      setData(result, lhs >= rhs);
+      break;
+    default:
+      return makeValue(EValueType::Null);
+  }
+  return result;
+}
+
+template <class T>
+TValue evaluateIntegral(EBinaryOp opcode, T lhs, T rhs, EValueType type)
+{
+  if (opcode == Modulo) {
+    if (rhs == 0) {
+      return makeValue(EValueType::Null);
+    }
+    TValue result = makeValue(type);
+    setData(result, static_cast<T>(lhs % rhs));
+    return result;
+  }
+  return evaluateNumeric(opcode, lhs, rhs, type);
+}
+
+TValue evaluateLogical(EBinaryOp opcode, bool lhs, bool rhs)
+{
+  TValue result = makeValue(EValueType::Boolean);
+  switch (opcode) {
+    case And:
+      setData(result, lhs && rhs);
+      break;
+    case Or:
+      setData(result, lhs || rhs);
+      break;
+    case Equal:
+      setData(result, lhs == rhs);
+      break;
+    case NotEqual:
+      setData(result, lhs != rhs);
+      break;
+    default:
+      return makeValue(EValueType::Null);
+  }
+  return result;
+}
+
+TValue evaluate(const TExpression* expr, TRow row)
+{
+  switch (expr->Kind) {
+    case EExpressionKind::Literal:
+      return static_cast<const TLiteralExpression*>(expr)->Value;
+
+    case EExpressionKind::Reference: {
+      TValue* values = (TValue*)(row + 1);
+      return values[static_cast<const TReferenceExpression*>(expr)->ColumnIndex];
+    }
+
+    case EExpressionKind::BinaryOp: {
+      const TBinaryOpExpression* binOpExpr = static_cast<const TBinaryOpExpression*>(expr);
+      TValue lhs = evaluate(binOpExpr->Lhs, row);
+      TValue rhs = evaluate(binOpExpr->Rhs, row);
+      if (lhs.Type != rhs.Type) {
+        return makeValue(EValueType::Null);
+      }
+      switch (lhs.Type) {
+        case EValueType::Int64:
+          return evaluateIntegral(
+            binOpExpr->Opcode, lhs.Data.Int64, rhs.Data.Int64, EValueType::Int64);
+        case EValueType::Uint64:
+          return evaluateIntegral(
+            binOpExpr->Opcode, lhs.Data.Uint64, rhs.Data.Uint64, EValueType::Uint64);
+        case EValueType::Double:
+          return evaluateNumeric(
+            binOpExpr->Opcode, lhs.Data.Double, rhs.Data.Double, EValueType::Double);
+        case EValueType::Boolean:
+          return evaluateLogical(
+            binOpExpr->Opcode, lhs.Data.Boolean, rhs.Data.Boolean);
+        default:
+          return makeValue(EValueType::Null);
+      }
+    }
+
+    case EExpressionKind::Function:
+      return makeValue(EValueType::Null);
+  }
+
+  return makeValue(EValueType::Null);
+}
+}
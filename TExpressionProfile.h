@@ -0,0 +1,135 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include "TExpressionTyper.h"
+
+// Counters of one instrumented node: how many times it was evaluated and,
+// for boolean nodes, how many of those evaluations were true.
+struct TNodeCounters {
+  ui64 Rows;
+  ui64 True;
+};
+
+// Per-node counters collected by instrumented code (see
+// LLVMCodegen::SetProfile). Nodes are identified by their index in a
+// pre-order walk of the expression, which is stable for a given tree shape.
+//
+// Generated code accumulates counts for a whole batch in locals and adds
+// them here once per batch, without atomics: batches evaluated
+// concurrently by several threads may lose updates, which is fine for
+// estimates of selectivity.
+class TExpressionProfile {
+public:
+  explicit TExpressionProfile(TConstExpressionPtr expr)
+  {
+    Number(expr);
+    Counters.resize(Nodes.size());
+    Instrumented.resize(Nodes.size(), false);
+    Reset();
+  }
+
+  int GetNodeCount() const
+  {
+    return Nodes.size();
+  }
+
+  TConstExpressionPtr GetNode(int id) const
+  {
+    return Nodes[id];
+  }
+
+  // Returns the id of expr, or -1 if it is not a node of the expression.
+  int GetId(TConstExpressionPtr expr) const
+  {
+    auto it = Ids.find(expr);
+    return it == Ids.end() ? -1 : it->second;
+  }
+
+  // Choosing the nodes to instrument only affects code generated afterwards.
+  void Instrument(int id)
+  {
+    Instrumented[id] = true;
+  }
+
+  void InstrumentBooleanNodes()
+  {
+    for (int id = 0; id < GetNodeCount(); id++) {
+      if (typeOf(Nodes[id]) == EValueType::Boolean) {
+        Instrument(id);
+      }
+    }
+  }
+
+  void InstrumentAll()
+  {
+    for (int id = 0; id < GetNodeCount(); id++) {
+      Instrument(id);
+    }
+  }
+
+  bool IsInstrumented(int id) const
+  {
+    return id >= 0 && Instrumented[id];
+  }
+
+  const TNodeCounters& GetCounters(int id) const
+  {
+    return Counters[id];
+  }
+
+  // Fraction of evaluations of a boolean node that were true, or 1 if the
+  // node has not been evaluated yet.
+  double GetSelectivity(int id) const
+  {
+    const TNodeCounters& counters = Counters[id];
+    return counters.Rows ? double(counters.True) / counters.Rows : 1.0;
+  }
+
+  void Reset()
+  {
+    for (auto counters = Counters.begin(); counters != Counters.end(); counters++) {
+      counters->Rows = 0;
+      counters->True = 0;
+    }
+  }
+
+  // Generated code updates the counters in place through this pointer.
+  TNodeCounters* GetCountersData()
+  {
+    return Counters.data();
+  }
+
+private:
+  std::vector<TConstExpressionPtr> Nodes;
+  std::unordered_map<TConstExpressionPtr, int> Ids;
+  std::vector<TNodeCounters> Counters;
+  std::vector<bool> Instrumented;
+
+  void Number(TConstExpressionPtr expr)
+  {
+    if (!Ids.insert(std::make_pair(expr, (int)Nodes.size())).second) {
+      return;
+    }
+    Nodes.push_back(expr);
+    switch (expr->Kind) {
+      case EExpressionKind::Literal:
+      case EExpressionKind::Reference:
+        break;
+      case EExpressionKind::BinaryOp: {
+        const TBinaryOpExpression* binOpExpr = static_cast<const TBinaryOpExpression*>(expr);
+        Number(binOpExpr->Lhs);
+        Number(binOpExpr->Rhs);
+        break;
+      }
+      case EExpressionKind::Function: {
+        const TFunctionExpression* funExpr = static_cast<const TFunctionExpression*>(expr);
+        for (auto args = funExpr->Arguments.begin();
+             args != funExpr->Arguments.end();
+             args++) {
+          Number(*args);
+        }
+        break;
+      }
+    }
+  }
+};
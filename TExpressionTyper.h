@@ -1,3 +1,4 @@
+#pragma once
 #include "YTTypes.h"
 #include "TExpression.h"
 #include "FunctionRegistry.h"
@@ -8,45 +9,54 @@ namespace TExpressionTyper {
 // EValueType::Null is returned.
 EValueType typeOf(const TExpression* expr)
 {
-  if (expr->As<TLiteralExpression>()) {
-    return expr->Type;
+  switch (expr->Kind) {
+    case EExpressionKind::Literal:
+    case EExpressionKind::Reference:
+      return expr->Type;
 
-  } else if (expr->As<TBinaryOpExpression>()) {
-    const TBinaryOpExpression* binOpExpr = expr->As<TBinaryOpExpression>();
-    EValueType lhsType = typeOf(binOpExpr->Lhs.get());
-    EValueType rhsType = typeOf(binOpExpr->Rhs.get());
-    std::vector<EValueType> argTypes({ lhsType, rhsType });
-    const FunctionSignature* signature = registry->GetFunction(
-      binOpExpr->Opcode,
-      EValueType::Null,
-      &argTypes);
-    if (signature->ArgumentTypes.size() == 2
-        && signature->ArgumentTypes[0] == lhsType
-        && signature->ArgumentTypes[1] == rhsType) {
-      return signature->ReturnType;
+    case EExpressionKind::BinaryOp: {
+      const TBinaryOpExpression* binOpExpr = static_cast<const TBinaryOpExpression*>(expr);
+      EValueType lhsType = typeOf(binOpExpr->Lhs);
+      EValueType rhsType = typeOf(binOpExpr->Rhs);
+      std::vector<EValueType> argTypes({ lhsType, rhsType });
+      const FunctionSignature* signature = registry->GetFunction(
+        binOpExpr->Opcode,
+        EValueType::Null,
+        &argTypes);
+      if (signature
+          && signature->ArgumentTypes.size() == 2
+          && signature->ArgumentTypes[0] == lhsType
+          && signature->ArgumentTypes[1] == rhsType) {
+        return signature->ReturnType;
+      }
+      return EValueType::Null;
     }
 
-  } else if (expr->As<TFunctionExpression>()) {
-    const TFunctionExpression* funExpr = expr->As<TFunctionExpression>();
-    std::vector<EValueType> argTypes;
-    for (auto args = funExpr->Arguments.begin();
-         args != funExpr->Arguments.end();
-         args++) {
-      argTypes.push_back((*args)->Type);
-    }
-    const FunctionSignature* signature = registry->GetFunction(
-      funExpr->FunctionName,
-      EValueType::Null,
-      &argTypes);
-    auto arg = funExpr->Arguments.begin();
-    auto tpe = signature->ArgumentTypes.begin();
-    for (; arg != funExpr->Arguments.end();
-         arg++, tpe++) {
-      if (typeOf(arg->get()) != *tpe) {
+    case EExpressionKind::Function: {
+      const TFunctionExpression* funExpr = static_cast<const TFunctionExpression*>(expr);
+      std::vector<EValueType> argTypes;
+      for (auto args = funExpr->Arguments.begin();
+           args != funExpr->Arguments.end();
+           args++) {
+        argTypes.push_back(typeOf(*args));
+      }
+      const FunctionSignature* signature = registry->GetFunction(
+        funExpr->FunctionName.str(),
+        EValueType::Null,
+        &argTypes);
+      if (!signature) {
         return EValueType::Null;
       }
+      auto arg = funExpr->Arguments.begin();
+      auto tpe = signature->ArgumentTypes.begin();
+      for (; arg != funExpr->Arguments.end();
+           arg++, tpe++) {
+        if (typeOf(*arg) != *tpe) {
+          return EValueType::Null;
+        }
+      }
+      return signature->ReturnType;
     }
-    return signature->ReturnType;
   }
 
   return EValueType::Null;
@@ -0,0 +1,162 @@
+#pragma once
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/Support/Host.h"
+#include "YTTypes.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+using namespace llvm;
+
+// The CPU and subtarget attributes code is generated for. EngineBuilder
+// defaults to a generic CPU, which leaves out AVX2 and AVX-512 even on
+// hosts that have them.
+struct TTargetFeatures {
+  std::string CPU;
+  // Sorted "+feature" and "-feature" strings, as taken by
+  // EngineBuilder::setMAttrs.
+  std::vector<std::string> Attributes;
+
+  // Names code generated for these features in caches, e.g.
+  // "haswell+avx+avx2-avx512f".
+  std::string GetKey() const
+  {
+    std::string key = CPU.empty() ? "default" : CPU;
+    for (auto attribute = Attributes.begin(); attribute != Attributes.end(); attribute++) {
+      key += *attribute;
+    }
+    return key;
+  }
+
+  bool Has(const std::string& feature) const
+  {
+    return std::binary_search(Attributes.begin(), Attributes.end(), "+" + feature);
+  }
+
+  // Whether code generated for these features runs on host.
+  bool IsSupportedBy(const TTargetFeatures& host) const
+  {
+    for (auto attribute = Attributes.begin(); attribute != Attributes.end(); attribute++) {
+      if ((*attribute)[0] == '+' && !host.Has(attribute->substr(1))) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+void applyTargetFeatures(EngineBuilder& builder, const TTargetFeatures& features)
+{
+  if (!features.CPU.empty()) {
+    builder.setMCPU(features.CPU);
+  }
+  if (!features.Attributes.empty()) {
+    builder.setMAttrs(features.Attributes);
+  }
+}
+
+// LLVM does not report host features on every target, x86 included in
+// older releases. This reads the ones the variants below choose between
+// with cpuid, counting AVX state only when the OS saves it.
+static void getCPUIDFeatures(StringMap<bool>* features)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return;
+  }
+
+  ui64 xcr0 = 0;
+  if (ecx & (1 << 27)) {
+    ui32 low, high;
+    __asm__ ("xgetbv" : "=a" (low), "=d" (high) : "c" (0));
+    xcr0 = (ui64(high) << 32) | low;
+  }
+  bool ymmState = (xcr0 & 0x06) == 0x06;
+  bool zmmState = ymmState && (xcr0 & 0xe0) == 0xe0;
+
+  (*features)["sse4.2"] = ecx & (1 << 20);
+  (*features)["popcnt"] = ecx & (1 << 23);
+  (*features)["fma"] = ymmState && (ecx & (1 << 12));
+  (*features)["avx"] = ymmState && (ecx & (1 << 28));
+
+  if (__get_cpuid_max(0, NULL) >= 7) {
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    (*features)["bmi"] = ebx & (1 << 3);
+    (*features)["avx2"] = ymmState && (ebx & (1 << 5));
+    (*features)["bmi2"] = ebx & (1 << 8);
+    (*features)["avx512f"] = zmmState && (ebx & (1 << 16));
+  }
+#endif
+}
+
+TTargetFeatures detectHostTargetFeatures()
+{
+  TTargetFeatures features;
+  features.CPU = sys::getHostCPUName().str();
+
+  StringMap<bool> hostFeatures;
+  if (!sys::getHostCPUFeatures(hostFeatures)) {
+    getCPUIDFeatures(&hostFeatures);
+  }
+  for (auto feature = hostFeatures.begin(); feature != hostFeatures.end(); feature++) {
+    features.Attributes.push_back(
+      (feature->getValue() ? "+" : "-") + feature->getKey().str());
+  }
+  std::sort(features.Attributes.begin(), features.Attributes.end());
+
+  return features;
+}
+
+// Detected once per process.
+const TTargetFeatures& getHostTargetFeatures()
+{
+  static const TTargetFeatures features = detectHostTargetFeatures();
+  return features;
+}
+
+static TTargetFeatures makeTargetVariant(
+  const char* cpu,
+  std::vector<std::string> features)
+{
+  TTargetFeatures variant;
+  variant.CPU = cpu;
+  for (auto feature = features.begin(); feature != features.end(); feature++) {
+    variant.Attributes.push_back("+" + *feature);
+  }
+  std::sort(variant.Attributes.begin(), variant.Attributes.end());
+  return variant;
+}
+
+// Variants to generate for a fleet of mixed hosts sharing cached code,
+// from the least to the most capable; roughly the x86-64 micro-architecture
+// levels. Elsewhere there is a single variant for the default CPU.
+const std::vector<TTargetFeatures>& getTargetVariants()
+{
+  static const std::vector<TTargetFeatures> variants = {
+#if defined(__x86_64__)
+    makeTargetVariant("x86-64", {}),
+    makeTargetVariant("x86-64", {"sse4.2", "popcnt"}),
+    makeTargetVariant("x86-64", {"sse4.2", "popcnt", "avx", "avx2", "fma", "bmi", "bmi2"}),
+    makeTargetVariant("x86-64", {"sse4.2", "popcnt", "avx", "avx2", "fma", "bmi", "bmi2", "avx512f"}),
+#else
+    TTargetFeatures(),
+#endif
+  };
+  return variants;
+}
+
+// The most capable variant host can run; the first one runs everywhere.
+const TTargetFeatures& selectTargetVariant(const TTargetFeatures& host)
+{
+  const std::vector<TTargetFeatures>& variants = getTargetVariants();
+  for (auto variant = variants.rbegin(); variant != variants.rend(); variant++) {
+    if (variant->IsSupportedBy(host)) {
+      return *variant;
+    }
+  }
+  return variants.front();
+}
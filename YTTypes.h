@@ -1,3 +1,4 @@
+#pragma once
 #include "llvm/IR/TypeBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 using namespace llvm;
@@ -21,6 +22,40 @@ enum EValueType {
   Any // Don’t bother right now.
 };
 
+const char* getValueTypeName(EValueType type)
+{
+  switch (type) {
+    case Null:
+      return "Null";
+    case Int64:
+      return "Int64";
+    case Uint64:
+      return "Uint64";
+    case Double:
+      return "Double";
+    case Boolean:
+      return "Boolean";
+    case String:
+      return "String";
+    case Any:
+      return "Any";
+  }
+  return "Unknown";
+}
+
+// Inverse of getValueTypeName, ignoring case. Returns false for unknown
+// names.
+bool parseValueTypeName(StringRef name, EValueType* type)
+{
+  for (int i = Null; i <= Any; i++) {
+    if (name.equals_lower(getValueTypeName(static_cast<EValueType>(i)))) {
+      *type = static_cast<EValueType>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
 struct TValue {
   i8 Id; // Column name.
   i8 Type; // Column type (EValueType).
@@ -42,6 +77,13 @@ struct TRowHeader
 
 using TRow = TRowHeader*;
 
+/* Generated code ABI */
+
+// Signatures of the row functions generated for expressions (see
+// LLVMCodegen::GetRowFunctionModule).
+typedef void (*TRowFunction)(TRow row, TValue* result);
+typedef void (*TBatchFunction)(TRow* rows, TValue* results, i64 count);
+
 /* LLMV types for YT data types */
 
 namespace llvm {
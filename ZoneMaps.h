@@ -0,0 +1,116 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "YTTypes.h"
+#include "TExpression.h"
+
+// Zone maps: per-block statistics of every column, from which a compiled
+// block filter (see LLVMCodegen::EmitBlockFilterFunction) tells whether a
+// predicate can hold for any row of the block, so that scans skip blocks
+// that cannot match without looking at their rows.
+
+// Statistics of the index-th values of the rows of a block. Generated code
+// reads them as four 64-bit words.
+struct TColumnStatistics {
+  // Type of every non-null value, Null if all are null, and Any if values
+  // differ in type or cannot be ordered (strings, NaN). Only Int64, Uint64,
+  // Double and Boolean columns have bounds.
+  ui64 Type;
+  // Rows where the value is null or missing.
+  ui64 NullCount;
+  // Data of the smallest and largest values, booleans as 0 or 1.
+  ui64 Min;
+  ui64 Max;
+};
+
+static_assert(sizeof(TColumnStatistics) == 4 * sizeof(ui64), "generated code reads statistics as words");
+
+// Returns a non-zero value if the predicate it was generated for can be
+// true for some row of a block with the given statistics.
+typedef i64 (*TBlockFilterFunction)(const TColumnStatistics* statistics, i64 columnCount);
+
+void initColumnStatistics(TColumnStatistics* statistics, ui64 nullCount = 0)
+{
+  statistics->Type = EValueType::Null;
+  statistics->NullCount = nullCount;
+  statistics->Min = 0;
+  statistics->Max = 0;
+}
+
+void updateColumnStatistics(TColumnStatistics* statistics, const TValue& value)
+{
+  EValueType type = static_cast<EValueType>(value.Type);
+  if (type == EValueType::Null) {
+    statistics->NullCount++;
+    return;
+  }
+  if (statistics->Type == EValueType::Any) {
+    return;
+  }
+
+  bool ordered = type == EValueType::Int64
+    || type == EValueType::Uint64
+    || type == EValueType::Boolean
+    || (type == EValueType::Double && !std::isnan(value.Data.Double));
+  if (!ordered || (statistics->Type != EValueType::Null && statistics->Type != type)) {
+    statistics->Type = EValueType::Any;
+    return;
+  }
+
+  TValue bits;
+  bits.Data.Uint64 = type == EValueType::Boolean
+    ? value.Data.Boolean
+    : value.Data.Uint64;
+  if (statistics->Type == EValueType::Null) {
+    statistics->Type = type;
+    statistics->Min = bits.Data.Uint64;
+    statistics->Max = bits.Data.Uint64;
+    return;
+  }
+
+  TValue min;
+  TValue max;
+  min.Data.Uint64 = statistics->Min;
+  max.Data.Uint64 = statistics->Max;
+  switch (type) {
+    case EValueType::Int64:
+      min.Data.Int64 = std::min(min.Data.Int64, bits.Data.Int64);
+      max.Data.Int64 = std::max(max.Data.Int64, bits.Data.Int64);
+      break;
+    case EValueType::Double:
+      min.Data.Double = std::min(min.Data.Double, bits.Data.Double);
+      max.Data.Double = std::max(max.Data.Double, bits.Data.Double);
+      break;
+    default:
+      min.Data.Uint64 = std::min(min.Data.Uint64, bits.Data.Uint64);
+      max.Data.Uint64 = std::max(max.Data.Uint64, bits.Data.Uint64);
+      break;
+  }
+  statistics->Min = min.Data.Uint64;
+  statistics->Max = max.Data.Uint64;
+}
+
+// Adds a row to the statistics of a block with rowCount rows before it.
+// Columns first seen in this row were missing, so null, in those rows.
+void updateBlockStatistics(
+  std::vector<TColumnStatistics>* statistics,
+  ui64 rowCount,
+  const TValue* values,
+  int count)
+{
+  size_t oldColumnCount = statistics->size();
+  if (static_cast<size_t>(count) > oldColumnCount) {
+    statistics->resize(count);
+    for (size_t j = oldColumnCount; j < statistics->size(); j++) {
+      initColumnStatistics(&(*statistics)[j], rowCount);
+    }
+  }
+  for (size_t j = 0; j < statistics->size(); j++) {
+    if (j < static_cast<size_t>(count)) {
+      updateColumnStatistics(&(*statistics)[j], values[j]);
+    } else {
+      (*statistics)[j].NullCount++;
+    }
+  }
+}
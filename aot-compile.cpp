@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/IPO.h"
+#include "Builtins.h"
+#include "ExpressionLibrary.h"
+#include "ExpressionParser.h"
+#include "LLVMCodegen.h"
+#include "Optimize.h"
+#include "TargetFeatures.h"
+using namespace llvm;
+
+// Compiles a file of expressions into a shared object that workers load
+// with TExpressionLibrary instead of compiling them at startup:
+//
+//   aot-compile.out [--target portable|host] <expressions> <library.so>
+//   aot-compile.out --list <library.so>
+//
+// Every non-empty line of the expressions file not starting with '#' reads
+// "<name> = <expression>", in the syntax of TExpressionParser. Libraries are
+// built for the least capable target variant by default, so that they load
+// on any host; "--target host" builds for this host only.
+
+struct TNamedExpression {
+  std::string Name;
+  std::string Source;
+  TConstExpressionPtr Expr;
+};
+
+bool isIdentifier(const std::string& name)
+{
+  if (name.empty() || isdigit(name[0])) {
+    return false;
+  }
+  for (size_t i = 0; i < name.size(); i++) {
+    if (!isalnum(name[i]) && name[i] != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string trim(const std::string& text)
+{
+  size_t begin = text.find_first_not_of(" \t\r");
+  size_t end = text.find_last_not_of(" \t\r");
+  return begin == std::string::npos ? "" : text.substr(begin, end - begin + 1);
+}
+
+bool readExpressions(
+  const char* path,
+  TExpressionArena* arena,
+  std::vector<TNamedExpression>* expressions)
+{
+  std::ifstream input(path);
+  if (!input) {
+    fprintf(stderr, "%s: cannot open\n", path);
+    return false;
+  }
+
+  TExpressionParser parser(arena);
+  std::string line;
+  for (int lineNumber = 1; std::getline(input, line); lineNumber++) {
+    line = trim(line);
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+
+    size_t equals = line.find('=');
+    TNamedExpression expression;
+    expression.Name = trim(line.substr(0, equals));
+    if (equals == std::string::npos || !isIdentifier(expression.Name)) {
+      fprintf(stderr, "%s:%d: expected <name> = <expression>\n", path, lineNumber);
+      return false;
+    }
+    for (auto other = expressions->begin(); other != expressions->end(); other++) {
+      if (other->Name == expression.Name) {
+        fprintf(stderr, "%s:%d: %s is defined twice\n", path, lineNumber, expression.Name.c_str());
+        return false;
+      }
+    }
+
+    expression.Source = trim(line.substr(equals + 1));
+    std::string error;
+    expression.Expr = parser.Parse(expression.Source, &error);
+    if (!expression.Expr) {
+      fprintf(stderr, "%s:%d: %s: %s\n", path, lineNumber, expression.Name.c_str(), error.c_str());
+      return false;
+    }
+    expressions->push_back(expression);
+  }
+  return true;
+}
+
+void addLibraryGlobals(Module* module, const std::string& manifest)
+{
+  LLVMContext& context = getGlobalContext();
+
+  TExpressionLibraryABI abi = getExpressionLibraryABI();
+  Constant* abiData = ConstantDataArray::get(
+    context,
+    ArrayRef<uint32_t>((const uint32_t*)&abi, sizeof(abi) / sizeof(uint32_t)));
+  new GlobalVariable(
+    *module,
+    abiData->getType(),
+    true,
+    GlobalValue::ExternalLinkage,
+    abiData,
+    "yt_expression_library_abi");
+
+  Constant* manifestData = ConstantDataArray::getString(context, manifest, true);
+  new GlobalVariable(
+    *module,
+    manifestData->getType(),
+    true,
+    GlobalValue::ExternalLinkage,
+    manifestData,
+    "yt_expression_library_manifest");
+}
+
+TargetMachine* createTargetMachine(const TTargetFeatures& features, const std::string& triple)
+{
+  std::string error;
+  const Target* target = TargetRegistry::lookupTarget(triple, error);
+  if (!target) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return NULL;
+  }
+
+  std::string attributes;
+  for (size_t i = 0; i < features.Attributes.size(); i++) {
+    attributes += (i ? "," : "") + features.Attributes[i];
+  }
+  return target->createTargetMachine(
+    triple,
+    features.CPU,
+    attributes,
+    TargetOptions(),
+    Reloc::PIC_,
+    CodeModel::Default,
+    CodeGenOpt::Aggressive);
+}
+
+bool emitObject(Module* module, TargetMachine* targetMachine, const std::string& path)
+{
+  std::string error;
+  raw_fd_ostream output(path.c_str(), error, sys::fs::F_None);
+  if (!error.empty()) {
+    fprintf(stderr, "%s: %s\n", path.c_str(), error.c_str());
+    return false;
+  }
+  formatted_raw_ostream formattedOutput(output);
+
+  PassManager passManager;
+  passManager.add(new DataLayoutPass(module));
+  if (targetMachine->addPassesToEmitFile(
+        passManager,
+        formattedOutput,
+        TargetMachine::CGFT_ObjectFile)) {
+    fprintf(stderr, "target cannot emit object files\n");
+    return false;
+  }
+  passManager.run(*module);
+  return true;
+}
+
+// Runs a program with arguments, without going through a shell, and returns
+// whether it exited with status 0.
+bool runProgram(const std::vector<std::string>& arguments)
+{
+  std::vector<char*> argv;
+  for (auto argument = arguments.begin(); argument != arguments.end(); argument++) {
+    argv.push_back(const_cast<char*>(argument->c_str()));
+  }
+  argv.push_back(NULL);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    return false;
+  }
+  if (pid == 0) {
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+  int status;
+  if (waitpid(pid, &status, 0) != pid) {
+    return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int compileLibrary(
+  const TTargetFeatures& target,
+  const char* expressionsPath,
+  const std::string& libraryPath)
+{
+  TExpressionArena arena;
+  std::vector<TNamedExpression> expressions;
+  if (!readExpressions(expressionsPath, &arena, &expressions)) {
+    return 1;
+  }
+
+  TExpressionManifest manifest;
+  manifest.Target = target;
+  LLVMCodegen codegen;
+  for (auto expression = expressions.begin(); expression != expressions.end(); expression++) {
+    codegen.EmitRowFunction(expression->Expr, expression->Name);
+    TExpressionManifest::TEntry entry;
+    entry.Name = expression->Name;
+    entry.Type = typeOf(expression->Expr);
+    entry.Source = expression->Source;
+    manifest.Expressions.push_back(entry);
+  }
+  Module* module = codegen.LinkFunctions();
+  std::string manifestText = manifest.Format();
+  addLibraryGlobals(module, manifestText);
+
+  std::string triple = sys::getProcessTriple();
+  std::unique_ptr<TargetMachine> targetMachine(createTargetMachine(target, triple));
+  if (!targetMachine) {
+    return 1;
+  }
+  module->setTargetTriple(triple);
+
+  // Only the row functions and the library globals are exported, so that
+  // builtins are inlined and dropped.
+  std::vector<std::string> exportNames;
+  for (auto expression = expressions.begin(); expression != expressions.end(); expression++) {
+    exportNames.push_back(expression->Name);
+    exportNames.push_back(expression->Name + "_batch");
+  }
+  exportNames.push_back("yt_expression_library_abi");
+  exportNames.push_back("yt_expression_library_manifest");
+  std::vector<const char*> exports;
+  for (auto name = exportNames.begin(); name != exportNames.end(); name++) {
+    exports.push_back(name->c_str());
+  }
+  PassManager internalizer;
+  internalizer.add(createInternalizePass(exports));
+  internalizer.run(*module);
+
+  optimize(module, targetMachine->getDataLayout());
+
+  std::string objectPath = libraryPath + ".o";
+  if (!emitObject(module, targetMachine.get(), objectPath)) {
+    return 1;
+  }
+  std::vector<std::string> link = { "clang", "-shared", objectPath, "-o", libraryPath };
+  bool linked = runProgram(link);
+  unlink(objectPath.c_str());
+  if (!linked) {
+    fprintf(stderr, "clang -shared %s -o %s failed\n", objectPath.c_str(), libraryPath.c_str());
+    return 1;
+  }
+
+  std::ofstream manifestOutput((libraryPath + ".manifest").c_str());
+  manifestOutput << manifestText;
+  return 0;
+}
+
+int listLibrary(const char* path)
+{
+  std::string error;
+  TExpressionLibrary* library = TExpressionLibrary::Load(path, &error);
+  if (!library) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  printf("target %s\n", library->GetManifest().Target.GetKey().c_str());
+  for (auto expression = library->GetExpressions().begin();
+       expression != library->GetExpressions().end();
+       expression++) {
+    printf("%s: %s = %s\n",
+      expression->Name.c_str(),
+      getValueTypeName(expression->Type),
+      expression->Source.c_str());
+  }
+  delete library;
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc == 3 && strcmp(argv[1], "--list") == 0) {
+    return listLibrary(argv[2]);
+  }
+
+  const TTargetFeatures* target = &getTargetVariants().front();
+  int arg = 1;
+  if (argc == 5 && strcmp(argv[1], "--target") == 0) {
+    if (strcmp(argv[2], "host") == 0) {
+      target = &getHostTargetFeatures();
+    } else if (strcmp(argv[2], "portable") != 0) {
+      fprintf(stderr, "unknown target %s\n", argv[2]);
+      return 1;
+    }
+    arg = 3;
+  }
+  if (argc - arg != 2) {
+    fprintf(stderr,
+      "usage: %s [--target portable|host] <expressions> <library.so>\n"
+      "       %s --list <library.so>\n",
+      argv[0],
+      argv[0]);
+    return 1;
+  }
+
+  LLVMInitializeNativeTarget();
+  LLVMInitializeNativeAsmPrinter();
+  registerBuiltins();
+
+  return compileLibrary(*target, argv[arg], argv[arg + 1]);
+}
@@ -0,0 +1,1224 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/Support/TargetSelect.h"
+#include "Builtins.h"
+#include "ExpressionCompiler.h"
+#include "MorselExecutor.h"
+#include "NativeFunctions.h"
+#include "RowFile.h"
+#include "StaticExpression.h"
+#include "TExpressionInterpreter.h"
+using namespace llvm;
+
+// Measures compile latency and evaluation throughput of generated
+// expressions and prints the results as a single JSON document:
+//   { "compile": [...], "evaluation": [...], "scaling": [...], "pipeline": [...],
+//     "groupby": [...], "join": [...], "sort": [...], "rowfile": [...],
+//     "zonemap": [...], "dictionary": [...], "morsel": [...],
+//     "rowwriter": [...], "prefetch": [...] }
+// Times are in microseconds, throughput in rows per second. With
+// "--trace <file>" the compilations are also written as a Chrome trace.
+// Exits with 1 if any of the "matches_*" correctness checks fails.
+
+typedef std::chrono::steady_clock TClock;
+
+double elapsedMicroseconds(TClock::time_point start)
+{
+  return std::chrono::duration<double, std::micro>(TClock::now() - start).count();
+}
+
+/* Inputs */
+
+// Rows of columnCount values laid out one after another, as they would be
+// in a row block.
+struct TRowBuffer {
+  std::vector<ui64> Storage;
+  std::vector<TRow> Rows;
+  std::vector<TValue> Results;
+};
+
+void makeRows(TRowBuffer* buffer, int rowCount, int columnCount, EValueType type)
+{
+  size_t rowWords = (sizeof(TRowHeader) + columnCount * sizeof(TValue)) / sizeof(ui64);
+  buffer->Storage.assign(rowWords * rowCount, 0);
+  buffer->Rows.resize(rowCount);
+  buffer->Results.assign(rowCount, TExpressionInterpreter::makeValue(type));
+
+  ui64 seed = 42;
+  for (int i = 0; i < rowCount; i++) {
+    TRow row = (TRow)&buffer->Storage[i * rowWords];
+    row->Count = columnCount;
+    row->Padding = 0;
+    TValue* values = (TValue*)(row + 1);
+    for (int j = 0; j < columnCount; j++) {
+      seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+      values[j] = TExpressionInterpreter::makeValue(type);
+      values[j].Id = j;
+      if (type == EValueType::Double) {
+        values[j].Data.Double = (seed >> 40) / 1024.0;
+      } else {
+        values[j].Data.Int64 = (seed >> 40) % 1000;
+      }
+    }
+    buffer->Rows[i] = row;
+  }
+}
+
+/* Expression shapes */
+
+struct TShape {
+  const char* Name;
+  EValueType Type;
+};
+
+const TShape Shapes[] = {
+  // c0 + c1 + ... + cN
+  { "sum", EValueType::Int64 },
+  { "sum", EValueType::Double },
+  // c0 * c1 + c2 * c3 + ...
+  { "muladd", EValueType::Int64 },
+  // c0 < c1 && c2 < c3 && ...
+  { "conjunction", EValueType::Int64 },
+};
+
+const int Sizes[] = { 2, 8, 32, 128 };
+
+TConstExpressionPtr makeExpression(
+  TExpressionArena& arena,
+  const TShape& shape,
+  int size)
+{
+  std::string name(shape.Name);
+  if (name == "sum") {
+    TConstExpressionPtr expr = arena.NewReference(shape.Type, 0);
+    for (int i = 1; i < size; i++) {
+      expr = arena.NewBinaryOp(
+        EValueType::Null,
+        EBinaryOp::Plus,
+        expr,
+        arena.NewReference(shape.Type, i));
+    }
+    return expr;
+  }
+
+  EBinaryOp pairOp = name == "muladd" ? EBinaryOp::Multiply : EBinaryOp::Less;
+  EBinaryOp joinOp = name == "muladd" ? EBinaryOp::Plus : EBinaryOp::And;
+  TConstExpressionPtr expr = NULL;
+  for (int i = 0; i + 1 < size; i += 2) {
+    TConstExpressionPtr pair = arena.NewBinaryOp(
+      EValueType::Null,
+      pairOp,
+      arena.NewReference(shape.Type, i),
+      arena.NewReference(shape.Type, i + 1));
+    expr = expr
+      ? arena.NewBinaryOp(EValueType::Null, joinOp, expr, pair)
+      : pair;
+  }
+  return expr;
+}
+
+/* Evaluation */
+
+// Runs evaluate over rows, repeating until roughly targetRows rows have
+// been processed, and returns rows per second.
+template <class TEvaluate>
+double measureThroughput(const TRowBuffer& buffer, i64 targetRows, TEvaluate evaluate)
+{
+  i64 rowCount = buffer.Rows.size();
+  i64 repetitions = std::max<i64>(1, targetRows / rowCount);
+  TClock::time_point start = TClock::now();
+  for (i64 i = 0; i < repetitions; i++) {
+    evaluate();
+  }
+  double seconds = elapsedMicroseconds(start) / 1e6;
+  return repetitions * rowCount / seconds;
+}
+
+bool sameResults(const TRowBuffer& jit, const std::vector<TValue>& expected, EValueType type)
+{
+  for (size_t i = 0; i < expected.size(); i++) {
+    bool same = type == EValueType::Boolean
+      ? jit.Results[i].Data.Boolean == expected[i].Data.Boolean
+      : jit.Results[i].Data.Int64 == expected[i].Data.Int64;
+    if (!same) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Output */
+
+// Correctness checks that failed so far; main exits with 1 if there are any.
+int failedChecks = 0;
+
+// Returns the JSON value of the correctness check name, counting it and
+// reporting it on stderr if it failed.
+const char* checkResult(const char* name, bool passed)
+{
+  if (!passed) {
+    failedChecks++;
+    std::cerr << "check failed: " << name << std::endl;
+  }
+  return passed ? "true" : "false";
+}
+
+// Accumulates the records of one JSON array. The stream returned by Add()
+// stays valid until the next call to Add() or Print().
+class TJsonArray {
+public:
+  explicit TJsonArray(const char* name)
+    : Name(name)
+    , Pending(false)
+  { }
+
+  std::ostringstream& Add()
+  {
+    Commit();
+    Pending = true;
+    Current.str("");
+    return Current;
+  }
+
+  void Print(std::ostream& output, bool last)
+  {
+    Commit();
+    output << "  \"" << Name << "\": [";
+    for (size_t i = 0; i < Records.size(); i++) {
+      output << (i ? ",\n    " : "\n    ") << Records[i];
+    }
+    output << "\n  ]" << (last ? "\n" : ",\n");
+  }
+
+private:
+  const char* Name;
+  std::vector<std::string> Records;
+  std::ostringstream Current;
+  bool Pending;
+
+  void Commit()
+  {
+    if (Pending) {
+      Records.push_back("{" + Current.str() + "}");
+      Pending = false;
+    }
+  }
+};
+
+/* Pipelines */
+
+// WHERE c0 < 500, SELECT c1 + c2, sum(c1 * c3), count(*), max(c2).
+TPipeline makeBenchmarkPipeline(TExpressionArena& arena)
+{
+  TValue threshold = TExpressionInterpreter::makeValue(EValueType::Int64);
+  threshold.Data.Int64 = 500;
+  auto column = [&] (int index) { return arena.NewReference(EValueType::Int64, index); };
+
+  TPipeline pipeline;
+  pipeline.Predicate = arena.NewBinaryOp(
+    EValueType::Null, EBinaryOp::Less, column(0), arena.NewLiteral(threshold));
+  pipeline.Projections.push_back(arena.NewBinaryOp(
+    EValueType::Null, EBinaryOp::Plus, column(1), column(2)));
+  pipeline.Aggregates.push_back({
+    EAggregateFunction::Sum,
+    arena.NewBinaryOp(EValueType::Null, EBinaryOp::Multiply, column(1), column(3))
+  });
+  pipeline.Aggregates.push_back({ EAggregateFunction::Count, NULL });
+  pipeline.Aggregates.push_back({ EAggregateFunction::Max, column(2) });
+  return pipeline;
+}
+
+// The benchmark pipeline run fused into one loop and as separate passes
+// with a materialized selection and intermediate results in between.
+void benchmarkPipeline(TJsonArray* records, int rowCount, i64 targetRows)
+{
+  TExpressionArena arena;
+  TPipeline pipeline = makeBenchmarkPipeline(arena);
+
+  TCompiledPipeline fused = compilePipeline(pipeline);
+  TCompiledExpression predicate = compileExpression(pipeline.Predicate);
+  TCompiledExpression projection = compileExpression(pipeline.Projections[0]);
+  TCompiledExpression sumArgument = compileExpression(pipeline.Aggregates[0].Argument);
+
+  TRowBuffer buffer;
+  makeRows(&buffer, rowCount, 4, EValueType::Int64);
+  std::vector<TValue> output(rowCount);
+  std::vector<ui64> states(getAggregateStateSlots(pipeline.Aggregates));
+
+  std::vector<TValue> fusedResults;
+  double fusedRate = measureThroughput(buffer, targetRows, [&] () {
+    initAggregateStates(pipeline.Aggregates, states.data());
+    fused.Function(buffer.Rows.data(), rowCount, output.data(), states.data());
+    fusedResults = finalizeAggregateStates(pipeline.Aggregates, states.data());
+  });
+
+  std::vector<TRow> selected(rowCount);
+  std::vector<TValue> sumArguments(rowCount);
+  i64 sum = 0;
+  i64 count = 0;
+  i64 max = 0;
+  double separateRate = measureThroughput(buffer, targetRows, [&] () {
+    predicate.BatchFunction(buffer.Rows.data(), buffer.Results.data(), rowCount);
+    count = 0;
+    for (int i = 0; i < rowCount; i++) {
+      if (buffer.Results[i].Data.Boolean) {
+        selected[count++] = buffer.Rows[i];
+      }
+    }
+    projection.BatchFunction(selected.data(), output.data(), count);
+    sumArgument.BatchFunction(selected.data(), sumArguments.data(), count);
+    sum = 0;
+    max = std::numeric_limits<i64>::min();
+    for (i64 i = 0; i < count; i++) {
+      sum += sumArguments[i].Data.Int64;
+      max = std::max(max, ((TValue*)(selected[i] + 1))[2].Data.Int64);
+    }
+  });
+
+  bool same = fusedResults[0].Data.Int64 == sum
+    && fusedResults[1].Data.Int64 == count
+    && fusedResults[2].Data.Int64 == max;
+
+  std::ostringstream& fusedRecord = records->Add();
+  fusedRecord << "\"rows\": " << rowCount
+    << ", \"evaluator\": \"fused\""
+    << ", \"rows_per_sec\": " << fusedRate
+    << ", \"matches_separate\": " << checkResult("matches_separate", same);
+  std::ostringstream& separateRecord = records->Add();
+  separateRecord << "\"rows\": " << rowCount
+    << ", \"evaluator\": \"separate\""
+    << ", \"rows_per_sec\": " << separateRate;
+
+  delete fused.Engine;
+  delete predicate.Engine;
+  delete projection.Engine;
+  delete sumArgument.Engine;
+}
+
+/* Morsels */
+
+// The benchmark pipeline run over morsels by an executor of one to
+// maxThreads threads, keeping the output in row order and not.
+void benchmarkMorsels(TJsonArray* records, int rowCount, i64 targetRows, int maxThreads)
+{
+  TExpressionArena arena;
+  TPipeline pipeline = makeBenchmarkPipeline(arena);
+  TCompiledPipeline compiled = compilePipeline(pipeline);
+
+  TRowBuffer buffer;
+  makeRows(&buffer, rowCount, 4, EValueType::Int64);
+
+  // Single-threaded reference.
+  std::vector<TValue> expectedOutput(rowCount * pipeline.Projections.size());
+  std::vector<ui64> states(getAggregateStateSlots(pipeline.Aggregates));
+  initAggregateStates(pipeline.Aggregates, states.data());
+  i64 expectedCount = compiled.Function(buffer.Rows.data(), rowCount, expectedOutput.data(), states.data());
+  expectedOutput.resize(expectedCount * pipeline.Projections.size());
+  std::vector<TValue> expected = finalizeAggregateStates(pipeline.Aggregates, states.data());
+
+  for (int threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+    TMorselExecutor executor(threadCount);
+    for (bool ordered : { true, false }) {
+      std::vector<TValue> output;
+      std::vector<ui64> mergedStates;
+      i64 count = 0;
+      double rate = measureThroughput(buffer, targetRows, [&] () {
+        count = runPipelineInParallel(
+          &executor,
+          compiled.Function,
+          pipeline,
+          buffer.Rows.data(),
+          rowCount,
+          ordered,
+          &output,
+          &mergedStates);
+      });
+
+      std::vector<TValue> aggregates = finalizeAggregateStates(pipeline.Aggregates, mergedStates.data());
+      bool same = count == expectedCount;
+      for (size_t i = 0; same && i < expected.size(); i++) {
+        same = aggregates[i].Data.Int64 == expected[i].Data.Int64;
+      }
+      for (size_t i = 0; same && ordered && i < expectedOutput.size(); i++) {
+        same = output[i].Data.Int64 == expectedOutput[i].Data.Int64;
+      }
+
+      std::ostringstream& record = records->Add();
+      record << "\"rows\": " << rowCount
+        << ", \"threads\": " << threadCount
+        << ", \"ordered\": " << (ordered ? "true" : "false")
+        << ", \"rows_per_sec\": " << rate
+        << ", \"stolen_morsels\": " << executor.GetStolenMorsels()
+        << ", \"matches_single_thread\": " << checkResult("matches_single_thread", same);
+    }
+  }
+
+  delete compiled.Engine;
+}
+
+/* Group by */
+
+// SELECT c0, sum(c1), count(*), min(c2), avg(c3) GROUP BY c0 over 1000
+// groups, compiled with one and several threads and written by hand over
+// std::unordered_map.
+void benchmarkGroupBy(TJsonArray* records, int rowCount, i64 targetRows, int maxThreads)
+{
+  TExpressionArena arena;
+  auto column = [&] (int index) { return arena.NewReference(EValueType::Int64, index); };
+
+  TGroupBy groupBy;
+  groupBy.Keys.push_back(column(0));
+  groupBy.Aggregates.push_back({ EAggregateFunction::Sum, column(1) });
+  groupBy.Aggregates.push_back({ EAggregateFunction::Count, NULL });
+  groupBy.Aggregates.push_back({ EAggregateFunction::Min, column(2) });
+  groupBy.Aggregates.push_back({ EAggregateFunction::Avg, column(3) });
+
+  TCompiledGroupBy compiled = compileGroupBy(groupBy);
+
+  TRowBuffer buffer;
+  makeRows(&buffer, rowCount, 4, EValueType::Int64);
+
+  struct TGroupState {
+    i64 Sum = 0;
+    i64 Count = 0;
+    i64 Min = std::numeric_limits<i64>::max();
+    double AvgSum = 0;
+  };
+  std::unordered_map<i64, TGroupState> expected;
+  double mapRate = measureThroughput(buffer, targetRows, [&] () {
+    expected.clear();
+    for (int i = 0; i < rowCount; i++) {
+      TValue* values = (TValue*)(buffer.Rows[i] + 1);
+      TGroupState& state = expected[values[0].Data.Int64];
+      state.Sum += values[1].Data.Int64;
+      state.Count++;
+      state.Min = std::min(state.Min, values[2].Data.Int64);
+      state.AvgSum += values[3].Data.Int64;
+    }
+  });
+
+  std::ostringstream& mapRecord = records->Add();
+  mapRecord << "\"rows\": " << rowCount
+    << ", \"evaluator\": \"unordered_map\""
+    << ", \"threads\": 1"
+    << ", \"rows_per_sec\": " << mapRate;
+
+  for (int threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+    TGroupByHashTable* table = NULL;
+    double rate = measureThroughput(buffer, targetRows, [&] () {
+      delete table;
+      table = aggregateInParallel(
+        compiled.Function,
+        groupBy,
+        buffer.Rows.data(),
+        rowCount,
+        threadCount);
+    });
+
+    bool same = table->GetGroupCount() == expected.size();
+    for (size_t i = 0; same && i < table->GetGroupCount(); i++) {
+      std::vector<TValue> group = table->GetGroup(i);
+      const TGroupState& state = expected[group[0].Data.Int64];
+      same = group[1].Data.Int64 == state.Sum
+        && group[2].Data.Int64 == state.Count
+        && group[3].Data.Int64 == state.Min
+        && group[4].Data.Double == state.AvgSum / state.Count;
+    }
+    delete table;
+
+    std::ostringstream& record = records->Add();
+    record << "\"rows\": " << rowCount
+      << ", \"evaluator\": \"jit\""
+      << ", \"threads\": " << threadCount
+      << ", \"rows_per_sec\": " << rate
+      << ", \"matches_unordered_map\": " << checkResult("matches_unordered_map", same);
+  }
+
+  delete compiled.Engine;
+}
+
+/* Joins */
+
+// build JOIN probe ON c0 * 1000 + c1, with as many build rows as probe
+// rows, so that most probe rows have no match. Run with a single partition
+// and with radix partitioning, and written by hand over
+// std::unordered_multimap.
+void benchmarkJoin(TJsonArray* records, int rowCount, i64 targetRows)
+{
+  TExpressionArena arena;
+  TValue thousand = TExpressionInterpreter::makeValue(EValueType::Int64);
+  thousand.Data.Int64 = 1000;
+  auto makeKey = [&] () {
+    return arena.NewBinaryOp(
+      EValueType::Null,
+      EBinaryOp::Plus,
+      arena.NewBinaryOp(
+        EValueType::Null,
+        EBinaryOp::Multiply,
+        arena.NewReference(EValueType::Int64, 0),
+        arena.NewLiteral(thousand)),
+      arena.NewReference(EValueType::Int64, 1));
+  };
+
+  TJoin join;
+  join.BuildKeys.push_back(makeKey());
+  join.ProbeKeys.push_back(makeKey());
+  TCompiledJoin compiled = compileJoin(join);
+
+  TRowBuffer buildSide;
+  makeRows(&buildSide, rowCount, 2, EValueType::Int64);
+  TRowBuffer probeSide;
+  makeRows(&probeSide, 2 * rowCount, 2, EValueType::Int64);
+  // Only probe with the second half, generated after the build side.
+  TRow* probeRows = probeSide.Rows.data() + rowCount;
+
+  auto keyOf = [] (TRow row) {
+    TValue* values = (TValue*)(row + 1);
+    return values[0].Data.Int64 * 1000 + values[1].Data.Int64;
+  };
+  std::unordered_multimap<i64, TRow> map;
+  i64 expectedMatches = 0;
+  double mapRate = measureThroughput(buildSide, targetRows, [&] () {
+    map.clear();
+    for (int i = 0; i < rowCount; i++) {
+      map.insert(std::make_pair(keyOf(buildSide.Rows[i]), buildSide.Rows[i]));
+    }
+    expectedMatches = 0;
+    for (int i = 0; i < rowCount; i++) {
+      auto range = map.equal_range(keyOf(probeRows[i]));
+      for (auto it = range.first; it != range.second; it++) {
+        expectedMatches++;
+      }
+    }
+  });
+
+  std::ostringstream& mapRecord = records->Add();
+  mapRecord << "\"rows\": " << rowCount
+    << ", \"evaluator\": \"unordered_multimap\""
+    << ", \"rows_per_sec\": " << mapRate
+    << ", \"matches\": " << expectedMatches;
+
+  for (int partitioned = 0; partitioned < 2; partitioned++) {
+    TJoinHashTable table(join.BuildKeys.size());
+    TJoinOutput output;
+    double rate = measureThroughput(buildSide, targetRows, [&] () {
+      table.Build(compiled.Build, buildSide.Rows.data(), rowCount, partitioned ? -1 : 0);
+      output.Clear();
+      compiled.Probe(probeRows, rowCount, table.GetHeader(), &output);
+    });
+
+    bool same = output.Size == expectedMatches;
+    for (i64 i = 0; same && i < output.Size; i++) {
+      same = keyOf(output.Data[i].Probe) == keyOf(output.Data[i].Build);
+    }
+
+    std::ostringstream& record = records->Add();
+    record << "\"rows\": " << rowCount
+      << ", \"evaluator\": \"jit\""
+      << ", \"partitions\": " << table.GetPartitionCount()
+      << ", \"rows_per_sec\": " << rate
+      << ", \"matches_unordered_multimap\": " << checkResult("matches_unordered_multimap", same);
+  }
+
+  delete compiled.Engine;
+}
+
+/* Sorting */
+
+// ORDER BY c0, c1 DESC with a comparator interpreting the keys and
+// switching on their types, with the generated comparator, by radix sort of
+// generated normalized keys, and with LIMIT 10 through TTopK.
+void benchmarkSort(TJsonArray* records, int rowCount, i64 targetRows)
+{
+  TExpressionArena arena;
+  TOrderBy orderBy;
+  orderBy.Keys.push_back({ arena.NewReference(EValueType::Int64, 0), false });
+  orderBy.Keys.push_back({ arena.NewReference(EValueType::Int64, 1), true });
+  TCompiledOrderBy compiled = compileOrderBy(orderBy);
+
+  TRowBuffer buffer;
+  makeRows(&buffer, rowCount, 2, EValueType::Int64);
+
+  auto compareInterpreted = [&] (TRow lhs, TRow rhs) {
+    for (const TSortKey& key : orderBy.Keys) {
+      TValue lhsValue = TExpressionInterpreter::evaluate(key.Expression, lhs);
+      TValue rhsValue = TExpressionInterpreter::evaluate(key.Expression, rhs);
+      int order = 0;
+      switch (lhsValue.Type) {
+        case EValueType::Int64:
+          order = (lhsValue.Data.Int64 > rhsValue.Data.Int64) - (lhsValue.Data.Int64 < rhsValue.Data.Int64);
+          break;
+        case EValueType::Uint64:
+          order = (lhsValue.Data.Uint64 > rhsValue.Data.Uint64) - (lhsValue.Data.Uint64 < rhsValue.Data.Uint64);
+          break;
+        case EValueType::Double:
+          order = (lhsValue.Data.Double > rhsValue.Data.Double) - (lhsValue.Data.Double < rhsValue.Data.Double);
+          break;
+        default:
+          order = lhsValue.Data.Boolean - rhsValue.Data.Boolean;
+          break;
+      }
+      if (order) {
+        return key.Descending ? order > 0 : order < 0;
+      }
+    }
+    return false;
+  };
+
+  std::vector<TRow> expected;
+  std::vector<TRow> sorted;
+  auto sameKeys = [&] (const std::vector<TRow>& rows, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      if (compiled.Compare(rows[i], expected[i]) != 0) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  double interpretedRate = measureThroughput(buffer, targetRows, [&] () {
+    expected = buffer.Rows;
+    std::sort(expected.begin(), expected.end(), compareInterpreted);
+  });
+  double comparatorRate = measureThroughput(buffer, targetRows, [&] () {
+    sorted = buffer.Rows;
+    std::sort(sorted.begin(), sorted.end(), [&] (TRow lhs, TRow rhs) {
+      return compiled.Compare(lhs, rhs) < 0;
+    });
+  });
+  bool comparatorSame = sameKeys(sorted, rowCount);
+  double radixRate = measureThroughput(buffer, targetRows, [&] () {
+    sorted = buffer.Rows;
+    sortRows(compiled.Compare, compiled.SortKeys, compiled.KeyCount, sorted.data(), rowCount);
+  });
+  bool radixSame = sameKeys(sorted, rowCount);
+
+  const size_t limit = 10;
+  std::vector<TRow> top;
+  double topKRate = measureThroughput(buffer, targetRows, [&] () {
+    TTopK topK(compiled.Compare, limit);
+    topK.Add(buffer.Rows.data(), rowCount);
+    top = topK.GetRows();
+  });
+  bool topKSame = sameKeys(top, std::min<size_t>(limit, rowCount));
+
+  const char* evaluators[] = { "interpreted_comparator", "jit_comparator", "jit_radix", "jit_top_10" };
+  double rates[] = { interpretedRate, comparatorRate, radixRate, topKRate };
+  int same[] = { -1, comparatorSame, radixSame, topKSame };
+  for (int i = 0; i < 4; i++) {
+    std::ostringstream& record = records->Add();
+    record << "\"rows\": " << rowCount
+      << ", \"evaluator\": \"" << evaluators[i] << "\""
+      << ", \"rows_per_sec\": " << rates[i];
+    if (same[i] >= 0) {
+      record << ", \"matches_interpreted\": " << checkResult("matches_interpreted", same[i]);
+    }
+  }
+
+  delete compiled.Engine;
+}
+
+/* Row files */
+
+// Writes the rows of buffer to a temporary row file and maps it back.
+// Returns NULL, with error set, on failure.
+TRowFileReader* writeRowFile(const TRowBuffer& buffer, std::string* error)
+{
+  char path[] = "/tmp/bench-rowfile-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    *error = "cannot create a temporary row file";
+    return NULL;
+  }
+  close(fd);
+
+  TRowFileWriter* writer = TRowFileWriter::Create(path, error);
+  bool written = writer != NULL;
+  for (size_t i = 0; written && i < buffer.Rows.size(); i++) {
+    written = writer->AddRow(buffer.Rows[i], error);
+  }
+  written = written && writer->Close(error);
+  delete writer;
+  TRowFileReader* reader = written ? TRowFileReader::Open(path, error) : NULL;
+  unlink(path);
+  return reader;
+}
+
+// c0 + c1 + c2 + c3 over rows in memory and over the same rows written to a
+// row file and mapped back.
+void benchmarkRowFile(TJsonArray* records, int rowCount, i64 targetRows)
+{
+  TExpressionArena arena;
+  TConstExpressionPtr expr = makeExpression(arena, Shapes[0], 4);
+  TCompiledExpression compiled = compileExpression(expr);
+
+  TRowBuffer buffer;
+  makeRows(&buffer, rowCount, 4, EValueType::Int64);
+
+  std::string error;
+  TRowFileReader* reader = writeRowFile(buffer, &error);
+  if (!reader) {
+    std::cerr << error << std::endl;
+    delete compiled.Engine;
+    return;
+  }
+
+  double memoryRate = measureThroughput(buffer, targetRows, [&] () {
+    compiled.BatchFunction(buffer.Rows.data(), buffer.Results.data(), rowCount);
+  });
+
+  std::vector<TValue> results(rowCount);
+  double mappedRate = measureThroughput(buffer, targetRows, [&] () {
+    TValue* output = results.data();
+    scanRowFile(reader, [&] (TRow* rows, i64 count) {
+      compiled.BatchFunction(rows, output, count);
+      output += count;
+    }, &error);
+  });
+
+  bool same = true;
+  for (int i = 0; i < rowCount; i++) {
+    same = same && results[i].Data.Int64 == buffer.Results[i].Data.Int64;
+  }
+
+  std::ostringstream& memoryRecord = records->Add();
+  memoryRecord << "\"rows\": " << rowCount
+    << ", \"source\": \"memory\""
+    << ", \"rows_per_sec\": " << memoryRate;
+  std::ostringstream& mappedRecord = records->Add();
+  mappedRecord << "\"rows\": " << rowCount
+    << ", \"source\": \"mmap\""
+    << ", \"blocks\": " << reader->GetBlockCount()
+    << ", \"rows_per_sec\": " << mappedRate
+    << ", \"matches_memory\": " << checkResult("matches_memory", same);
+
+  delete reader;
+  delete compiled.Engine;
+}
+
+/* Zone maps */
+
+// WHERE c0 >= n / 2 AND c0 < n / 2 + n / 10 over a row file sorted by c0,
+// as a time range over a log would be, scanning every block and only the
+// blocks whose zone maps the compiled block filter does not rule out.
+void benchmarkZoneMaps(TJsonArray* records, int rowCount, i64 targetRows)
+{
+  TExpressionArena arena;
+  TValue lower = TExpressionInterpreter::makeValue(EValueType::Int64);
+  lower.Data.Int64 = rowCount / 2;
+  TValue upper = TExpressionInterpreter::makeValue(EValueType::Int64);
+  upper.Data.Int64 = rowCount / 2 + rowCount / 10;
+  TConstExpressionPtr column = arena.NewReference(EValueType::Int64, 0);
+  TConstExpressionPtr predicate = arena.NewBinaryOp(
+    EValueType::Null,
+    EBinaryOp::And,
+    arena.NewBinaryOp(EValueType::Null, EBinaryOp::GreaterOrEqual, column, arena.NewLiteral(lower)),
+    arena.NewBinaryOp(EValueType::Null, EBinaryOp::Less, column, arena.NewLiteral(upper)));
+
+  TCompiledExpression compiled = compileExpression(predicate);
+  TCompiledBlockFilter filter = compileBlockFilter(predicate);
+
+  TRowBuffer buffer;
+  makeRows(&buffer, rowCount, 4, EValueType::Int64);
+  for (int i = 0; i < rowCount; i++) {
+    ((TValue*)(buffer.Rows[i] + 1))[0].Data.Int64 = i;
+  }
+
+  std::string error;
+  TRowFileReader* reader = writeRowFile(buffer, &error);
+  if (!reader) {
+    std::cerr << error << std::endl;
+    delete compiled.Engine;
+    delete filter.Engine;
+    return;
+  }
+
+  std::vector<TValue> results(rowCount);
+  auto scan = [&] (TBlockFilterFunction blockFilter, i64* matches, ui64* skippedBlocks) {
+    *matches = 0;
+    *skippedBlocks = 0;
+    scanRowFile(reader, [&] (TRow* rows, i64 count) {
+      compiled.BatchFunction(rows, results.data(), count);
+      for (i64 i = 0; i < count; i++) {
+        *matches += results[i].Data.Boolean;
+      }
+    }, &error, blockFilter, skippedBlocks);
+  };
+
+  i64 fullMatches;
+  ui64 fullSkipped;
+  double fullRate = measureThroughput(buffer, targetRows, [&] () {
+    scan(NULL, &fullMatches, &fullSkipped);
+  });
+  i64 prunedMatches;
+  ui64 prunedSkipped;
+  double prunedRate = measureThroughput(buffer, targetRows, [&] () {
+    scan(filter.Function, &prunedMatches, &prunedSkipped);
+  });
+
+  std::ostringstream& fullRecord = records->Add();
+  fullRecord << "\"rows\": " << rowCount
+    << ", \"scan\": \"full\""
+    << ", \"blocks\": " << reader->GetBlockCount()
+    << ", \"matches\": " << fullMatches
+    << ", \"rows_per_sec\": " << fullRate;
+  std::ostringstream& prunedRecord = records->Add();
+  prunedRecord << "\"rows\": " << rowCount
+    << ", \"scan\": \"pruned\""
+    << ", \"blocks\": " << reader->GetBlockCount()
+    << ", \"skipped_blocks\": " << prunedSkipped
+    << ", \"rows_per_sec\": " << prunedRate
+    << ", \"matches_full\": " << checkResult("matches_full", prunedMatches == fullMatches);
+
+  delete reader;
+  delete compiled.Engine;
+  delete filter.Engine;
+}
+
+/* Dictionary encoding */
+
+// c0 IN (3 strings) and c0 starting with a prefix over a string column of
+// 100 distinct values, compared string by string on every row and as a
+// compiled filter of the dictionary codes of the column, resolved once.
+void benchmarkDictionary(TJsonArray* records, int rowCount, i64 targetRows)
+{
+  std::vector<std::string> strings;
+  for (int i = 0; i < 100; i++) {
+    strings.push_back("region-" + std::to_string(i / 10) + std::to_string(i % 10));
+  }
+
+  TRowBuffer buffer;
+  makeRows(&buffer, rowCount, 1, EValueType::Int64);
+  for (int i = 0; i < rowCount; i++) {
+    TValue* value = (TValue*)(buffer.Rows[i] + 1);
+    const std::string& string = strings[value->Data.Uint64 % strings.size()];
+    value->Type = EValueType::String;
+    value->Length = string.size();
+    value->Data.String = string.data();
+  }
+  TDictionaryColumn column;
+  encodeStringColumn(buffer.Rows.data(), rowCount, 0, &column);
+
+  const TStringPredicate predicates[] = {
+    { EStringPredicateKind::In, { "region-03", "region-42", "region-77" } },
+    { EStringPredicateKind::Prefix, { "region-1" } }
+  };
+  const char* names[] = { "in", "prefix" };
+
+  std::vector<ui8> matches(rowCount);
+  for (int p = 0; p < 2; p++) {
+    i64 stringMatches = 0;
+    double stringRate = measureThroughput(buffer, targetRows, [&] () {
+      stringMatches = 0;
+      for (int i = 0; i < rowCount; i++) {
+        const TValue* value = (const TValue*)(buffer.Rows[i] + 1);
+        bool match = matchesStringPredicate(predicates[p], StringRef(value->Data.String, value->Length));
+        matches[i] = match;
+        stringMatches += match;
+      }
+    });
+
+    TClock::time_point start = TClock::now();
+    TCodePredicate resolved = resolveStringPredicate(predicates[p], column.Dictionary);
+    double resolveTime = elapsedMicroseconds(start);
+    TCompiledCodeFilter filter = compileCodeFilter(resolved);
+    i64 codeMatches = 0;
+    double codeRate = measureThroughput(buffer, targetRows, [&] () {
+      codeMatches = filter.Function(column.Codes.data(), rowCount, matches.data());
+    });
+
+    std::ostringstream& stringRecord = records->Add();
+    stringRecord << "\"rows\": " << rowCount
+      << ", \"predicate\": \"" << names[p] << "\""
+      << ", \"evaluator\": \"strings\""
+      << ", \"rows_per_sec\": " << stringRate;
+    std::ostringstream& codeRecord = records->Add();
+    codeRecord << "\"rows\": " << rowCount
+      << ", \"predicate\": \"" << names[p] << "\""
+      << ", \"evaluator\": \"codes\""
+      << ", \"resolve_us\": " << resolveTime
+      << ", \"rows_per_sec\": " << codeRate
+      << ", \"matches_strings\": " << checkResult("matches_strings", codeMatches == stringMatches);
+
+    delete filter.Engine;
+  }
+}
+
+/* Row writer */
+
+// Batches of rows below the benchmark pipeline threshold written out as
+// rows of c1 + c2 and c1 * c3, by generated code into a row writer reset
+// between batches, and copied from pipeline output into rows allocated and
+// freed one by one.
+void benchmarkRowWriter(TJsonArray* records, int rowCount, i64 targetRows)
+{
+  const int batchRows = 1024;
+
+  TExpressionArena arena;
+  TPipeline pipeline = makeBenchmarkPipeline(arena);
+  pipeline.Projections.push_back(arena.NewBinaryOp(
+    EValueType::Null,
+    EBinaryOp::Multiply,
+    arena.NewReference(EValueType::Int64, 1),
+    arena.NewReference(EValueType::Int64, 3)));
+  pipeline.Aggregates.clear();
+  int projectionCount = pipeline.Projections.size();
+
+  TCompiledMaterialize materialize = compileMaterialize(pipeline.Predicate, pipeline.Projections);
+  TCompiledPipeline projected = compilePipeline(pipeline);
+
+  TRowBuffer buffer;
+  makeRows(&buffer, rowCount, 4, EValueType::Int64);
+
+  auto sumRows = [&] (TRow* rows, i64 count) {
+    i64 sum = 0;
+    for (i64 i = 0; i < count; i++) {
+      const TValue* values = (const TValue*)(rows[i] + 1);
+      for (int j = 0; j < projectionCount; j++) {
+        sum += values[j].Data.Int64;
+      }
+    }
+    return sum;
+  };
+
+  TRowWriter writer;
+  i64 writerRows = 0;
+  i64 writerSum = 0;
+  double writerRate = measureThroughput(buffer, targetRows, [&] () {
+    writerRows = 0;
+    writerSum = 0;
+    for (int begin = 0; begin < rowCount; begin += batchRows) {
+      writer.Reset();
+      i64 written = materialize.Function(
+        buffer.Rows.data() + begin,
+        std::min(batchRows, rowCount - begin),
+        writer.GetHeader());
+      writerRows += written;
+      writerSum += sumRows(writer.GetRows(), written);
+    }
+  });
+
+  std::vector<TValue> output(batchRows * projectionCount);
+  std::vector<TRow> rows(batchRows);
+  std::vector<ui64> states(getAggregateStateSlots(pipeline.Aggregates));
+  i64 mallocRows = 0;
+  i64 mallocSum = 0;
+  double mallocRate = measureThroughput(buffer, targetRows, [&] () {
+    mallocRows = 0;
+    mallocSum = 0;
+    for (int begin = 0; begin < rowCount; begin += batchRows) {
+      i64 passed = projected.Function(
+        buffer.Rows.data() + begin,
+        std::min(batchRows, rowCount - begin),
+        output.data(),
+        states.data());
+      for (i64 i = 0; i < passed; i++) {
+        rows[i] = (TRow)malloc(sizeof(TRowHeader) + projectionCount * sizeof(TValue));
+        rows[i]->Count = projectionCount;
+        rows[i]->Padding = 0;
+        memcpy(rows[i] + 1, &output[i * projectionCount], projectionCount * sizeof(TValue));
+      }
+      mallocRows += passed;
+      mallocSum += sumRows(rows.data(), passed);
+      for (i64 i = 0; i < passed; i++) {
+        free(rows[i]);
+      }
+    }
+  });
+
+  std::ostringstream& writerRecord = records->Add();
+  writerRecord << "\"rows\": " << rowCount
+    << ", \"batch_rows\": " << batchRows
+    << ", \"output\": \"writer\""
+    << ", \"written_rows\": " << writerRows
+    << ", \"rows_per_sec\": " << writerRate
+    << ", \"matches_malloc\": "
+    << checkResult("matches_malloc", writerRows == mallocRows && writerSum == mallocSum);
+  std::ostringstream& mallocRecord = records->Add();
+  mallocRecord << "\"rows\": " << rowCount
+    << ", \"batch_rows\": " << batchRows
+    << ", \"output\": \"malloc\""
+    << ", \"rows_per_sec\": " << mallocRate;
+
+  delete materialize.Engine;
+  delete projected.Engine;
+}
+
+void describe(std::ostream& record, const TShape& shape, int size)
+{
+  record << "\"shape\": \"" << shape.Name << "\""
+    << ", \"type\": \"" << getValueTypeName(shape.Type) << "\""
+    << ", \"size\": " << size;
+}
+
+/* Prefetching */
+
+// Batch functions over rows visited in a random order, as rows scattered
+// across the heap are, compiled without prefetching and prefetching the
+// values of rows various distances ahead.
+void benchmarkPrefetch(TJsonArray* records, int rowCount, i64 targetRows)
+{
+  const int distances[] = { 0, 4, 16, 64 };
+  const int size = 8;
+
+  TRowBuffer buffer;
+  makeRows(&buffer, rowCount, size, EValueType::Int64);
+  ui64 seed = 42;
+  for (int i = rowCount - 1; i > 0; i--) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    std::swap(buffer.Rows[i], buffer.Rows[(seed >> 33) % (i + 1)]);
+  }
+
+  for (const TShape& shape : Shapes) {
+    if (shape.Type != EValueType::Int64) {
+      continue;
+    }
+    TExpressionArena arena;
+    TConstExpressionPtr expr = makeExpression(arena, shape, size);
+    EValueType resultType = typeOf(expr);
+
+    std::vector<TValue> expected;
+    for (int distance : distances) {
+      TCompileOptions options;
+      options.PrefetchDistance = distance;
+      TCompiledExpression compiled = compileExpression(expr, NULL, options);
+      double rate = measureThroughput(buffer, targetRows, [&] () {
+        compiled.BatchFunction(buffer.Rows.data(), buffer.Results.data(), rowCount);
+      });
+      if (distance == 0) {
+        expected = buffer.Results;
+      }
+
+      std::ostringstream& record = records->Add();
+      describe(record, shape, size);
+      record << ", \"rows\": " << rowCount
+        << ", \"prefetch_distance\": " << distance
+        << ", \"rows_per_sec\": " << rate
+        << ", \"matches_unprefetched\": "
+        << checkResult("matches_unprefetched", sameResults(buffer, expected, resultType));
+
+      delete compiled.Engine;
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  LLVMInitializeNativeTarget();
+  LLVMInitializeNativeAsmPrinter();
+  LLVMInitializeNativeAsmParser();
+  registerBuiltins();
+
+  const int compileRepetitions = 5;
+  const int rowCounts[] = { 1024, 65536, 1048576 };
+  const i64 targetRows = 1 << 24;
+  const int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+  TJsonArray compileRecords("compile");
+  TJsonArray evaluationRecords("evaluation");
+  TJsonArray scalingRecords("scaling");
+  TJsonArray pipelineRecords("pipeline");
+  TJsonArray groupByRecords("groupby");
+  TJsonArray joinRecords("join");
+  TJsonArray sortRecords("sort");
+  TJsonArray rowFileRecords("rowfile");
+  TJsonArray zoneMapRecords("zonemap");
+  TJsonArray dictionaryRecords("dictionary");
+  TJsonArray morselRecords("morsel");
+  TJsonArray rowWriterRecords("rowwriter");
+  TJsonArray prefetchRecords("prefetch");
+  std::vector<TCompileStatistics> trace;
+
+  for (const TShape& shape : Shapes) {
+    for (int size : Sizes) {
+      TExpressionArena arena;
+      TConstExpressionPtr expr = makeExpression(arena, shape, size);
+      EValueType resultType = typeOf(expr);
+
+      TCompileStatistics total;
+      for (int i = 0; i < compileRepetitions; i++) {
+        TCompileStatistics statistics;
+        delete compileExpression(expr, &statistics).Engine;
+        trace.push_back(statistics);
+        for (int phase = 0; phase < CompilePhaseCount; phase++) {
+          total.PhaseTime[phase] += statistics.PhaseTime[phase];
+        }
+        total.InstructionsBeforeOptimization = statistics.InstructionsBeforeOptimization;
+        total.InstructionsAfterOptimization = statistics.InstructionsAfterOptimization;
+        total.CodeBytes = statistics.CodeBytes;
+      }
+      std::ostringstream& record = compileRecords.Add();
+      describe(record, shape, size);
+      for (int phase = 0; phase < CompilePhaseCount; phase++) {
+        record << ", \"" << getCompilePhaseName(static_cast<ECompilePhase>(phase))
+          << "_us\": " << double(total.PhaseTime[phase]) / compileRepetitions;
+      }
+      record << ", \"instructions_before\": " << total.InstructionsBeforeOptimization
+        << ", \"instructions_after\": " << total.InstructionsAfterOptimization
+        << ", \"code_bytes\": " << total.CodeBytes;
+
+      TCompiledExpression compiled = compileExpression(expr);
+      TBatchFunction batch = compiled.BatchFunction;
+
+      // Cost of counting every node (see TExpressionProfile).
+      TExpressionProfile profile(expr);
+      profile.InstrumentAll();
+      TCompileOptions instrumentedOptions;
+      instrumentedOptions.Profile = &profile;
+      TCompiledExpression instrumented = compileExpression(expr, NULL, instrumentedOptions);
+
+      for (int rowCount : rowCounts) {
+        TRowBuffer buffer;
+        makeRows(&buffer, rowCount, size, shape.Type);
+
+        double jitRate = measureThroughput(buffer, targetRows, [&] () {
+          batch(buffer.Rows.data(), buffer.Results.data(), rowCount);
+        });
+
+        std::vector<TValue> expected(rowCount);
+        double interpreterRate = measureThroughput(buffer, targetRows, [&] () {
+          for (int i = 0; i < rowCount; i++) {
+            expected[i] = TExpressionInterpreter::evaluate(expr, buffer.Rows[i]);
+          }
+        });
+
+        std::ostringstream& jitRecord = evaluationRecords.Add();
+        describe(jitRecord, shape, size);
+        jitRecord << ", \"rows\": " << rowCount
+          << ", \"evaluator\": \"jit\""
+          << ", \"rows_per_sec\": " << jitRate
+          << ", \"matches_interpreter\": "
+          << checkResult("matches_interpreter", sameResults(buffer, expected, resultType));
+
+        double instrumentedRate = measureThroughput(buffer, targetRows, [&] () {
+          instrumented.BatchFunction(buffer.Rows.data(), buffer.Results.data(), rowCount);
+        });
+
+        std::ostringstream& instrumentedRecord = evaluationRecords.Add();
+        describe(instrumentedRecord, shape, size);
+        instrumentedRecord << ", \"rows\": " << rowCount
+          << ", \"evaluator\": \"jit_instrumented\""
+          << ", \"rows_per_sec\": " << instrumentedRate;
+
+        std::ostringstream& interpreterRecord = evaluationRecords.Add();
+        describe(interpreterRecord, shape, size);
+        interpreterRecord << ", \"rows\": " << rowCount
+          << ", \"evaluator\": \"interpreter\""
+          << ", \"rows_per_sec\": " << interpreterRate;
+
+        // func from llvm-experiments computes exactly c0 + c1.
+        if (std::string(shape.Name) == "sum"
+            && shape.Type == EValueType::Int64
+            && size == 2) {
+          double nativeRate = measureThroughput(buffer, targetRows, [&] () {
+            for (int i = 0; i < rowCount; i++) {
+              func(buffer.Rows[i], &buffer.Results[i]);
+            }
+          });
+          std::ostringstream& nativeRecord = evaluationRecords.Add();
+          describe(nativeRecord, shape, size);
+          nativeRecord << ", \"rows\": " << rowCount
+            << ", \"evaluator\": \"native\""
+            << ", \"rows_per_sec\": " << nativeRate;
+
+          // So does the same expression built at compile time.
+          TBatchFunction staticBatch = TStaticExpression::getBatchFunction(
+            TStaticExpression::column<EValueType::Int64, 0>()
+              + TStaticExpression::column<EValueType::Int64, 1>());
+          double staticRate = measureThroughput(buffer, targetRows, [&] () {
+            staticBatch(buffer.Rows.data(), buffer.Results.data(), rowCount);
+          });
+          std::ostringstream& staticRecord = evaluationRecords.Add();
+          describe(staticRecord, shape, size);
+          staticRecord << ", \"rows\": " << rowCount
+            << ", \"evaluator\": \"static\""
+            << ", \"rows_per_sec\": " << staticRate
+            << ", \"matches_interpreter\": "
+            << checkResult("matches_interpreter", sameResults(buffer, expected, resultType));
+        }
+      }
+
+      // Scaling with threads over the largest input, split into one
+      // contiguous range per thread.
+      TRowBuffer buffer;
+      int rowCount = rowCounts[sizeof(rowCounts) / sizeof(rowCounts[0]) - 1];
+      makeRows(&buffer, rowCount, size, shape.Type);
+      for (int threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+        double rate = measureThroughput(buffer, targetRows, [&] () {
+          std::vector<std::thread> threads;
+          i64 rangeSize = (rowCount + threadCount - 1) / threadCount;
+          for (int t = 0; t < threadCount; t++) {
+            i64 begin = t * rangeSize;
+            i64 end = std::min<i64>(rowCount, begin + rangeSize);
+            threads.push_back(std::thread([&, begin, end] () {
+              batch(&buffer.Rows[begin], &buffer.Results[begin], end - begin);
+            }));
+          }
+          for (auto& thread : threads) {
+            thread.join();
+          }
+        });
+        std::ostringstream& record = scalingRecords.Add();
+        describe(record, shape, size);
+        record << ", \"rows\": " << rowCount
+          << ", \"threads\": " << threadCount
+          << ", \"rows_per_sec\": " << rate;
+      }
+
+      delete compiled.Engine;
+      delete instrumented.Engine;
+    }
+  }
+
+  for (int rowCount : rowCounts) {
+    benchmarkPipeline(&pipelineRecords, rowCount, targetRows);
+    benchmarkGroupBy(&groupByRecords, rowCount, targetRows, maxThreads);
+    benchmarkJoin(&joinRecords, rowCount, targetRows);
+    // Sorting is n log n: fewer repetitions keep the interpreted comparator
+    // bearable.
+    benchmarkSort(&sortRecords, rowCount, targetRows / 16);
+    benchmarkRowFile(&rowFileRecords, rowCount, targetRows);
+    benchmarkZoneMaps(&zoneMapRecords, rowCount, targetRows);
+    benchmarkDictionary(&dictionaryRecords, rowCount, targetRows);
+    benchmarkRowWriter(&rowWriterRecords, rowCount, targetRows);
+    benchmarkPrefetch(&prefetchRecords, rowCount, targetRows);
+  }
+  benchmarkMorsels(
+    &morselRecords,
+    rowCounts[sizeof(rowCounts) / sizeof(rowCounts[0]) - 1],
+    targetRows,
+    maxThreads);
+
+  std::cout << "{\n";
+  compileRecords.Print(std::cout, false);
+  evaluationRecords.Print(std::cout, false);
+  scalingRecords.Print(std::cout, false);
+  pipelineRecords.Print(std::cout, false);
+  groupByRecords.Print(std::cout, false);
+  joinRecords.Print(std::cout, false);
+  sortRecords.Print(std::cout, false);
+  rowFileRecords.Print(std::cout, false);
+  zoneMapRecords.Print(std::cout, false);
+  dictionaryRecords.Print(std::cout, false);
+  morselRecords.Print(std::cout, false);
+  rowWriterRecords.Print(std::cout, false);
+  prefetchRecords.Print(std::cout, true);
+  std::cout << "}" << std::endl;
+
+  if (argc == 3 && strcmp(argv[1], "--trace") == 0) {
+    std::ofstream traceFile(argv[2]);
+    exportChromeTrace(traceFile, trace);
+  }
+  return failedChecks ? 1 : 0;
+}
@@ -23,15 +23,13 @@
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "YTTypes.h"
+#include "NativeFunctions.h"
+#include "Optimize.h"
+#include "PerfJITEventListener.h"
+#include "TargetFeatures.h"
 using namespace llvm;
 using namespace object;
 
-void func(TRow row, TValue* result)
-{
-  TValue* values = (TValue*)(row + 1);
-  result->Data.Int64 = values[0].Data.Int64 + values[1].Data.Int64;
-}
-
 void addFuncIRToModule(Module* module)
 {
   LLVMContext &context = getGlobalContext();
@@ -128,10 +126,14 @@ uint64_t SharedObjectMemoryManager::getSymbolAddress(const std::string &Name)
 }
 
 ExecutionEngine* getObjectEngine(Module* module) {
-  return EngineBuilder(module)
+  EngineBuilder builder(module);
+  builder
     .setUseMCJIT(true)
-    .setMCJITMemoryManager(new SharedObjectMemoryManager())
-    .create();
+    .setMCJITMemoryManager(new SharedObjectMemoryManager());
+  applyTargetFeatures(builder, getHostTargetFeatures());
+  ExecutionEngine* engine = builder.create();
+  registerPerfJITEventListener(engine);
+  return engine;
 }
 
 /* UDFs from LLVM IR */
@@ -171,42 +173,13 @@ uint64_t IRMemoryManager::getSymbolAddress(const std::string &Name)
 }
 
 ExecutionEngine* getIREngine(Module* module) {
-  return EngineBuilder(module)
-    .setUseMCJIT(true)
-    //.setMCJITMemoryManager(new IRMemoryManager())
-    .create();
-}
-
-void optimize(Module* module, ExecutionEngine* engine) {
-  std::cout << "BEFORE OPTIMIZATIONS" << std::endl;
-  module->dump();
-  PassManagerBuilder passManagerBuilder;
-  passManagerBuilder.OptLevel = 2;
-  passManagerBuilder.SizeLevel = 0;
-  passManagerBuilder.Inliner = createFunctionInliningPass();
-
-  FunctionPassManager* functionPassManager = new legacy::FunctionPassManager(module);
-  PassManager* modulePassManager = new PassManager();
-
-  module->setDataLayout(engine->getDataLayout()->getStringRepresentation());
-  functionPassManager->add(new DataLayoutPass(module));
-  passManagerBuilder.populateFunctionPassManager(*functionPassManager);
-
-  functionPassManager->doInitialization();
-  for (auto it = module->begin(), jt = module->end(); it != jt; ++it) {
-      if (!it->isDeclaration()) {
-          functionPassManager->run(*it);
-      }
-  }
-  functionPassManager->doFinalization();
-
-  modulePassManager->add(new DataLayoutPass(module));
-  passManagerBuilder.populateModulePassManager(*modulePassManager);
-
-  modulePassManager->run(*module);
-
-  std::cout << "AFTER OPTIMIZATIONS" << std::endl;
-  module->dump();
+  EngineBuilder builder(module);
+  builder
+    .setUseMCJIT(true);
+  applyTargetFeatures(builder, getHostTargetFeatures());
+  ExecutionEngine* engine = builder.create();
+  registerPerfJITEventListener(engine);
+  return engine;
 }
 
 int main(int argc, char** argv)
@@ -243,7 +216,11 @@ int main(int argc, char** argv)
     srcArgs->replaceAllUsesWith(destArgs);
   }
 
+  std::cout << "BEFORE OPTIMIZATIONS" << std::endl;
+  module->dump();
   optimize(module, engine);
+  std::cout << "AFTER OPTIMIZATIONS" << std::endl;
+  module->dump();
 
   engine->finalizeObject();
   void* funcPtr = engine->getPointerToNamedFunction("func");
@@ -121,29 +121,21 @@ Module* emitExp(IRBuilder<>& builder)
 void testPlusInt()
 {
   // 1 + 2 + 3
-  std::shared_ptr<TValue> one = std::make_shared<TValue>();
-  one->Id = 0; one->Type = EValueType::Int64; one->Length = 0;
-  one->Data = { 1 };
-  std::shared_ptr<TValue> two = std::make_shared<TValue>();
-  two->Id = 0; two->Type = EValueType::Int64; two->Length = 0;
-  two->Data = { 2 };
-  std::shared_ptr<TValue> three = std::make_shared<TValue>();
-  three->Id = 0; three->Type = EValueType::Int64; three->Length = 0;
-  three->Data = { 3 };
-
-  TConstExpressionPtr oneExpr =
-    std::make_shared<TLiteralExpression>(EValueType::Int64, one);
-  TConstExpressionPtr twoExpr =
-    std::make_shared<TLiteralExpression>(EValueType::Int64, two);
-  TConstExpressionPtr threeExpr =
-    std::make_shared<TLiteralExpression>(EValueType::Int64, three);
-
-  std::shared_ptr<TExpression> expr1 =
-    std::make_shared<TBinaryOpExpression>(
+  TValue one = { 0, EValueType::Int64, 0, { 1 } };
+  TValue two = { 0, EValueType::Int64, 0, { 2 } };
+  TValue three = { 0, EValueType::Int64, 0, { 3 } };
+
+  TExpressionArena arena;
+  TConstExpressionPtr oneExpr = arena.NewLiteral(one);
+  TConstExpressionPtr twoExpr = arena.NewLiteral(two);
+  TConstExpressionPtr threeExpr = arena.NewLiteral(three);
+
+  TConstExpressionPtr expr1 =
+    arena.NewBinaryOp(
       EValueType::Null,
       EBinaryOp::Plus,
       oneExpr,
-      std::make_shared<TBinaryOpExpression>(
+      arena.NewBinaryOp(
         EValueType::Null,
         EBinaryOp::Plus,
         twoExpr,
@@ -164,29 +156,24 @@ void testPlusInt()
 
 void testPlusDouble()
 {
-  std::shared_ptr<TValue> one = std::make_shared<TValue>();
-  one->Id = 0; one->Type = EValueType::Double; one->Length = 0;
-  one->Data.Double = { 1.5 };
-  std::shared_ptr<TValue> two = std::make_shared<TValue>();
-  two->Id = 0; two->Type = EValueType::Double; two->Length = 0;
-  two->Data.Double = { 2.0 };
-  std::shared_ptr<TValue> three = std::make_shared<TValue>();
-  three->Id = 0; three->Type = EValueType::Double; three->Length = 0;
-  three->Data.Double = { 3.0 };
-
-  TConstExpressionPtr oneExpr =
-    std::make_shared<TLiteralExpression>(EValueType::Double, one);
-  TConstExpressionPtr twoExpr =
-    std::make_shared<TLiteralExpression>(EValueType::Double, two);
-  TConstExpressionPtr threeExpr =
-    std::make_shared<TLiteralExpression>(EValueType::Double, three);
-
-  std::shared_ptr<TExpression> expr =
-    std::make_shared<TBinaryOpExpression>(
+  TValue one = { 0, EValueType::Double, 0, { 0 } };
+  one.Data.Double = 1.5;
+  TValue two = { 0, EValueType::Double, 0, { 0 } };
+  two.Data.Double = 2.0;
+  TValue three = { 0, EValueType::Double, 0, { 0 } };
+  three.Data.Double = 3.0;
+
+  TExpressionArena arena;
+  TConstExpressionPtr oneExpr = arena.NewLiteral(one);
+  TConstExpressionPtr twoExpr = arena.NewLiteral(two);
+  TConstExpressionPtr threeExpr = arena.NewLiteral(three);
+
+  TConstExpressionPtr expr =
+    arena.NewBinaryOp(
       EValueType::Null,
       EBinaryOp::Plus,
       oneExpr,
-      std::make_shared<TBinaryOpExpression>(
+      arena.NewBinaryOp(
         EValueType::Null,
         EBinaryOp::Plus,
         twoExpr,
@@ -207,28 +194,20 @@ void testPlusDouble()
 
 void testMultiplyInt()
 {
-  std::shared_ptr<TValue> two = std::make_shared<TValue>();
-  two->Id = 0; two->Type = EValueType::Int64; two->Length = 0;
-  two->Data = { 2 };
-  std::shared_ptr<TValue> four = std::make_shared<TValue>();
-  four->Id = 0; four->Type = EValueType::Int64; four->Length = 0;
-  four->Data = { 4 };
-  std::shared_ptr<TValue> three = std::make_shared<TValue>();
-  three->Id = 0; three->Type = EValueType::Int64; three->Length = 0;
-  three->Data = { 3 };
-
-  TConstExpressionPtr twoExpr =
-    std::make_shared<TLiteralExpression>(EValueType::Int64, two);
-  TConstExpressionPtr fourExpr =
-    std::make_shared<TLiteralExpression>(EValueType::Int64, four);
-  TConstExpressionPtr threeExpr =
-    std::make_shared<TLiteralExpression>(EValueType::Int64, three);
-
-  std::shared_ptr<TExpression> expr =
-    std::make_shared<TBinaryOpExpression>(
+  TValue two = { 0, EValueType::Int64, 0, { 2 } };
+  TValue four = { 0, EValueType::Int64, 0, { 4 } };
+  TValue three = { 0, EValueType::Int64, 0, { 3 } };
+
+  TExpressionArena arena;
+  TConstExpressionPtr twoExpr = arena.NewLiteral(two);
+  TConstExpressionPtr fourExpr = arena.NewLiteral(four);
+  TConstExpressionPtr threeExpr = arena.NewLiteral(three);
+
+  TConstExpressionPtr expr =
+    arena.NewBinaryOp(
       EValueType::Null,
       EBinaryOp::Plus,
-      std::make_shared<TBinaryOpExpression>(
+      arena.NewBinaryOp(
         EValueType::Null,
         EBinaryOp::Multiply,
         twoExpr,
@@ -250,21 +229,16 @@ void testMultiplyInt()
 
 void testUdf()
 {
-  std::shared_ptr<TValue> two = std::make_shared<TValue>();
-  two->Id = 0; two->Type = EValueType::Int64; two->Length = 0;
-  two->Data = { 2 };
-  std::shared_ptr<TValue> four = std::make_shared<TValue>();
-  four->Id = 0; four->Type = EValueType::Int64; four->Length = 0;
-  four->Data = { 4 };
-
-  TConstExpressionPtr twoExpr =
-    std::make_shared<TLiteralExpression>(EValueType::Int64, two);
-  TConstExpressionPtr fourExpr =
-    std::make_shared<TLiteralExpression>(EValueType::Int64, four);
-  
+  TValue two = { 0, EValueType::Int64, 0, { 2 } };
+  TValue four = { 0, EValueType::Int64, 0, { 4 } };
+
+  TExpressionArena arena;
+  TConstExpressionPtr twoExpr = arena.NewLiteral(two);
+  TConstExpressionPtr fourExpr = arena.NewLiteral(four);
+
   TArguments args({ twoExpr, fourExpr });
-  std::shared_ptr<TExpression> expr =
-    std::make_shared<TFunctionExpression>(
+  TConstExpressionPtr expr =
+    arena.NewFunction(
       EValueType::Null,
       "_Z3expll",
       args);